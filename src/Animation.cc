@@ -25,10 +25,19 @@
 
 #include <assert.h>
 #include <fstream>
-#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "Animation.h"
-#include "string_utils.h"
+#include "CSVReader.h"
 
 using namespace std;
 
@@ -49,31 +58,34 @@ const VectorNd Animation::getStateLine(const size_t _stateIdx) const {
 }
 
 
+static bool keyframe_time_before (double time, const AnimationKeyFrame &keyframe) {
+	return time < keyframe.time;
+}
+
 void Animation::addPose (double time, const VectorNd &state) {
-	AnimationKeyFrame keyframe (time, state);
+	if (keyFrames.size() == 0 || keyFrames.rbegin()->time <= time) {
+		keyFrames.push_back (AnimationKeyFrame (time, state));
+		return;
+	}
 
-	vector<AnimationKeyFrame>::iterator iter = keyFrames.begin();
-	vector<AnimationKeyFrame>::iterator next = iter;
-	next++;
+	vector<AnimationKeyFrame>::iterator iter = std::upper_bound (keyFrames.begin(), keyFrames.end(), time, keyframe_time_before);
+	keyFrames.insert (iter, AnimationKeyFrame (time, state));
+}
 
-	if (iter == keyFrames.end()) {
-		keyFrames.push_back (keyframe);
-		return;
+void Animation::addPoses (const vector<AnimationKeyFrame> &poses) {
+	reserve (poses.size());
+
+	for (size_t i = 0; i < poses.size(); i++) {
+		addPose (poses[i].time, poses[i].state);
 	}
+}
 
-	do {
-		if (next == keyFrames.end()) {
-			keyFrames.insert (next, keyframe);
-			return;
-		} else {
-			if (next->time > time) {
-				keyFrames.insert (next, keyframe);
-				return;
-			}
-		}
-		iter = next;
-		next++;
-	} while (iter != keyFrames.end());
+void Animation::reserve (size_t frame_count) {
+	size_t required = keyFrames.size() + frame_count;
+
+	// keep the amortized growth when called for every few frames
+	if (required > keyFrames.capacity())
+		keyFrames.reserve (std::max (required, 2 * keyFrames.capacity()));
 }
 
 void Animation::setCurrentTime (double time) {
@@ -140,68 +152,230 @@ double Animation::getLastFrameTime() const {
 	return keyFrames.rbegin()->time;
 }
 
+static const char animation_magic[8] = { 'P', 'U', 'P', 'A', 'N', 'I', '0', '1' };
+
+/// Fixed size part of the binary header
+struct AnimationFileHeader {
+	char magic[8];
+	uint32_t stateCount;
+	uint32_t scalarSize;
+	uint64_t keyFrameCount;
+	double timeStart;
+	double timeStep;
+	uint32_t stateNameCount;
+};
+
+Animation::Format Animation::formatFromFilename (const std::string &filename) {
+	if (filename.size() > 5 && filename.substr (filename.size() - 5, 5) == ".anim")
+		return FormatBinary;
+
+	return FormatCSV;
+}
+
+static bool is_binary_animation (const unsigned char *data, size_t size) {
+	return size >= sizeof (AnimationFileHeader) && memcmp (data, animation_magic, sizeof (animation_magic)) == 0;
+}
+
+/** Reads a binary animation from the mapped file data. Returns false if
+ * the header is invalid or the file is truncated. */
+static bool load_binary_animation (const char *filename, const unsigned char *data, size_t size, Animation &animation) {
+	AnimationFileHeader header;
+	memcpy (&header, data, sizeof (header));
+
+	if ((header.scalarSize != 4 && header.scalarSize != 8)
+			|| (header.stateNameCount != 0 && header.stateNameCount != header.stateCount)) {
+		cerr << "Error: invalid header in animation file '" << filename << "'" << endl;
+		return false;
+	}
+
+	size_t offset = sizeof (header);
+
+	animation.stateNames.clear();
+	for (uint32_t i = 0; i < header.stateNameCount; i++) {
+		uint32_t length = 0;
+		if (offset + sizeof (length) > size) 
+			break;
+		memcpy (&length, data + offset, sizeof (length));
+		offset += sizeof (length);
+
+		if (offset + length > size)
+			break;
+		animation.stateNames.push_back (string (reinterpret_cast<const char*>(data + offset), length));
+		offset += length;
+	}
+
+	offset = (offset + 7) / 8 * 8;
+
+	// the counts come from the file, so they are checked by division such
+	// that corrupt values cannot overflow
+	uint64_t frame_count = header.keyFrameCount;
+	uint64_t frame_bytes = sizeof (double) + static_cast<uint64_t>(header.stateCount) * header.scalarSize;
+	if (animation.stateNames.size() != header.stateNameCount
+			|| offset > size
+			|| frame_count > (size - offset) / frame_bytes) {
+		cerr << "Error: truncated animation file '" << filename << "'" << endl;
+		animation.stateNames.clear();
+		return false;
+	}
+
+	animation.keyFrames.clear();
+	if (frame_count == 0)
+		return true;
+
+	const double *times = reinterpret_cast<const double*>(data + offset);
+	const unsigned char *states = data + offset + frame_count * sizeof (double);
+
+	animation.reserve (frame_count);
+
+	VectorNd state (header.stateCount);
+	for (uint64_t fi = 0; fi < frame_count; fi++) {
+		if (header.scalarSize == 8) {
+			memcpy (state.data(), states + fi * header.stateCount * sizeof (double), header.stateCount * sizeof (double));
+		} else {
+			const float *frame_state = reinterpret_cast<const float*>(states) + fi * header.stateCount;
+			for (uint32_t i = 0; i < header.stateCount; i++) {
+				state[i] = frame_state[i];
+			}
+		}
+
+		animation.addPose (times[fi], state);
+	}
+
+	return true;
+}
+
 bool Animation::loadFromFile (const char* filename) {
-	ifstream infile (filename);
-	if (!infile) {
+	int fd = open (filename, O_RDONLY);
+	if (fd != -1) {
+		struct stat file_stat;
+		bool binary = false;
+		bool result = false;
+
+		if (fstat (fd, &file_stat) == 0 && file_stat.st_size >= static_cast<off_t>(sizeof (AnimationFileHeader))) {
+			void *mapping = mmap (NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+				const unsigned char *data = static_cast<const unsigned char*>(mapping);
+				binary = is_binary_animation (data, file_stat.st_size);
+				if (binary)
+					result = load_binary_animation (filename, data, file_stat.st_size, *this);
+				munmap (mapping, file_stat.st_size);
+			}
+		}
+		close (fd);
+
+		if (binary)
+			return result;
+	}
+
+	CSVReader csv_reader;
+	if (!csv_reader.load (filename)) {
 		cerr << "Error reading animation file from '" << filename << "'" << endl;
 		abort();
 		return false;
 	}
 
 	keyFrames.clear();
+	stateNames.clear();
 
-	int line_index = 0;
-	string line;
-	string previous_line;
+	reserve (csv_reader.getRowCount());
 
-	while (!infile.eof()) {
-		previous_line = line;
-		getline (infile, line);
+	// rows whose first entry is not a number were skipped by the reader
+	for (size_t ri = 0; ri < csv_reader.getRowCount(); ri++) {
+		const double *row = csv_reader.getRow (ri);
+		size_t column_count = csv_reader.getColumnCount (ri);
 
-		if (infile.eof()) {
-			break;
-		} else {
-			line_index++;
+		VectorNd state (column_count - 1);
+		for (size_t i = 1; i < column_count; i++) {
+			state[i - 1] = row[i];
 		}
 
-		vector<string> tokens = tokenize_csv_strip_whitespaces (line);
-		if (tokens.size() == 0)
-			continue;
-
-		double frame_time = 0.;
-		VectorNd state = VectorNd::Zero (tokens.size() - 1);
+		addPose (row[0], state);
+	}
 
-		double value;
-		istringstream value_stream (tokens[0]);
+	return true;
+}
 
-		// If the first entry is not a number we ignore the whole line
-		if (!(value_stream >> value))
-			continue;
+void Animation::saveToFile (const char* filename) const {
+	saveToFile (filename, formatFromFilename (filename));
+}
 
-		for (size_t i = 0; i < tokens.size(); i++) {
-			value_stream.clear();
-			value_stream.str(tokens[i]);
-			if (!(value_stream >> value)) {
-				cerr << "Error: could not convert string '" << tokens[i] << "' to number in " << filename << ", line " << line_index << ", column " << i << endl;
-				abort();
-			}
+static bool save_binary_animation (const char *filename, const Animation &animation, bool single_precision) {
+	FILE *outfile = fopen (filename, "wb");
+	if (!outfile) {
+		cerr << "Error: could not open animation file '" << filename << "' for writing" << endl;
+		return false;
+	}
 
-			if (i == 0)
-				frame_time = value;
-			else {
-				state[i - 1] = value;
+	const vector<AnimationKeyFrame> &key_frames = animation.keyFrames;
+	uint32_t state_count = key_frames.size() > 0 ? key_frames[0].state.size() : animation.stateNames.size();
+
+	AnimationFileHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, animation_magic, sizeof (animation_magic));
+	header.stateCount = state_count;
+	header.scalarSize = single_precision ? sizeof (float) : sizeof (double);
+	header.keyFrameCount = key_frames.size();
+	header.timeStart = key_frames.size() > 0 ? key_frames[0].time : 0.;
+	header.stateNameCount = animation.stateNames.size() == state_count ? state_count : 0;
+
+	// the time step is only set if all keyframes are equally spaced
+	if (key_frames.size() > 1) {
+		header.timeStep = (key_frames.rbegin()->time - key_frames[0].time) / (key_frames.size() - 1);
+		for (size_t fi = 1; fi < key_frames.size(); fi++) {
+			if (fabs (key_frames[fi].time - key_frames[fi - 1].time - header.timeStep) > 1.0e-9 * (1. + fabs (header.timeStep))) {
+				header.timeStep = 0.;
+				break;
 			}
 		}
-		addPose (frame_time, state);
 	}
 
-	infile.close();
+	size_t offset = fwrite (&header, 1, sizeof (header), outfile);
+	for (uint32_t i = 0; i < header.stateNameCount; i++) {
+		uint32_t length = animation.stateNames[i].size();
+		offset += fwrite (&length, 1, sizeof (length), outfile);
+		offset += fwrite (animation.stateNames[i].c_str(), 1, length, outfile);
+	}
+
+	const char padding[8] = { 0 };
+	offset += fwrite (padding, 1, (8 - offset % 8) % 8, outfile);
 
-	return true;
+	for (size_t fi = 0; fi < key_frames.size(); fi++) {
+		fwrite (&key_frames[fi].time, sizeof (double), 1, outfile);
+	}
+
+	vector<double> double_state (state_count);
+	vector<float> float_state (state_count);
+	for (size_t fi = 0; fi < key_frames.size(); fi++) {
+		const VectorNd &state = key_frames[fi].state;
+		if (state.size() != state_count) {
+			cerr << "Error: keyframes of the animation have different state sizes" << endl;
+			fclose (outfile);
+			return false;
+		}
+
+		if (single_precision) {
+			for (uint32_t i = 0; i < state_count; i++)
+				float_state[i] = static_cast<float>(state[i]);
+			fwrite (float_state.data(), sizeof (float), state_count, outfile);
+		} else {
+			for (uint32_t i = 0; i < state_count; i++)
+				double_state[i] = state[i];
+			fwrite (double_state.data(), sizeof (double), state_count, outfile);
+		}
+	}
+
+	return fclose (outfile) == 0;
 }
 
-void Animation::saveToFile( const char* filename) const {
+bool Animation::saveToFile (const char* filename, Format format, bool single_precision) const {
+	if (format == FormatBinary)
+		return save_binary_animation (filename, *this, single_precision);
+
 	ofstream outfile (filename);
+	if (!outfile) {
+		cerr << "Error: could not open animation file '" << filename << "' for writing" << endl;
+		return false;
+	}
 
 	for (vector<AnimationKeyFrame>::const_iterator iter = keyFrames.begin(); iter != keyFrames.end(); iter++) {
 		outfile << iter->time << ", ";
@@ -215,4 +389,6 @@ void Animation::saveToFile( const char* filename) const {
 	}
 
 	outfile.close();
+
+	return true;
 }
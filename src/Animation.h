@@ -27,6 +27,7 @@
 #define ANIMATION_H
 
 #include <vector>
+#include <string>
 
 #include "SimpleMath/SimpleMath.h"
 
@@ -43,14 +44,40 @@ struct AnimationKeyFrame {
 	VectorNd state;
 };
 
+/** Keyframes of a motion.
+ *
+ * Animations are stored either as CSV with one row "time, state..." per
+ * keyframe or in a binary format that is read without parsing:
+ *
+ * the magic "PUPANI01", the state count (uint32), the scalar size of the
+ * states (uint32, 4 or 8), the keyframe count (uint64), the start time
+ * and the time step (float64, the step is 0 if the keyframes are not
+ * equally spaced), the number of state names (uint32, 0 or the state
+ * count) and the names (uint32 length + characters). After padding to a
+ * multiple of 8 bytes follow the times of all keyframes (float64) and the
+ * states of all keyframes (float32 or float64), all in native byte order.
+ */
 struct Animation {
+	enum Format {
+		FormatCSV = 0,
+		FormatBinary
+	};
+
 	Animation() :
 		currentTime (0.)
 	{}
 	double currentTime;
 	std::vector<AnimationKeyFrame> keyFrames;
+	/// Optional names of the states, only stored in the binary format
+	std::vector<std::string> stateNames;
 
+	/// Inserts after all keyframes with the same or earlier time, appending
+	/// in time order takes constant time
 	void addPose (double time, const VectorNd &states);
+	/// Adds keyframes that may be in any order
+	void addPoses (const std::vector<AnimationKeyFrame> &poses);
+	/// Preallocates frame_count keyframes in addition to the existing ones
+	void reserve (size_t frame_count);
 	void setCurrentTime (double time);
 	VectorNd getCurrentPose () const;
 
@@ -58,8 +85,12 @@ struct Animation {
 	double getLastFrameTime() const;
 	double getDuration() const { return getLastFrameTime() - getFirstFrameTime(); };
 
+	/// Loads a file in either format
 	bool loadFromFile (const char* filename);
+	/// Saves in the format of the extension (.anim is binary)
 	void saveToFile (const char* filename) const;
+	bool saveToFile (const char* filename, Format format, bool single_precision = false) const;
+	static Format formatFromFilename (const std::string &filename);
   
   const VectorNd getTimeLine() const;
   const VectorNd getStateLine(const size_t _stateIdx) const;
@@ -0,0 +1,120 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include "AnimationFitThread.h"
+
+#include "ModelFitter.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cmath>
+
+/// Minimum time between two framesFitted() signals in milliseconds
+static const qint64 signal_interval = 50;
+
+static bool keyframe_before (const AnimationKeyFrame &a, const AnimationKeyFrame &b) {
+	return a.time < b.time - 1.0e-9;
+}
+
+AnimationFitThread::AnimationFitThread (ModelFitter *fitter, const VectorNd &initial_state, const Animation &animation, QObject *parent) :
+	QThread (parent),
+	fitter (fitter),
+	initialState (initial_state),
+	animation (animation),
+	result (false),
+	canceled (0),
+	fittedFrameCount (0) {
+	fitter->frameCallback = [this] (int frame, double time, const VectorNd &state) {
+		return frameFitted (frame, time, state);
+	};
+}
+
+AnimationFitThread::~AnimationFitThread() {
+	cancel();
+	wait();
+
+	fitter->frameCallback = nullptr;
+}
+
+void AnimationFitThread::cancel() {
+	canceled.storeRelease (1);
+}
+
+bool AnimationFitThread::wasCanceled() const {
+	return canceled.loadAcquire() != 0;
+}
+
+int AnimationFitThread::takeFittedPoses (Animation *animation) {
+	std::vector<AnimationKeyFrame> poses;
+
+	{
+		QMutexLocker locker (&mutex);
+		poses.swap (fittedPoses);
+	}
+
+	for (size_t i = 0; i < poses.size(); i++) {
+		std::vector<AnimationKeyFrame>::iterator iter = std::lower_bound (
+				animation->keyFrames.begin(),
+				animation->keyFrames.end(),
+				poses[i],
+				keyframe_before);
+
+		if (iter != animation->keyFrames.end() && fabs (iter->time - poses[i].time) < 1.0e-9)
+			iter->state = poses[i].state;
+		else
+			animation->addPose (poses[i].time, poses[i].state);
+	}
+
+	QMutexLocker locker (&mutex);
+	return fittedFrameCount;
+}
+
+void AnimationFitThread::run() {
+	lastSignalTime.start();
+
+	result = fitter->refitAnimation (initialState, &animation);
+	fitter->closeLog();
+
+	result = result && !wasCanceled();
+}
+
+bool AnimationFitThread::frameFitted (int frame, double time, const VectorNd &state) {
+	int fitted_frame_count = 0;
+
+	{
+		QMutexLocker locker (&mutex);
+		fittedPoses.push_back (AnimationKeyFrame (time, state));
+		fittedFrameCount++;
+		fitted_frame_count = fittedFrameCount;
+	}
+
+	if (lastSignalTime.elapsed() >= signal_interval) {
+		lastSignalTime.restart();
+		emit framesFitted (fitted_frame_count);
+	}
+
+	return !wasCanceled();
+}
@@ -0,0 +1,99 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#ifndef ANIMATION_FIT_THREAD_H
+#define ANIMATION_FIT_THREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include <vector>
+
+#include "Animation.h"
+
+struct ModelFitter;
+
+/** Fits an animation in a background thread.
+ *
+ * The model of the fitter must be a copy of the model shown in the GUI
+ * (see Model::loadFromModel()). The marker data is only read, so it must
+ * not be modified until the thread has finished.
+ *
+ * The thread calls ModelFitter::refitAnimation() on a copy of the given
+ * animation, i.e. only frames affected by changes since the last fit with
+ * the same fitter are computed. Fitted frames are collected and can be
+ * moved to the animation of the GUI with takeFittedPoses() whenever
+ * framesFitted() is emitted.
+ */
+class AnimationFitThread : public QThread {
+	Q_OBJECT
+
+public:
+	AnimationFitThread (ModelFitter *fitter, const VectorNd &initial_state, const Animation &animation, QObject *parent = 0);
+	virtual ~AnimationFitThread();
+
+	/// Stops the fit after the current frame.
+	void cancel();
+	bool wasCanceled() const;
+	/// Whether all frames were fitted successfully.
+	bool getResult() const {
+		return result;
+	}
+	/// The fitted animation, only valid once the thread has finished.
+	const Animation& getAnimation() const {
+		return animation;
+	}
+
+	/// Adds the poses fitted since the last call to animation (or replaces
+	/// the poses with the same time) and returns the total number of
+	/// fitted frames.
+	int takeFittedPoses (Animation *animation);
+
+signals:
+	void framesFitted (int fitted_frame_count);
+
+protected:
+	virtual void run();
+
+private:
+	bool frameFitted (int frame, double time, const VectorNd &state);
+
+	ModelFitter *fitter;
+	VectorNd initialState;
+	Animation animation;
+	bool result;
+
+	QAtomicInt canceled;
+	QElapsedTimer lastSignalTime;
+
+	QMutex mutex;
+	std::vector<AnimationKeyFrame> fittedPoses;
+	int fittedFrameCount;
+};
+
+/* ANIMATION_FIT_THREAD_H */
+#endif
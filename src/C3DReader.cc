@@ -0,0 +1,389 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include "C3DReader.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+size_t C3DParameter::getValueCount() const {
+	size_t result = 1;
+	for (size_t i = 0; i < dimensions.size(); i++) {
+		result *= dimensions[i];
+	}
+
+	return result;
+}
+
+C3DReader::C3DReader() :
+	processorType (ProcessorIntel),
+	floatFormat (false),
+	pointScale (1.f),
+	frameRate (0.f),
+	firstFrame (1),
+	lastFrame (0),
+	pointCount (0),
+	analogSampleCount (0),
+	fileData (NULL),
+	fileSize (0),
+	dataOffset (0),
+	frameSize (0)
+{}
+
+C3DReader::~C3DReader() {
+	close();
+}
+
+int C3DReader::readInt16 (const unsigned char *bytes) const {
+	if (processorType == ProcessorMIPS)
+		return static_cast<short>((bytes[0] << 8) | bytes[1]);
+
+	return static_cast<short>(bytes[0] | (bytes[1] << 8));
+}
+
+float C3DReader::readFloat (const unsigned char *bytes) const {
+	unsigned char ieee[4];
+
+	if (processorType == ProcessorMIPS) {
+		ieee[0] = bytes[3];
+		ieee[1] = bytes[2];
+		ieee[2] = bytes[1];
+		ieee[3] = bytes[0];
+	} else if (processorType == ProcessorDEC) {
+		// VAX F_floating: swapped 16 bit words and an exponent that is
+		// larger by two than the one of IEEE
+		ieee[0] = bytes[2];
+		ieee[1] = bytes[3];
+		ieee[2] = bytes[0];
+		ieee[3] = bytes[1];
+	} else {
+		memcpy (ieee, bytes, 4);
+	}
+
+	float result;
+	memcpy (&result, ieee, 4);
+
+	if (processorType == ProcessorDEC)
+		result *= 0.25f;
+
+	return result;
+}
+
+bool C3DReader::open (const char *filename_) {
+	close();
+
+	filename = filename_;
+
+	int fd = ::open (filename_, O_RDONLY);
+	if (fd == -1) {
+		cerr << "Error: could not open C3D file '" << filename << "'!" << endl;
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat (fd, &file_stat) != 0 || file_stat.st_size < 1024) {
+		cerr << "Error: invalid C3D file '" << filename << "'!" << endl;
+		::close (fd);
+		return false;
+	}
+
+	fileSize = file_stat.st_size;
+	void *mapping = mmap (NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close (fd);
+
+	if (mapping == MAP_FAILED) {
+		cerr << "Error: could not map C3D file '" << filename << "'!" << endl;
+		fileSize = 0;
+		return false;
+	}
+
+	fileData = static_cast<const unsigned char*>(mapping);
+
+	if (fileData[1] != 0x50 || fileData[0] == 0) {
+		cerr << "Error: '" << filename << "' is not a C3D file!" << endl;
+		close();
+		return false;
+	}
+
+	size_t parameter_offset = (fileData[0] - 1) * 512;
+	if (parameter_offset + 4 > fileSize) {
+		cerr << "Error: invalid parameter section in C3D file '" << filename << "'!" << endl;
+		close();
+		return false;
+	}
+
+	int processor = fileData[parameter_offset + 3];
+	if (processor != ProcessorIntel && processor != ProcessorDEC && processor != ProcessorMIPS) {
+		cerr << "Warning: unknown processor type " << processor << " in C3D file '" << filename << "', assuming Intel." << endl;
+		processor = ProcessorIntel;
+	}
+	processorType = static_cast<ProcessorType>(processor);
+
+	// header
+	pointCount = readUInt16 (fileData + 2);
+	analogSampleCount = readUInt16 (fileData + 4);
+	firstFrame = readUInt16 (fileData + 6);
+	lastFrame = readUInt16 (fileData + 8);
+	float header_scale = readFloat (fileData + 12);
+	unsigned int data_start = readUInt16 (fileData + 16);
+	frameRate = readFloat (fileData + 20);
+
+	if (!parseParameters (parameter_offset)) {
+		close();
+		return false;
+	}
+
+	// parameters take precedence as the header fields are limited to 16 bit
+	const C3DParameter *used = findParameter ("POINT", "USED");
+	if (used && used->type == 2)
+		pointCount = readUInt16 (used->values);
+
+	const C3DParameter *parameter_data_start = findParameter ("POINT", "DATA_START");
+	if (parameter_data_start && parameter_data_start->type == 2 && readUInt16 (parameter_data_start->values) != 0)
+		data_start = readUInt16 (parameter_data_start->values);
+
+	const C3DParameter *frames = findParameter ("POINT", "FRAMES");
+	if (frames) {
+		int frame_count = 0;
+		if (frames->type == 2)
+			frame_count = readUInt16 (frames->values);
+		else if (frames->type == 4)
+			frame_count = static_cast<int>(readFloat (frames->values));
+
+		if (frame_count > getFrameCount())
+			lastFrame = firstFrame + frame_count - 1;
+	}
+
+	pointScale = getParameterFloat ("POINT", "SCALE", header_scale);
+	floatFormat = pointScale < 0.f;
+	pointScale = fabsf (pointScale);
+
+	frameRate = getParameterFloat ("POINT", "RATE", frameRate);
+
+	pointLabels = getParameterStrings ("POINT", "LABELS");
+	for (int label_index = 2; pointLabels.size() < pointCount; label_index++) {
+		char name[32];
+		snprintf (name, sizeof (name), "LABELS%d", label_index);
+		std::vector<std::string> labels = getParameterStrings ("POINT", name);
+		if (labels.size() == 0)
+			break;
+
+		pointLabels.insert (pointLabels.end(), labels.begin(), labels.end());
+	}
+	pointLabels.resize (pointCount);
+
+	if (data_start == 0) {
+		cerr << "Error: missing data section in C3D file '" << filename << "'!" << endl;
+		close();
+		return false;
+	}
+
+	dataOffset = (data_start - 1) * 512;
+	frameSize = (pointCount * 4 + analogSampleCount) * (floatFormat ? 4 : 2);
+
+	if (dataOffset > fileSize) {
+		cerr << "Error: missing data section in C3D file '" << filename << "'!" << endl;
+		close();
+		return false;
+	}
+
+	if (frameSize > 0) {
+		int available_frames = static_cast<int>((fileSize - dataOffset) / frameSize);
+		if (available_frames < getFrameCount()) {
+			cerr << "Warning: C3D file '" << filename << "' contains only " << available_frames << " of " << getFrameCount() << " frames." << endl;
+			lastFrame = firstFrame + available_frames - 1;
+		}
+	}
+
+	return true;
+}
+
+bool C3DReader::parseParameters (size_t offset) {
+	size_t end = std::min (fileSize, offset + fileData[offset + 2] * 512);
+	size_t position = offset + 4;
+
+	parameters.clear();
+	groupNames.clear();
+
+	while (position + 2 <= end) {
+		int name_length = abs (static_cast<signed char>(fileData[position]));
+		int id = static_cast<signed char>(fileData[position + 1]);
+
+		if (name_length == 0 || position + 4 + name_length > end)
+			break;
+
+		std::string name (reinterpret_cast<const char*>(fileData + position + 2), name_length);
+		size_t offset_position = position + 2 + name_length;
+		unsigned int next_offset = readUInt16 (fileData + offset_position);
+		size_t body = offset_position + 2;
+
+		if (id < 0) {
+			if (static_cast<size_t>(-id) >= groupNames.size())
+				groupNames.resize (-id + 1);
+			groupNames[-id] = name;
+		} else if (body + 2 <= end) {
+			C3DParameter parameter;
+			parameter.name = name;
+			parameter.groupId = id;
+			parameter.type = static_cast<signed char>(fileData[body]);
+
+			unsigned int dimension_count = fileData[body + 1];
+			for (unsigned int i = 0; i < dimension_count && body + 2 + i < end; i++) {
+				parameter.dimensions.push_back (fileData[body + 2 + i]);
+			}
+			parameter.values = fileData + body + 2 + dimension_count;
+
+			if (parameter.values + parameter.getValueCount() * abs (parameter.type) > fileData + end) {
+				cerr << "Warning: ignoring truncated parameter " << name << " in C3D file '" << filename << "'." << endl;
+			} else {
+				parameters.push_back (parameter);
+			}
+		}
+
+		if (next_offset == 0)
+			break;
+
+		position = offset_position + next_offset;
+	}
+
+	return true;
+}
+
+void C3DReader::close () {
+	if (fileData) {
+		munmap (const_cast<unsigned char*>(fileData), fileSize);
+		fileData = NULL;
+	}
+
+	fileSize = 0;
+	parameters.clear();
+	groupNames.clear();
+	pointLabels.clear();
+	pointCount = 0;
+}
+
+const C3DParameter* C3DReader::findParameter (const char *group_name, const char *parameter_name) const {
+	for (size_t i = 0; i < parameters.size(); i++) {
+		int group_id = parameters[i].groupId;
+		if (parameters[i].name == parameter_name
+				&& group_id < static_cast<int>(groupNames.size())
+				&& groupNames[group_id] == group_name)
+			return &parameters[i];
+	}
+
+	return NULL;
+}
+
+float C3DReader::getParameterFloat (const char *group_name, const char *parameter_name, float default_value) const {
+	const C3DParameter *parameter = findParameter (group_name, parameter_name);
+
+	if (!parameter || parameter->getValueCount() == 0)
+		return default_value;
+
+	switch (parameter->type) {
+		case 1: return static_cast<float>(parameter->values[0]);
+		case 2: return static_cast<float>(readInt16 (parameter->values));
+		case 4: return readFloat (parameter->values);
+		default: break;
+	}
+
+	return default_value;
+}
+
+std::vector<std::string> C3DReader::getParameterStrings (const char *group_name, const char *parameter_name) const {
+	std::vector<std::string> result;
+
+	const C3DParameter *parameter = findParameter (group_name, parameter_name);
+	if (!parameter || parameter->type != -1 || parameter->dimensions.size() == 0)
+		return result;
+
+	size_t length = parameter->dimensions[0];
+	size_t count = parameter->getValueCount() / std::max (length, static_cast<size_t>(1));
+
+	for (size_t i = 0; i < count; i++) {
+		std::string entry (reinterpret_cast<const char*>(parameter->values + i * length), length);
+		entry = entry.substr (0, entry.find_last_not_of (" \0", std::string::npos, 2) + 1);
+		result.push_back (entry);
+	}
+
+	return result;
+}
+
+void C3DReader::readPoints (int frame_index, const unsigned int *points, unsigned int count, float *xyz) const {
+	assert (frame_index >= 0 && frame_index < getFrameCount());
+
+	const unsigned char *frame = fileData + dataOffset + frame_index * frameSize;
+
+	if (floatFormat) {
+		for (unsigned int i = 0; i < count; i++) {
+			const unsigned char *point = frame + points[i] * 16;
+			float *position = xyz + i * 3;
+
+			if (readFloat (point + 12) < 0.f) {
+				position[0] = position[1] = position[2] = 0.f;
+				continue;
+			}
+
+			position[0] = readFloat (point);
+			position[1] = readFloat (point + 4);
+			position[2] = readFloat (point + 8);
+		}
+	} else {
+		for (unsigned int i = 0; i < count; i++) {
+			const unsigned char *point = frame + points[i] * 8;
+			float *position = xyz + i * 3;
+
+			if (readInt16 (point + 6) < 0) {
+				position[0] = position[1] = position[2] = 0.f;
+				continue;
+			}
+
+			position[0] = readInt16 (point) * pointScale;
+			position[1] = readInt16 (point + 2) * pointScale;
+			position[2] = readInt16 (point + 4) * pointScale;
+		}
+	}
+}
+
+void C3DReader::readFrame (int frame_index, float *xyz) const {
+	std::vector<unsigned int> points (pointCount);
+	for (unsigned int i = 0; i < pointCount; i++) {
+		points[i] = i;
+	}
+
+	readPoints (frame_index, points.data(), pointCount, xyz);
+}
@@ -0,0 +1,124 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#ifndef C3D_READER_H
+#define C3D_READER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/// Parameter of the parameter section of a C3D file
+struct C3DParameter {
+	std::string name;
+	int groupId;
+	/// -1 char, 1 byte, 2 int16, 4 float
+	int type;
+	std::vector<int> dimensions;
+	/// Points into the mapped file
+	const unsigned char *values;
+
+	size_t getValueCount() const;
+};
+
+/** Reads C3D files without loading them into memory.
+ *
+ * The file is mapped into memory, only the header and the parameter
+ * section are parsed by open(). Point data is decoded on request for
+ * single frames such that opening a file takes the same time for any
+ * number of frames.
+ *
+ * Integer and floating point data and the Intel, DEC and MIPS processor
+ * types are supported. Analog data is skipped.
+ */
+struct C3DReader {
+	enum ProcessorType {
+		ProcessorIntel = 84,
+		ProcessorDEC = 85,
+		ProcessorMIPS = 86
+	};
+
+	C3DReader();
+	~C3DReader();
+
+	bool open (const char *filename);
+	void close ();
+	bool isOpen() const {
+		return fileData != NULL;
+	}
+
+	int getFrameCount() const {
+		return lastFrame - firstFrame + 1;
+	}
+
+	/// Returns the parameter or NULL if it does not exist
+	const C3DParameter* findParameter (const char *group_name, const char *parameter_name) const;
+	/// Returns the first value of a numeric parameter or default_value
+	float getParameterFloat (const char *group_name, const char *parameter_name, float default_value) const;
+	/// Returns the entries of a character parameter with trailing spaces removed
+	std::vector<std::string> getParameterStrings (const char *group_name, const char *parameter_name) const;
+
+	/** Decodes the coordinates of the given points in the frame with index
+	 * frame_index (starting from 0) into xyz (3 floats per point). The
+	 * coordinates are scaled to the units of the file (usually mm).
+	 * Invalid points are returned as zeros. */
+	void readPoints (int frame_index, const unsigned int *points, unsigned int count, float *xyz) const;
+	/// Decodes all points of a frame
+	void readFrame (int frame_index, float *xyz) const;
+
+	std::string filename;
+	ProcessorType processorType;
+	bool floatFormat;
+	/// Scale of integer data
+	float pointScale;
+	float frameRate;
+	int firstFrame;
+	int lastFrame;
+	unsigned int pointCount;
+	/// Analog samples that follow the points of every frame
+	unsigned int analogSampleCount;
+	std::vector<std::string> pointLabels;
+	std::vector<C3DParameter> parameters;
+	std::vector<std::string> groupNames;
+
+	private:
+		int readInt16 (const unsigned char *bytes) const;
+		unsigned int readUInt16 (const unsigned char *bytes) const {
+			return static_cast<unsigned int>(readInt16 (bytes)) & 0xffff;
+		}
+		float readFloat (const unsigned char *bytes) const;
+		bool parseParameters (size_t offset);
+
+		const unsigned char *fileData;
+		size_t fileSize;
+		size_t dataOffset;
+		size_t frameSize;
+
+		C3DReader (const C3DReader &reader) {};
+		C3DReader& operator= (const C3DReader &reader) { return *this; };
+};
+
+/* C3D_READER_H */
+#endif
@@ -0,0 +1,223 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include "C3DWriter.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+void C3DWriter::addInt16 (int value) {
+	bytes.resize (bytes.size() + 2);
+	setInt16 (bytes.size() - 2, value);
+}
+
+void C3DWriter::setInt16 (size_t offset, int value) {
+	unsigned short v = static_cast<unsigned short>(value);
+	if (processorType == C3DReader::ProcessorMIPS) {
+		bytes[offset] = v >> 8;
+		bytes[offset + 1] = v & 0xff;
+	} else {
+		bytes[offset] = v & 0xff;
+		bytes[offset + 1] = v >> 8;
+	}
+}
+
+void C3DWriter::addFloat (float value) {
+	unsigned char ieee[4];
+	if (processorType == C3DReader::ProcessorDEC)
+		value *= 4.f;
+	memcpy (ieee, &value, 4);
+
+	if (processorType == C3DReader::ProcessorMIPS) {
+		unsigned char swapped[4] = { ieee[3], ieee[2], ieee[1], ieee[0] };
+		bytes.insert (bytes.end(), swapped, swapped + 4);
+	} else if (processorType == C3DReader::ProcessorDEC) {
+		unsigned char swapped[4] = { ieee[2], ieee[3], ieee[0], ieee[1] };
+		bytes.insert (bytes.end(), swapped, swapped + 4);
+	} else {
+		bytes.insert (bytes.end(), ieee, ieee + 4);
+	}
+}
+
+void C3DWriter::beginParameters () {
+	parameterStart = bytes.size();
+
+	// reserved, key, block count (set later), processor
+	bytes.push_back (1);
+	bytes.push_back (0x50);
+	bytes.push_back (0);
+	bytes.push_back (processorType);
+}
+
+void C3DWriter::addGroup (int id, const char *name) {
+	bytes.push_back (strlen (name));
+	bytes.push_back (static_cast<unsigned char>(-id));
+	bytes.insert (bytes.end(), name, name + strlen (name));
+	lastOffset = bytes.size();
+	addInt16 (3);
+	// empty description
+	bytes.push_back (0);
+}
+
+void C3DWriter::addParameter (const char *name, int group_id, int type, int dimension, int count) {
+	bytes.push_back (strlen (name));
+	bytes.push_back (static_cast<unsigned char>(group_id));
+	bytes.insert (bytes.end(), name, name + strlen (name));
+	int value_size = abs (type) * (dimension > 0 ? dimension : 1) * count;
+	int dimension_count = (dimension > 0 ? 1 : 0) + (count > 1 ? 1 : 0);
+	lastOffset = bytes.size();
+	// offset to the next record includes the empty description
+	addInt16 (5 + dimension_count + value_size);
+	bytes.push_back (static_cast<unsigned char>(type));
+	bytes.push_back (dimension_count);
+	if (dimension > 0)
+		bytes.push_back (dimension);
+	if (count > 1)
+		bytes.push_back (count);
+}
+
+void C3DWriter::endParameters () {
+	bytes[lastOffset] = 0;
+	bytes[lastOffset + 1] = 0;
+	pad();
+	bytes[parameterStart + 2] = (bytes.size() - parameterStart) / 512;
+}
+
+void C3DWriter::pad () {
+	bytes.resize ((bytes.size() + 511) / 512 * 512, 0);
+}
+
+bool C3DWriter::save (const char *filename) const {
+	FILE *c3d_file = fopen (filename, "wb");
+	if (!c3d_file) {
+		cerr << "Error: could not open " << filename << " for writing." << endl;
+		return false;
+	}
+
+	bool result = fwrite (bytes.data(), 1, bytes.size(), c3d_file) == bytes.size();
+	result = fclose (c3d_file) == 0 && result;
+
+	return result;
+}
+
+bool C3DWriter::writePoints (const char *filename, const vector<string> &labels, const vector<float> &xyz, float frame_rate, const char *units) {
+	unsigned int point_count = labels.size();
+	unsigned int frame_count = point_count > 0 ? xyz.size() / (point_count * 3) : 0;
+
+	if (point_count == 0 || point_count > 255 || frame_count > 32767) {
+		cerr << "Error: invalid number of points or frames for a C3D file." << endl;
+		return false;
+	}
+
+	size_t label_length = 0;
+	for (unsigned int i = 0; i < point_count; i++)
+		label_length = std::max (label_length, labels[i].size());
+
+	C3DWriter writer;
+
+	// header with the parameters in block 2
+	writer.bytes.push_back (2);
+	writer.bytes.push_back (0x50);
+	writer.addInt16 (point_count);
+	writer.addInt16 (0);
+	writer.addInt16 (1);
+	writer.addInt16 (frame_count);
+	writer.addInt16 (0);
+	writer.addFloat (-1.f);
+	size_t header_data_start = writer.bytes.size();
+	writer.addInt16 (0);
+	writer.addInt16 (0);
+	writer.addFloat (frame_rate);
+	writer.pad();
+
+	writer.beginParameters();
+	writer.addGroup (1, "POINT");
+
+	writer.addParameter ("USED", 1, 2, 0, 1);
+	writer.addInt16 (point_count);
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("SCALE", 1, 4, 0, 1);
+	writer.addFloat (-1.f);
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("RATE", 1, 4, 0, 1);
+	writer.addFloat (frame_rate);
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("FRAMES", 1, 2, 0, 1);
+	writer.addInt16 (frame_count);
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("DATA_START", 1, 2, 0, 1);
+	size_t parameter_data_start = writer.bytes.size();
+	writer.addInt16 (0);
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("UNITS", 1, -1, strlen (units), 1);
+	writer.bytes.insert (writer.bytes.end(), units, units + strlen (units));
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("LABELS", 1, -1, label_length, point_count);
+	for (unsigned int i = 0; i < point_count; i++) {
+		writer.bytes.insert (writer.bytes.end(), labels[i].begin(), labels[i].end());
+		writer.bytes.resize (writer.bytes.size() + label_length - labels[i].size(), ' ');
+	}
+	writer.bytes.push_back (0);
+
+	writer.addGroup (2, "ANALOG");
+
+	writer.addParameter ("USED", 2, 2, 0, 1);
+	writer.addInt16 (0);
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("RATE", 2, 4, 0, 1);
+	writer.addFloat (frame_rate);
+	writer.bytes.push_back (0);
+
+	writer.endParameters();
+
+	int data_start = writer.bytes.size() / 512 + 1;
+	writer.setInt16 (header_data_start, data_start);
+	writer.setInt16 (parameter_data_start, data_start);
+
+	// points with a residual of 0
+	for (unsigned int f = 0; f < frame_count; f++) {
+		for (unsigned int i = 0; i < point_count; i++) {
+			const float *point = &xyz[(f * point_count + i) * 3];
+			writer.addFloat (point[0]);
+			writer.addFloat (point[1]);
+			writer.addFloat (point[2]);
+			writer.addFloat (0.f);
+		}
+	}
+
+	return writer.save (filename);
+}
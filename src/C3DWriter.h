@@ -0,0 +1,81 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#ifndef C3D_WRITER_H
+#define C3D_WRITER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "C3DReader.h"
+
+/** Writes C3D files, e.g. for synthetic test and benchmark data.
+ *
+ * The file is assembled in memory in the byte order and number format of
+ * the processor type. The record functions allow to write arbitrary
+ * files, writePoints() writes a complete floating point file with point
+ * trajectories only.
+ */
+struct C3DWriter {
+	C3DWriter (C3DReader::ProcessorType processor_type = C3DReader::ProcessorIntel) :
+		processorType (processor_type),
+		parameterStart (0),
+		lastOffset (0)
+	{}
+
+	void addInt16 (int value);
+	void addFloat (float value);
+	/// Overwrites the int16 value at offset
+	void setInt16 (size_t offset, int value);
+
+	/// Adds the first bytes of the parameter section
+	void beginParameters ();
+	void addGroup (int id, const char *name);
+	/** Adds a parameter record up to its values which have to be added
+	 * afterwards. dimension is the first dimension (0 for none), count the
+	 * second dimension (none if 1). */
+	void addParameter (const char *name, int group_id, int type, int dimension, int count);
+	/// Marks the last record as last one and sets the number of blocks
+	void endParameters ();
+
+	/// Pads to the next 512 byte block
+	void pad ();
+	bool save (const char *filename) const;
+
+	/** Writes a floating point file with the trajectories in xyz (3 floats
+	 * per point and point_count * 3 per frame) in the given units. */
+	static bool writePoints (const char *filename, const std::vector<std::string> &labels, const std::vector<float> &xyz, float frame_rate, const char *units = "mm");
+
+	C3DReader::ProcessorType processorType;
+	std::vector<unsigned char> bytes;
+	/// Start of the parameter section
+	size_t parameterStart;
+	/// Start of the offset to the next record of the last record
+	size_t lastOffset;
+};
+
+/* C3D_WRITER_H */
+#endif
@@ -0,0 +1,319 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include "CSVReader.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <algorithm>
+#include <sstream>
+#include <locale>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/// Powers of ten that are exact as double
+static const double exact_powers_of_ten[] = {
+	1.0e0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9, 1.0e10,
+	1.0e11, 1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18, 1.0e19, 1.0e20,
+	1.0e21, 1.0e22
+};
+
+bool CSVReader::parseDouble (const char *begin, const char *end, double &value) {
+	const char *c = begin;
+	bool negative = false;
+
+	if (c != end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		c++;
+	}
+
+	unsigned long long mantissa = 0;
+	int digit_count = 0;
+	int exponent = 0;
+	bool has_digits = false;
+
+	for (; c != end && *c >= '0' && *c <= '9'; c++) {
+		has_digits = true;
+		if (digit_count < 19) {
+			mantissa = mantissa * 10 + (*c - '0');
+			if (mantissa != 0)
+				digit_count++;
+		} else {
+			exponent++;
+		}
+	}
+
+	if (c != end && *c == '.') {
+		c++;
+		for (; c != end && *c >= '0' && *c <= '9'; c++) {
+			has_digits = true;
+			if (digit_count < 19) {
+				mantissa = mantissa * 10 + (*c - '0');
+				if (mantissa != 0)
+					digit_count++;
+				exponent--;
+			}
+		}
+	}
+
+	if (!has_digits)
+		return false;
+
+	if (c != end && (*c == 'e' || *c == 'E')) {
+		c++;
+		bool exponent_negative = false;
+		if (c != end && (*c == '-' || *c == '+')) {
+			exponent_negative = *c == '-';
+			c++;
+		}
+
+		if (c == end || *c < '0' || *c > '9')
+			return false;
+
+		int exponent_value = 0;
+		for (; c != end && *c >= '0' && *c <= '9'; c++) {
+			if (exponent_value < 10000)
+				exponent_value = exponent_value * 10 + (*c - '0');
+		}
+
+		exponent += exponent_negative ? -exponent_value : exponent_value;
+	}
+
+	if (c != end)
+		return false;
+
+	// exact if the mantissa and the power of ten are exact doubles
+	if (mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+		value = static_cast<double>(mantissa);
+		if (exponent < 0)
+			value /= exact_powers_of_ten[-exponent];
+		else
+			value *= exact_powers_of_ten[exponent];
+	} else {
+		// rare: long mantissas or large exponents. Parsed in the classic
+		// locale as Qt sets the locale of the user, which may use decimal
+		// commas.
+		std::istringstream token_stream (std::string (begin, end));
+		token_stream.imbue (std::locale::classic());
+		if (!(token_stream >> value) || token_stream.peek() != EOF)
+			return false;
+
+		return true;
+	}
+
+	if (negative)
+		value = -value;
+
+	return true;
+}
+
+static inline bool is_whitespace (char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/// Result of parsing the lines of one chunk
+struct CSVChunk {
+	CSVChunk() :
+		begin (NULL),
+		end (NULL),
+		lineCount (0),
+		errorLine (-1),
+		errorColumn (0)
+	{}
+
+	const char *begin;
+	const char *end;
+
+	std::vector<double> values;
+	/// Number of values of every row
+	std::vector<size_t> rowSizes;
+	int lineCount;
+
+	/// Line (within the chunk) of the first error or -1
+	int errorLine;
+	int errorColumn;
+	std::string errorToken;
+};
+
+static void parse_chunk (CSVChunk *chunk, bool skip_non_numeric_rows) {
+	const char *line = chunk->begin;
+
+	while (line < chunk->end) {
+		const char *line_end = static_cast<const char*>(memchr (line, '\n', chunk->end - line));
+		if (!line_end)
+			line_end = chunk->end;
+
+		size_t row_start = chunk->values.size();
+		int column = 0;
+		const char *c = line;
+
+		while (c < line_end && is_whitespace (*c))
+			c++;
+
+		// Fields are separated by exactly one comma or by whitespace, so
+		// ", ," is an empty field. A comma at the end of the line is ignored.
+		while (c < line_end) {
+			const char *token_end = c;
+			while (token_end < line_end && *token_end != ',' && !is_whitespace (*token_end))
+				token_end++;
+
+			double value;
+			if (!CSVReader::parseDouble (c, token_end, value)) {
+				if (column == 0 && token_end != c && skip_non_numeric_rows) {
+					break;
+				}
+
+				chunk->errorLine = chunk->lineCount;
+				chunk->errorColumn = column;
+				chunk->errorToken = std::string (c, token_end);
+				return;
+			}
+
+			chunk->values.push_back (value);
+			column++;
+
+			c = token_end;
+			while (c < line_end && is_whitespace (*c))
+				c++;
+
+			if (c < line_end && *c == ',') {
+				c++;
+				while (c < line_end && is_whitespace (*c))
+					c++;
+			}
+		}
+
+		if (chunk->values.size() > row_start)
+			chunk->rowSizes.push_back (chunk->values.size() - row_start);
+
+		chunk->lineCount++;
+		line = line_end + 1;
+	}
+}
+
+bool CSVReader::load (const char *filename, unsigned int thread_count) {
+	values.clear();
+	rowOffsets.assign (1, 0);
+	errorLine = 0;
+	errorColumn = 0;
+
+	int fd = open (filename, O_RDONLY);
+	if (fd == -1) {
+		cerr << "Error: could not open CSV file '" << filename << "'" << endl;
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat (fd, &file_stat) != 0) {
+		cerr << "Error: could not read CSV file '" << filename << "'" << endl;
+		close (fd);
+		return false;
+	}
+
+	size_t size = file_stat.st_size;
+	if (size == 0) {
+		close (fd);
+		return true;
+	}
+
+	void *mapping = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+
+	if (mapping == MAP_FAILED) {
+		cerr << "Error: could not map CSV file '" << filename << "'" << endl;
+		return false;
+	}
+
+	const char *data = static_cast<const char*>(mapping);
+
+	if (thread_count == 0) {
+		thread_count = 1;
+		if (size > (4 << 20))
+			thread_count = std::max (std::thread::hardware_concurrency(), 1u);
+	}
+
+	// chunks end after a line break
+	std::vector<CSVChunk> chunks (thread_count);
+	const char *chunk_begin = data;
+	for (unsigned int ci = 0; ci < thread_count; ci++) {
+		const char *chunk_end = data + size;
+		if (ci < thread_count - 1) {
+			chunk_end = std::max (chunk_begin, data + size * (ci + 1) / thread_count);
+			const char *line_end = static_cast<const char*>(memchr (chunk_end, '\n', data + size - chunk_end));
+			chunk_end = line_end ? line_end + 1 : data + size;
+		}
+
+		chunks[ci].begin = chunk_begin;
+		chunks[ci].end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+
+	std::vector<std::thread> threads;
+	for (unsigned int ci = 1; ci < thread_count; ci++) {
+		threads.push_back (std::thread (parse_chunk, &chunks[ci], skipNonNumericRows));
+	}
+	parse_chunk (&chunks[0], skipNonNumericRows);
+	for (size_t ti = 0; ti < threads.size(); ti++) {
+		threads[ti].join();
+	}
+
+	munmap (mapping, size);
+
+	int line_offset = 0;
+	size_t value_count = 0;
+	size_t row_count = 0;
+	for (unsigned int ci = 0; ci < thread_count; ci++) {
+		if (chunks[ci].errorLine != -1) {
+			errorLine = line_offset + chunks[ci].errorLine + 1;
+			errorColumn = chunks[ci].errorColumn;
+			cerr << "Error: could not convert string '" << chunks[ci].errorToken << "' to number in " << filename << ", line " << errorLine << ", column " << errorColumn << endl;
+			rowOffsets.assign (1, 0);
+			return false;
+		}
+
+		line_offset += chunks[ci].lineCount;
+		value_count += chunks[ci].values.size();
+		row_count += chunks[ci].rowSizes.size();
+	}
+
+	values.reserve (value_count);
+	rowOffsets.reserve (row_count + 1);
+	for (unsigned int ci = 0; ci < thread_count; ci++) {
+		values.insert (values.end(), chunks[ci].values.begin(), chunks[ci].values.end());
+		for (size_t ri = 0; ri < chunks[ci].rowSizes.size(); ri++) {
+			rowOffsets.push_back (rowOffsets.back() + chunks[ci].rowSizes[ri]);
+		}
+	}
+
+	return true;
+}
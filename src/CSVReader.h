@@ -0,0 +1,83 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#ifndef CSV_READER_H
+#define CSV_READER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/** Reads numeric CSV files such as animations.
+ *
+ * The file is mapped into memory and split into chunks at line ends that
+ * are parsed by multiple threads. Values are separated by a comma or by
+ * whitespace, empty fields are an error. Numbers are always read with a
+ * decimal point, independent of the locale.
+ */
+struct CSVReader {
+	CSVReader() :
+		skipNonNumericRows (true),
+		errorLine (0),
+		errorColumn (0)
+	{}
+
+	/** Parses the file with thread_count threads (0 uses all cores for
+	 * files larger than a few megabytes). If a value cannot be converted,
+	 * its line and column are printed and stored in errorLine and
+	 * errorColumn and false is returned. */
+	bool load (const char *filename, unsigned int thread_count = 0);
+
+	size_t getRowCount() const {
+		return rowOffsets.size() - 1;
+	}
+	size_t getColumnCount (size_t row) const {
+		return rowOffsets[row + 1] - rowOffsets[row];
+	}
+	const double* getRow (size_t row) const {
+		return values.data() + rowOffsets[row];
+	}
+
+	/** Converts [begin, end) to a number without allocating. Returns false
+	 * if it is not a number or has trailing characters. */
+	static bool parseDouble (const char *begin, const char *end, double &value);
+
+	/// Rows whose first value is not a number (e.g. headers) are ignored,
+	/// otherwise they are an error.
+	bool skipNonNumericRows;
+
+	/// Line (starting from 1) and column (starting from 0) of the value
+	/// that could not be converted by the last load(), 0 otherwise
+	int errorLine;
+	int errorColumn;
+
+	/// Values of all rows
+	std::vector<double> values;
+	/// Index of the first value of every row in values plus the total count
+	std::vector<size_t> rowOffsets;
+};
+
+/* CSV_READER_H */
+#endif
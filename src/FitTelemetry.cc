@@ -0,0 +1,178 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include "FitTelemetry.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+void FitTelemetrySummary::addFrame (const FrameTelemetry &frame) {
+	frameCount++;
+	if (!frame.success)
+		failedFrameCount++;
+
+	totalSteps += frame.steps;
+	totalTime += frame.totalTime;
+	kinematicsTime += frame.kinematicsTime;
+	jacobianTime += frame.jacobianTime;
+	solveTime += frame.solveTime;
+
+	if (maxStepsFrame == -1 || frame.steps > maxSteps) {
+		maxSteps = frame.steps;
+		maxStepsFrame = frame.frame;
+	}
+
+	if (slowestFrame == -1 || frame.totalTime > maxFrameTime) {
+		maxFrameTime = frame.totalTime;
+		slowestFrame = frame.frame;
+	}
+
+	if (worstFrame == -1 || frame.residualNorm > maxResidualNorm) {
+		maxResidualNorm = frame.residualNorm;
+		worstFrame = frame.frame;
+	}
+}
+
+void FitTelemetrySummary::add (const FitTelemetrySummary &other) {
+	frameCount += other.frameCount;
+	failedFrameCount += other.failedFrameCount;
+	totalSteps += other.totalSteps;
+	totalTime += other.totalTime;
+	kinematicsTime += other.kinematicsTime;
+	jacobianTime += other.jacobianTime;
+	solveTime += other.solveTime;
+
+	if (other.maxStepsFrame != -1 && (maxStepsFrame == -1 || other.maxSteps > maxSteps)) {
+		maxSteps = other.maxSteps;
+		maxStepsFrame = other.maxStepsFrame;
+	}
+
+	if (other.slowestFrame != -1 && (slowestFrame == -1 || other.maxFrameTime > maxFrameTime)) {
+		maxFrameTime = other.maxFrameTime;
+		slowestFrame = other.slowestFrame;
+	}
+
+	if (other.worstFrame != -1 && (worstFrame == -1 || other.maxResidualNorm > maxResidualNorm)) {
+		maxResidualNorm = other.maxResidualNorm;
+		worstFrame = other.worstFrame;
+	}
+}
+
+void FitTelemetry::reserve (unsigned int frame_capacity, unsigned int iteration_capacity) {
+	frames.resize (frame_capacity);
+	iterations.resize (iteration_capacity);
+	clear();
+}
+
+void FitTelemetry::clear() {
+	iterationTotal = 0;
+	frameTotal = 0;
+	summary = FitTelemetrySummary();
+}
+
+void FitTelemetry::addFrame (const FrameTelemetry &frame) {
+	if (frames.size() == 0)
+		return;
+
+	frames[frameTotal % frames.size()] = frame;
+	frameTotal++;
+	summary.addFrame (frame);
+}
+
+unsigned int FitTelemetry::getFrameCount() const {
+	return static_cast<unsigned int>(std::min (frameTotal, static_cast<unsigned long>(frames.size())));
+}
+
+const FrameTelemetry& FitTelemetry::getFrame (unsigned int index) const {
+	assert (index < getFrameCount());
+
+	unsigned long oldest = frameTotal - getFrameCount();
+	return frames[(oldest + index) % frames.size()];
+}
+
+bool FitTelemetry::getIterations (const FrameTelemetry &frame, std::vector<IterationTelemetry> &result) const {
+	result.clear();
+
+	if (frame.firstIteration + iterations.size() < iterationTotal)
+		return false;
+
+	for (unsigned long i = frame.firstIteration; i < frame.firstIteration + frame.iterationCount; i++) {
+		result.push_back (iterations[i % iterations.size()]);
+	}
+
+	return true;
+}
+
+bool FitTelemetry::saveSummary (const std::string &filename) const {
+	ofstream file (filename.c_str());
+	if (!file) {
+		cerr << "Error: could not open telemetry summary " << filename << " for writing!" << endl;
+		return false;
+	}
+
+	file << "frames, failed_frames, total_steps, max_steps, max_steps_frame, total_time, kinematics_time, jacobian_time, solve_time, max_frame_time, slowest_frame, max_residual_norm, worst_frame" << endl;
+	file << summary.frameCount << ", "
+		<< summary.failedFrameCount << ", "
+		<< summary.totalSteps << ", "
+		<< summary.maxSteps << ", "
+		<< summary.maxStepsFrame << ", "
+		<< summary.totalTime << ", "
+		<< summary.kinematicsTime << ", "
+		<< summary.jacobianTime << ", "
+		<< summary.solveTime << ", "
+		<< summary.maxFrameTime << ", "
+		<< summary.slowestFrame << ", "
+		<< summary.maxResidualNorm << ", "
+		<< summary.worstFrame << endl;
+
+	return true;
+}
+
+bool FitTelemetry::saveFrames (const std::string &filename) const {
+	ofstream file (filename.c_str());
+	if (!file) {
+		cerr << "Error: could not open telemetry file " << filename << " for writing!" << endl;
+		return false;
+	}
+
+	file << "frame, steps, success, total_time, kinematics_time, jacobian_time, solve_time, residual_norm" << endl;
+	for (unsigned int i = 0; i < getFrameCount(); i++) {
+		const FrameTelemetry &frame = getFrame (i);
+		file << frame.frame << ", "
+			<< frame.steps << ", "
+			<< frame.success << ", "
+			<< frame.totalTime << ", "
+			<< frame.kinematicsTime << ", "
+			<< frame.jacobianTime << ", "
+			<< frame.solveTime << ", "
+			<< frame.residualNorm << endl;
+	}
+
+	return true;
+}
@@ -0,0 +1,162 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#ifndef FIT_TELEMETRY_H
+#define FIT_TELEMETRY_H
+
+#include <string>
+#include <vector>
+
+/// Residual norm before and norm of the step of a single IK iteration
+struct IterationTelemetry {
+	double residualNorm;
+	double stepNorm;
+};
+
+/** Telemetry of a fitted frame.
+ *
+ * The times are wall clock seconds. totalTime contains the time spent
+ * updating the kinematics, evaluating the marker Jacobians and solving
+ * the normal equations plus everything else done for the frame.
+ */
+struct FrameTelemetry {
+	int frame;
+	unsigned int steps;
+	bool success;
+	double totalTime;
+	double kinematicsTime;
+	double jacobianTime;
+	double solveTime;
+	/// Norm of the marker residuals of the fitted state
+	double residualNorm;
+	/// Index of the first iteration of the frame counting all iterations
+	/// ever recorded and the number of iterations of the frame
+	unsigned long firstIteration;
+	unsigned int iterationCount;
+};
+
+/// Accumulated telemetry of all frames since the last FitTelemetry::clear()
+struct FitTelemetrySummary {
+	FitTelemetrySummary() :
+		frameCount (0),
+		failedFrameCount (0),
+		totalSteps (0),
+		maxSteps (0),
+		maxStepsFrame (-1),
+		totalTime (0.),
+		kinematicsTime (0.),
+		jacobianTime (0.),
+		solveTime (0.),
+		maxFrameTime (0.),
+		slowestFrame (-1),
+		maxResidualNorm (0.),
+		worstFrame (-1)
+	{}
+
+	void addFrame (const FrameTelemetry &frame);
+	/// Merges the summary of another fit, e.g. of a different thread
+	void add (const FitTelemetrySummary &other);
+
+	unsigned int frameCount;
+	unsigned int failedFrameCount;
+	unsigned long totalSteps;
+	unsigned int maxSteps;
+	int maxStepsFrame;
+	double totalTime;
+	double kinematicsTime;
+	double jacobianTime;
+	double solveTime;
+	double maxFrameTime;
+	int slowestFrame;
+	double maxResidualNorm;
+	int worstFrame;
+};
+
+/** Per frame solver telemetry of a fit.
+ *
+ * The frames and the iterations are stored in ring buffers that are
+ * allocated by reserve(), recording therefore never allocates. Once a
+ * buffer is full the oldest entries get overwritten. The summary covers
+ * all frames since the last clear(), including overwritten ones.
+ */
+struct FitTelemetry {
+	FitTelemetry() :
+		iterationTotal (0),
+		frameTotal (0)
+	{}
+
+	/// Allocates the buffers and clears all recorded data. Capacities of
+	/// 0 disable the recording.
+	void reserve (unsigned int frame_capacity, unsigned int iteration_capacity);
+	void clear();
+	bool isEnabled() const {
+		return frames.size() > 0;
+	}
+
+	/// Index that the next iteration passed to addIteration() gets
+	unsigned long getIterationIndex() const {
+		return iterationTotal;
+	}
+	void addIteration (double residual_norm, double step_norm) {
+		if (iterations.size() == 0)
+			return;
+
+		IterationTelemetry &iteration = iterations[iterationTotal % iterations.size()];
+		iteration.residualNorm = residual_norm;
+		iteration.stepNorm = step_norm;
+		iterationTotal++;
+	}
+	void addFrame (const FrameTelemetry &frame);
+
+	/// Number of frames in the buffer
+	unsigned int getFrameCount() const;
+	/// Returns the index-th frame in the buffer, 0 is the oldest one
+	const FrameTelemetry& getFrame (unsigned int index) const;
+	/// Copies the iterations of the frame. Returns false if they were
+	/// already overwritten.
+	bool getIterations (const FrameTelemetry &frame, std::vector<IterationTelemetry> &result) const;
+	const FitTelemetrySummary& getSummary() const {
+		return summary;
+	}
+	/// Adds the frames of a fit recorded elsewhere to the summary
+	void mergeSummary (const FitTelemetrySummary &other) {
+		summary.add (other);
+	}
+
+	/// Writes the summary as a CSV header and a single row
+	bool saveSummary (const std::string &filename) const;
+	/// Writes all frames in the buffer as CSV
+	bool saveFrames (const std::string &filename) const;
+
+	private:
+		std::vector<FrameTelemetry> frames;
+		std::vector<IterationTelemetry> iterations;
+		unsigned long iterationTotal;
+		unsigned long frameTotal;
+		FitTelemetrySummary summary;
+};
+
+/* FIT_TELEMETRY_H */
+#endif
@@ -0,0 +1,360 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include "FittingLog.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <clocale>
+#include <stdint.h>
+
+using namespace std;
+
+/// Number of buffered rows after which the writer thread gets woken up
+static const unsigned int rows_per_write = 256;
+
+static const char binary_magic[] = "PUPLOG01";
+
+/** The log always uses '.' as decimal separator. printf and strtod follow
+ * LC_NUMERIC, which is process wide and must not be switched from the
+ * writer thread, so the separator of the locale gets replaced instead.
+ */
+static char locale_decimal_point() {
+	const char *decimal_point = localeconv()->decimal_point;
+	if (decimal_point && decimal_point[0] != '\0')
+		return decimal_point[0];
+
+	return '.';
+}
+
+static double parse_residual (const char *str, char **end, char decimal_point) {
+	if (decimal_point == '.')
+		return strtod (str, end);
+
+	char buffer[64];
+	size_t length = std::min (strcspn (str, ",\n"), sizeof (buffer) - 1);
+	memcpy (buffer, str, length);
+	buffer[length] = '\0';
+
+	char *separator = strchr (buffer, '.');
+	if (separator)
+		*separator = decimal_point;
+
+	char *buffer_end = NULL;
+	double value = strtod (buffer, &buffer_end);
+	*end = const_cast<char*>(str) + (buffer_end - buffer);
+
+	return value;
+}
+
+FittingLog::FittingLog() :
+	format (FormatCSV),
+	markerCount (0),
+	file (NULL),
+	busy (false),
+	flushRequested (false),
+	stopRequested (false)
+{}
+
+FittingLog::~FittingLog() {
+	close();
+}
+
+bool FittingLog::open (const std::string &_filename, const std::vector<std::string> &marker_names, Format _format, bool append) {
+	close();
+
+	filename = _filename;
+	format = _format;
+	markerCount = marker_names.size();
+
+	file = fopen (filename.c_str(), append ? "ab" : "wb");
+	if (!file) {
+		cerr << "Error: could not open fitting log '" << filename << "'!" << endl;
+		return false;
+	}
+
+	bool write_header = !append || ftell (file) == 0;
+
+	if (write_header && format == FormatCSV) {
+		fputs ("frame, steps, ", file);
+		for (size_t i = 0; i < marker_names.size(); i++) {
+			fputs (marker_names[i].c_str(), file);
+			if (i != marker_names.size() - 1)
+				fputs (", ", file);
+		}
+		fputc ('\n', file);
+	} else if (write_header && format == FormatBinary) {
+		fwrite (binary_magic, 1, 8, file);
+		uint32_t count = markerCount;
+		fwrite (&count, sizeof (count), 1, file);
+		for (size_t i = 0; i < marker_names.size(); i++) {
+			uint32_t length = marker_names[i].size();
+			fwrite (&length, sizeof (length), 1, file);
+			fwrite (marker_names[i].c_str(), 1, length, file);
+		}
+	}
+
+	busy = false;
+	flushRequested = false;
+	stopRequested = false;
+	pending.clear();
+	pending.reserve (rows_per_write * (markerCount + 2));
+
+	writer = std::thread (&FittingLog::writerLoop, this);
+
+	return true;
+}
+
+void FittingLog::addRow (int frame, unsigned int steps, const std::vector<double> &residuals) {
+	assert (file);
+	assert (residuals.size() == markerCount);
+
+	std::unique_lock<std::mutex> lock (mutex);
+
+	pending.push_back (frame);
+	pending.push_back (steps);
+	pending.insert (pending.end(), residuals.begin(), residuals.end());
+
+	if (pending.size() >= rows_per_write * (markerCount + 2))
+		rowsAvailable.notify_one();
+}
+
+void FittingLog::flush() {
+	if (!file)
+		return;
+
+	std::unique_lock<std::mutex> lock (mutex);
+
+	flushRequested = true;
+	rowsAvailable.notify_one();
+	while (flushRequested)
+		rowsWritten.wait (lock);
+
+	fflush (file);
+}
+
+void FittingLog::close() {
+	if (!file)
+		return;
+
+	flush();
+
+	{
+		std::unique_lock<std::mutex> lock (mutex);
+		stopRequested = true;
+		rowsAvailable.notify_one();
+	}
+
+	writer.join();
+
+	fclose (file);
+	file = NULL;
+}
+
+void FittingLog::writerLoop() {
+	std::unique_lock<std::mutex> lock (mutex);
+	size_t row_size = markerCount + 2;
+
+	while (true) {
+		while (!stopRequested && !flushRequested && pending.size() < rows_per_write * row_size)
+			rowsAvailable.wait (lock);
+
+		if (pending.size() > 0) {
+			writing.swap (pending);
+			busy = true;
+
+			lock.unlock();
+			writeRows (writing);
+			writing.clear();
+			lock.lock();
+
+			busy = false;
+			continue;
+		}
+
+		if (flushRequested) {
+			flushRequested = false;
+			rowsWritten.notify_all();
+		}
+
+		if (stopRequested)
+			break;
+	}
+}
+
+void FittingLog::writeRows (const std::vector<double> &rows) {
+	size_t row_size = markerCount + 2;
+	size_t row_count = rows.size() / row_size;
+
+	if (format == FormatBinary) {
+		for (size_t ri = 0; ri < row_count; ri++) {
+			const double *row = &rows[ri * row_size];
+			int32_t frame = static_cast<int32_t>(row[0]);
+			uint32_t steps = static_cast<uint32_t>(row[1]);
+			fwrite (&frame, sizeof (frame), 1, file);
+			fwrite (&steps, sizeof (steps), 1, file);
+			for (size_t mi = 0; mi < markerCount; mi++) {
+				float residual = static_cast<float>(row[mi + 2]);
+				fwrite (&residual, sizeof (residual), 1, file);
+			}
+		}
+		return;
+	}
+
+	// at most 32 characters per value
+	text.resize (row_count * row_size * 32);
+	char *out = &text[0];
+	char decimal_point = locale_decimal_point();
+
+	for (size_t ri = 0; ri < row_count; ri++) {
+		const double *row = &rows[ri * row_size];
+		out += sprintf (out, "%d, %u", static_cast<int>(row[0]), static_cast<unsigned int>(row[1]));
+		for (size_t mi = 0; mi < markerCount; mi++) {
+			int length = sprintf (out, ", %g", row[mi + 2]);
+			if (decimal_point != '.') {
+				char *separator = static_cast<char*>(memchr (out + 2, decimal_point, length - 2));
+				if (separator)
+					*separator = '.';
+			}
+			out += length;
+		}
+		*out++ = '\n';
+	}
+
+	fwrite (&text[0], 1, out - &text[0], file);
+}
+
+bool FittingLog::load (const std::string &filename, std::vector<std::string> &marker_names, std::vector<FittingLogRow> &rows) {
+	marker_names.clear();
+	rows.clear();
+
+	FILE *in = fopen (filename.c_str(), "rb");
+	if (!in)
+		return false;
+
+	char magic[8];
+	bool is_binary = fread (magic, 1, 8, in) == 8 && memcmp (magic, binary_magic, 8) == 0;
+
+	if (is_binary) {
+		uint32_t count = 0;
+		if (fread (&count, sizeof (count), 1, in) != 1) {
+			fclose (in);
+			return false;
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t length = 0;
+			if (fread (&length, sizeof (length), 1, in) != 1) {
+				fclose (in);
+				return false;
+			}
+			std::string name (length, ' ');
+			if (length > 0 && fread (&name[0], 1, length, in) != length) {
+				fclose (in);
+				return false;
+			}
+			marker_names.push_back (name);
+		}
+
+		FittingLogRow row;
+		row.residuals.resize (count);
+		int32_t frame;
+		uint32_t steps;
+		while (fread (&frame, sizeof (frame), 1, in) == 1 && fread (&steps, sizeof (steps), 1, in) == 1) {
+			row.frame = frame;
+			row.steps = steps;
+			for (uint32_t mi = 0; mi < count; mi++) {
+				float residual;
+				if (fread (&residual, sizeof (residual), 1, in) != 1) {
+					fclose (in);
+					return false;
+				}
+				row.residuals[mi] = residual;
+			}
+			rows.push_back (row);
+		}
+
+		fclose (in);
+		return true;
+	}
+
+	rewind (in);
+
+	std::vector<char> line (4096);
+	bool header_read = false;
+	char decimal_point = locale_decimal_point();
+
+	while (fgets (&line[0], line.size(), in)) {
+		// grow the buffer for long lines
+		while (strchr (&line[0], '\n') == NULL && !feof (in)) {
+			size_t length = strlen (&line[0]);
+			line.resize (line.size() * 2);
+			if (!fgets (&line[length], line.size() - length, in))
+				break;
+		}
+
+		char *cursor = &line[0];
+		if (!header_read) {
+			header_read = true;
+			// skip "frame, steps, "
+			for (unsigned int skip = 0; skip < 2 && cursor; skip++) {
+				cursor = strchr (cursor, ',');
+				if (cursor)
+					cursor++;
+			}
+			while (cursor && *cursor != '\0' && *cursor != '\n') {
+				while (*cursor == ' ')
+					cursor++;
+				char *end = cursor + strcspn (cursor, ",\n");
+				marker_names.push_back (std::string (cursor, end - cursor));
+				cursor = (*end == ',') ? end + 1 : end;
+			}
+			continue;
+		}
+
+		FittingLogRow row;
+		char *end = NULL;
+		row.frame = strtol (cursor, &end, 10);
+		if (end == cursor)
+			continue;
+		cursor = end + 1;
+		row.steps = strtoul (cursor, &end, 10);
+		cursor = end;
+
+		while (*cursor == ',') {
+			cursor++;
+			row.residuals.push_back (parse_residual (cursor, &end, decimal_point));
+			cursor = end;
+		}
+
+		rows.push_back (row);
+	}
+
+	fclose (in);
+	return true;
+}
@@ -0,0 +1,105 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#ifndef FITTING_LOG_H
+#define FITTING_LOG_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct FittingLogRow {
+	int frame;
+	unsigned int steps;
+	std::vector<double> residuals;
+};
+
+/** Writes the per frame marker residuals of a fit.
+ *
+ * Rows are buffered and formatted and written by a background thread so
+ * that fitting does not wait for the disk. The file stays open until
+ * close() is called or the log gets destroyed.
+ *
+ * FormatCSV writes the same text as before: a header with the marker
+ * names followed by rows of "frame, steps, residual, ...". Residuals always
+ * use '.' as decimal separator, regardless of LC_NUMERIC.
+ *
+ * FormatBinary writes the magic "PUPLOG01", the marker count (uint32),
+ * the marker names (uint32 length + characters) and then for every row the
+ * frame (int32), the steps (uint32) and the residuals (float32), all in
+ * native byte order.
+ */
+struct FittingLog {
+	enum Format {
+		FormatCSV = 0,
+		FormatBinary
+	};
+
+	FittingLog();
+	~FittingLog();
+
+	/** Opens the log. In append mode the header is only written if the file
+	 * is new or empty. */
+	bool open (const std::string &filename, const std::vector<std::string> &marker_names, Format format, bool append = false);
+	bool isOpen() const {
+		return file != NULL;
+	}
+	/// Copies the row into the buffer. residuals must have one entry per marker.
+	void addRow (int frame, unsigned int steps, const std::vector<double> &residuals);
+	/// Blocks until all rows are written to the file.
+	void flush();
+	void close();
+
+	/// Reads a log written in either format.
+	static bool load (const std::string &filename, std::vector<std::string> &marker_names, std::vector<FittingLogRow> &rows);
+
+	std::string filename;
+	Format format;
+	unsigned int markerCount;
+
+	private:
+		void writerLoop();
+		void writeRows (const std::vector<double> &rows);
+
+		FILE *file;
+		std::thread writer;
+		std::mutex mutex;
+		std::condition_variable rowsAvailable;
+		std::condition_variable rowsWritten;
+		/// Rows that are not yet written, flattened as frame, steps,
+		/// residuals...
+		std::vector<double> pending;
+		std::vector<double> writing;
+		std::vector<char> text;
+		bool busy;
+		bool flushRequested;
+		bool stopRequested;
+};
+
+/* FITTING_LOG_H */
+#endif
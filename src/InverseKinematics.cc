@@ -0,0 +1,834 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include "InverseKinematics.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+using namespace RigidBodyDynamics;
+
+double IKProfileClock (const IKWorkspace &workspace) {
+	if (!workspace.profile)
+		return 0.;
+
+	return std::chrono::duration<double> (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void profile_kinematics (IKWorkspace &workspace, double start) {
+	if (workspace.profile) {
+		workspace.profile->kinematicsCount++;
+		workspace.profile->kinematicsTime += IKProfileClock (workspace) - start;
+	}
+}
+
+static void profile_solve (IKWorkspace &workspace, double start) {
+	if (workspace.profile) {
+		workspace.profile->solveCount++;
+		workspace.profile->solveTime += IKProfileClock (workspace) - start;
+	}
+}
+
+static void record_iteration (IKWorkspace &workspace, const rbdlVectorNd &e, const rbdlVectorNd &delta_theta) {
+	if (workspace.telemetry)
+		workspace.telemetry->addIteration (e.norm(), delta_theta.norm());
+}
+
+/** Forms J^T J of the stacked Jacobian with DofCount columns. Double
+ * precision works on J in place, single precision needs a converted copy.
+ */
+template <typename Scalar, int DofCount>
+struct IKNormalProduct {
+	static void compute (const rbdlMatrixNd &J_in, Eigen::Matrix<Scalar, Eigen::Dynamic, DofCount> &J, Eigen::Matrix<Scalar, DofCount, DofCount> &A) {
+		J = J_in.cast<Scalar>();
+		A.noalias() = J.transpose() * J;
+	}
+};
+
+template <int DofCount>
+struct IKNormalProduct<double, DofCount> {
+	static void compute (const rbdlMatrixNd &J_in, Eigen::Matrix<double, Eigen::Dynamic, DofCount> &J, Eigen::Matrix<double, DofCount, DofCount> &A) {
+		Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, DofCount> > J_map (J_in.data(), J_in.rows(), J_in.cols());
+		A.noalias() = J_map.transpose() * J_map;
+	}
+};
+
+/** Joint space normal equation solver for Scalar and DofCount, which may
+ * be Eigen::Dynamic. All storage is allocated in the constructor.
+ */
+template <typename Scalar, int DofCount>
+struct IKNormalSolverImpl : public IKNormalSolver {
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, DofCount> JacobianType;
+	typedef Eigen::Matrix<Scalar, DofCount, DofCount> MatrixType;
+	typedef Eigen::Matrix<Scalar, DofCount, 1> VectorType;
+
+	IKNormalSolverImpl (unsigned int dof_count, unsigned int rows) {
+		// only single precision keeps a copy of the Jacobian
+		if (!Eigen::internal::is_same<Scalar, double>::value)
+			J.resize (rows, dof_count);
+		A.resize (dof_count, dof_count);
+		b.resize (dof_count);
+		llt = Eigen::LLT<MatrixType> (dof_count);
+	}
+
+	virtual bool solve (const rbdlMatrixNd &J_in, double damping, const rbdlVectorNd &rhs, rbdlVectorNd &x) {
+		IKNormalProduct<Scalar, DofCount>::compute (J_in, J, A);
+		A.diagonal().array() += static_cast<Scalar>(damping);
+		b = rhs.cast<Scalar>();
+
+		llt.compute (A);
+		if (llt.info() != Eigen::Success)
+			return false;
+
+		llt.solveInPlace (b);
+		x = b.template cast<double>();
+
+		return true;
+	}
+
+	JacobianType J;
+	MatrixType A;
+	VectorType b;
+	Eigen::LLT<MatrixType> llt;
+
+	// fixed size members of vectorizable size need aligned allocations
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/// Instantiates the solvers for 1 to DofCount degrees of freedom and picks
+/// the one that matches dof_count.
+template <typename Scalar, int DofCount>
+struct IKFixedNormalSolverFactory {
+	static IKNormalSolver* create (unsigned int dof_count, unsigned int rows) {
+		if (dof_count == DofCount)
+			return new IKNormalSolverImpl<Scalar, DofCount> (dof_count, rows);
+
+		return IKFixedNormalSolverFactory<Scalar, DofCount - 1>::create (dof_count, rows);
+	}
+};
+
+template <typename Scalar>
+struct IKFixedNormalSolverFactory<Scalar, 0> {
+	static IKNormalSolver* create (unsigned int dof_count, unsigned int rows) {
+		return NULL;
+	}
+};
+
+template <typename Scalar>
+static IKNormalSolver* create_normal_solver (unsigned int dof_count, unsigned int rows, bool use_fixed_size) {
+	IKNormalSolver *result = NULL;
+
+	if (use_fixed_size && dof_count <= IKMaxFixedDofCount)
+		result = IKFixedNormalSolverFactory<Scalar, IKMaxFixedDofCount>::create (dof_count, rows);
+
+	if (!result && !Eigen::internal::is_same<Scalar, double>::value)
+		result = new IKNormalSolverImpl<Scalar, Eigen::Dynamic> (dof_count, rows);
+
+	return result;
+}
+
+void IKWorkspace::updateNormalSolver() {
+	normalSolver.reset();
+
+	if (useTaskSpace || dofCount == 0)
+		return;
+
+	if (precision == IKPrecisionFloat)
+		normalSolver.reset (create_normal_solver<float> (dofCount, 3 * markerCount, useFixedSize));
+	else
+		normalSolver.reset (create_normal_solver<double> (dofCount, 3 * markerCount, useFixedSize));
+}
+
+void IKWorkspace::resize (unsigned int dof_count, unsigned int marker_count) {
+	if (dof_count == dofCount && marker_count == markerCount)
+		return;
+
+	dofCount = dof_count;
+	markerCount = marker_count;
+
+	unsigned int rows = 3 * marker_count;
+
+	useTaskSpace = rows < dof_count;
+	unsigned int system_size = useTaskSpace ? rows : dof_count;
+
+	dofParent.assign (dof_count, -1);
+
+	G = rbdlMatrixNd::Zero (3, dof_count);
+	jointAxes = rbdlMatrixNd::Zero (6, dof_count);
+	J = rbdlMatrixNd::Zero (rows, dof_count);
+	e = rbdlVectorNd::Zero (rows);
+	weightedResiduals = rbdlVectorNd::Zero (rows);
+
+	normalMatrix = rbdlMatrixNd::Zero (system_size, system_size);
+	normalRhs = rbdlVectorNd::Zero (system_size);
+	normalSolution = rbdlVectorNd::Zero (system_size);
+	normalLLT = Eigen::LLT<rbdlMatrixNd> (system_size);
+	normalLDLT = Eigen::LDLT<rbdlMatrixNd> (system_size);
+
+	deltaTheta = rbdlVectorNd::Zero (dof_count);
+
+	trialQ = rbdlVectorNd::Zero (dof_count);
+	trialResiduals = rbdlVectorNd::Zero (rows);
+	gradient = rbdlVectorNd::Zero (dof_count);
+
+	updateNormalSolver();
+}
+
+void ComputeMarkerJacobianPointwise (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Q,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		IKWorkspace &workspace
+		) {
+	double kinematics_start = IKProfileClock (workspace);
+	UpdateKinematicsCustom (model, &Q, NULL, NULL);
+	profile_kinematics (workspace, kinematics_start);
+
+	for (unsigned int k = 0; k < body_id.size(); k++) {
+		workspace.G.setZero();
+		CalcPointJacobian (model, Q, body_id[k], body_point[k], workspace.G, false);
+		rbdlVector3d point_base = CalcBodyToBaseCoordinates (model, Q, body_id[k], body_point[k], false);
+
+		workspace.J.block(k * 3, 0, 3, workspace.dofCount) = workspace.G;
+		workspace.e.segment<3>(k * 3) = target_pos[k] - point_base;
+	}
+}
+
+/** Computes only the residuals of all markers at Q.
+ */
+static void compute_marker_residuals (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Q,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &e
+		) {
+	UpdateKinematicsCustom (model, &Q, NULL, NULL);
+
+	for (unsigned int k = 0; k < body_id.size(); k++) {
+		e.segment<3>(k * 3) = target_pos[k] - CalcBodyToBaseCoordinates (model, Q, body_id[k], body_point[k], false);
+	}
+}
+
+/** Stores the motion subspace column S (in coordinates of the body frame
+ * X_base) in base coordinates in the given column of axes.
+ *
+ * The linear part is the velocity of the point that coincides with the
+ * base origin so that the velocity of a base point p is v + w x p.
+ */
+static void store_base_axis (
+		const RigidBodyDynamics::Math::SpatialTransform &X_base,
+		const RigidBodyDynamics::Math::SpatialVector &S,
+		rbdlMatrixNd &axes,
+		unsigned int column
+		) {
+	rbdlVector3d omega = X_base.E.transpose() * S.head<3>();
+	rbdlVector3d v_origin = X_base.E.transpose() * S.tail<3>();
+
+	axes.block<3,1>(0, column) = omega;
+	axes.block<3,1>(3, column) = v_origin - omega.cross(X_base.r);
+}
+
+static void compute_marker_jacobian (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Q,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		IKWorkspace &workspace
+		) {
+	// Only joints with 1 or 3 degrees of freedom have their motion subspace
+	// stored in the model. For anything else we use the RBDL functions.
+	for (unsigned int j = 1; j < model.mJoints.size(); j++) {
+		if (model.mJoints[j].mDoFCount != 1 && model.mJoints[j].mDoFCount != 3) {
+			ComputeMarkerJacobianPointwise (model, Q, body_id, body_point, target_pos, workspace);
+			return;
+		}
+	}
+
+	double kinematics_start = IKProfileClock (workspace);
+	UpdateKinematicsCustom (model, &Q, NULL, NULL);
+	profile_kinematics (workspace, kinematics_start);
+
+	// motion subspaces of all joints in base coordinates, computed once
+	// instead of once per marker
+	rbdlMatrixNd &axes = workspace.jointAxes;
+	for (unsigned int j = 1; j < model.mJoints.size(); j++) {
+		unsigned int q_index = model.mJoints[j].q_index;
+
+		if (model.mJoints[j].mDoFCount == 1) {
+			store_base_axis (model.X_base[j], model.S[j], axes, q_index);
+		} else {
+			for (unsigned int i = 0; i < 3; i++) {
+				store_base_axis (model.X_base[j], model.multdof3_S[j].col(i), axes, q_index + i);
+			}
+		}
+	}
+
+	rbdlMatrixNd &J = workspace.J;
+	J.setZero();
+
+	for (unsigned int k = 0; k < body_id.size(); k++) {
+		unsigned int movable_id = body_id[k];
+		rbdlVector3d point_movable = body_point[k];
+
+		if (model.IsFixedBodyId (body_id[k])) {
+			const FixedBody &fixed_body = model.mFixedBodies[body_id[k] - model.fixed_body_discriminator];
+			movable_id = fixed_body.mMovableParent;
+			point_movable = fixed_body.mParentTransform.r + fixed_body.mParentTransform.E.transpose() * body_point[k];
+		}
+
+		const RigidBodyDynamics::Math::SpatialTransform &X_base = model.X_base[movable_id];
+		rbdlVector3d point_base = X_base.r + X_base.E.transpose() * point_movable;
+
+		workspace.e.segment<3>(k * 3) = target_pos[k] - point_base;
+
+		// only the joints on the path to the root move the point
+		unsigned int j = movable_id;
+		while (j != 0) {
+			unsigned int q_index = model.mJoints[j].q_index;
+			unsigned int dof_count = model.mJoints[j].mDoFCount;
+
+			for (unsigned int i = q_index; i < q_index + dof_count; i++) {
+				J.block<3,1>(k * 3, i) = axes.block<3,1>(3, i) + axes.block<3,1>(0, i).cross(point_base);
+			}
+
+			j = model.lambda[j];
+		}
+	}
+}
+
+void ComputeMarkerJacobian (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Q,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		IKWorkspace &workspace
+		) {
+	if (!workspace.profile) {
+		compute_marker_jacobian (model, Q, body_id, body_point, target_pos, workspace);
+		return;
+	}
+
+	double start = IKProfileClock (workspace);
+	double kinematics_time = workspace.profile->kinematicsTime;
+	compute_marker_jacobian (model, Q, body_id, body_point, target_pos, workspace);
+	workspace.profile->jacobianCount++;
+	workspace.profile->jacobianTime += IKProfileClock (workspace) - start
+		- (workspace.profile->kinematicsTime - kinematics_time);
+}
+
+/** Solves workspace.normalMatrix x = rhs.
+ *
+ * The matrix is symmetric positive definite so we use a Cholesky
+ * factorization and only resort to LDLT if that fails.
+ */
+static void solve_normal_equations (
+		IKWorkspace &workspace,
+		const rbdlVectorNd &rhs,
+		rbdlVectorNd &x
+		) {
+	workspace.normalLLT.compute (workspace.normalMatrix);
+
+	if (workspace.normalLLT.info() == Eigen::Success) {
+		x = workspace.normalLLT.solve (rhs);
+		return;
+	}
+
+	workspace.normalLDLT.compute (workspace.normalMatrix);
+	x = workspace.normalLDLT.solve (rhs);
+}
+
+/** Returns the last degree of freedom that moves the given body or -1 if
+ * it is only attached to the root by fixed joints.
+ */
+static int last_body_dof (RigidBodyDynamics::Model &model, unsigned int body_id) {
+	if (model.IsFixedBodyId (body_id))
+		body_id = model.mFixedBodies[body_id - model.fixed_body_discriminator].mMovableParent;
+
+	while (body_id != 0 && model.mJoints[body_id].mDoFCount == 0)
+		body_id = model.lambda[body_id];
+
+	if (body_id == 0)
+		return -1;
+
+	return model.mJoints[body_id].q_index + model.mJoints[body_id].mDoFCount - 1;
+}
+
+/** Fills workspace.dofParent from the model and decides whether the tree
+ * structure is sparse enough to be exploited.
+ */
+static void update_tree_structure (RigidBodyDynamics::Model &model, IKWorkspace &workspace) {
+	workspace.useTreeSparsity = false;
+
+	if (workspace.useTaskSpace)
+		return;
+
+	for (unsigned int j = 1; j < model.mJoints.size(); j++) {
+		unsigned int dof_count = model.mJoints[j].mDoFCount;
+		if (dof_count != 1 && dof_count != 3)
+			return;
+
+		unsigned int q_index = model.mJoints[j].q_index;
+		workspace.dofParent[q_index] = last_body_dof (model, model.lambda[j]);
+		for (unsigned int i = 1; i < dof_count; i++) {
+			workspace.dofParent[q_index + i] = q_index + i - 1;
+		}
+	}
+
+	unsigned int n = workspace.dofCount;
+	unsigned int nonzeros = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		assert (workspace.dofParent[i] < static_cast<int>(i));
+		for (int j = i; j != -1; j = workspace.dofParent[j])
+			nonzeros++;
+	}
+
+	workspace.useTreeSparsity = nonzeros <= workspace.treeFillThreshold * 0.5 * n * (n + 1);
+}
+
+/** Forms the lower triangle of J^T J for the pairs of degrees of freedom
+ * that lie on the same branch. Every marker only contributes to the pairs
+ * of its own chain.
+ */
+static void form_tree_normal_matrix (
+		RigidBodyDynamics::Model &model,
+		const std::vector<unsigned int>& body_id,
+		const IKWorkspace &workspace,
+		rbdlMatrixNd &A
+		) {
+	const rbdlMatrixNd &J = workspace.J;
+	const std::vector<int> &parent = workspace.dofParent;
+
+	A.setZero();
+
+	for (unsigned int k = 0; k < body_id.size(); k++) {
+		for (int i = last_body_dof (model, body_id[k]); i != -1; i = parent[i]) {
+			for (int j = i; j != -1; j = parent[j]) {
+				A(i, j) += J.block<3,1>(k * 3, i).dot (J.block<3,1>(k * 3, j));
+			}
+		}
+	}
+}
+
+/** Computes H = L^T L in place for a matrix with tree sparsity.
+ *
+ * Only the lower triangle entries (i, j) with j an ancestor of i are used.
+ * See Featherstone, R., "Rigid Body Dynamics Algorithms", Springer 2008,
+ * section 6.5.
+ */
+static bool tree_ltl_factorize (rbdlMatrixNd &H, const std::vector<int> &parent) {
+	for (int k = H.rows() - 1; k >= 0; k--) {
+		if (H(k, k) <= 0.)
+			return false;
+
+		H(k, k) = sqrt (H(k, k));
+
+		for (int i = parent[k]; i != -1; i = parent[i])
+			H(k, i) /= H(k, k);
+
+		for (int i = parent[k]; i != -1; i = parent[i]) {
+			for (int j = i; j != -1; j = parent[j])
+				H(i, j) -= H(k, i) * H(k, j);
+		}
+	}
+
+	return true;
+}
+
+/** Solves L^T L x = b with L computed by tree_ltl_factorize().
+ */
+static void tree_ltl_solve (const rbdlMatrixNd &L, const std::vector<int> &parent, const rbdlVectorNd &b, rbdlVectorNd &x) {
+	x = b;
+
+	for (int i = L.rows() - 1; i >= 0; i--) {
+		x[i] /= L(i, i);
+		for (int j = parent[i]; j != -1; j = parent[j])
+			x[j] -= L(i, j) * x[i];
+	}
+
+	for (int i = 0; i < L.rows(); i++) {
+		for (int j = parent[i]; j != -1; j = parent[j])
+			x[i] -= L(i, j) * x[j];
+		x[i] /= L(i, i);
+	}
+}
+
+/** Solves (J^T J + damping I) x = rhs.
+ *
+ * Uses the tree factorization if the tree is sparse enough, otherwise the
+ * fixed size or single precision solver of the workspace if there is one
+ * and the dynamic double precision matrices as fallback.
+ */
+static void solve_joint_space (
+		RigidBodyDynamics::Model &model,
+		const std::vector<unsigned int>& body_id,
+		IKWorkspace &workspace,
+		double damping,
+		const rbdlVectorNd &rhs,
+		rbdlVectorNd &x
+		) {
+	rbdlMatrixNd &A = workspace.normalMatrix;
+
+	if (workspace.useTreeSparsity) {
+		form_tree_normal_matrix (model, body_id, workspace, A);
+		A.diagonal().array() += damping;
+
+		if (tree_ltl_factorize (A, workspace.dofParent)) {
+			tree_ltl_solve (A, workspace.dofParent, rhs, x);
+			return;
+		}
+	} else if (workspace.normalSolver) {
+		if (workspace.normalSolver->solve (workspace.J, damping, rhs, x))
+			return;
+	}
+
+	A.noalias() = workspace.J.transpose() * workspace.J;
+	A.diagonal().array() += damping;
+
+	solve_normal_equations (workspace, rhs, x);
+}
+
+bool LevenbergMarquardtIK (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Qinit,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &Qres,
+		double step_tol,
+		double lambda,
+		unsigned int max_iter,
+		unsigned int *steps,
+		IKWorkspace &workspace
+		) {
+
+	assert (Qinit.size() == model.q_size);
+	assert (body_id.size() == body_point.size());
+	assert (body_id.size() == target_pos.size());
+
+	workspace.resize (model.qdot_size, body_id.size());
+	update_tree_structure (model, workspace);
+
+	const rbdlMatrixNd &J = workspace.J;
+	const rbdlVectorNd &e = workspace.e;
+	rbdlMatrixNd &A = workspace.normalMatrix;
+	rbdlVectorNd &delta_theta = workspace.deltaTheta;
+
+	Qres = Qinit;
+
+	unsigned int ik_iter;
+
+	for (ik_iter = 0; ik_iter < max_iter; ik_iter++) {
+		ComputeMarkerJacobian (model, Qres, body_id, body_point, target_pos, workspace);
+
+		// abort if we are getting "close"
+		if (e.norm() < step_tol) {
+			*steps = ik_iter;
+			return true;
+		}
+
+		double solve_start = IKProfileClock (workspace);
+		if (workspace.useTaskSpace) {
+			// delta_theta = J^T (J J^T + lambda^2 I)^-1 e
+			A.noalias() = J * J.transpose();
+			A.diagonal().array() += lambda * lambda;
+
+			solve_normal_equations (workspace, e, workspace.normalSolution);
+			delta_theta.noalias() = J.transpose() * workspace.normalSolution;
+		} else {
+			// delta_theta = (J^T J + lambda^2 I)^-1 J^T e
+			workspace.normalRhs.noalias() = J.transpose() * e;
+			solve_joint_space (model, body_id, workspace, lambda * lambda, workspace.normalRhs, delta_theta);
+		}
+		profile_solve (workspace, solve_start);
+
+		Qres += delta_theta;
+		record_iteration (workspace, e, delta_theta);
+
+		if (delta_theta.norm() < step_tol) {
+			*steps = ik_iter;
+			return true;
+		}
+	}
+
+	*steps = ik_iter;
+
+	return false;
+}
+
+bool SugiharaIK (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Qinit,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &Qres,
+		double step_tol,
+		unsigned int max_iter,
+		unsigned int *steps,
+		IKWorkspace &workspace
+		) {
+
+	assert (Qinit.size() == model.q_size);
+	assert (body_id.size() == body_point.size());
+	assert (body_id.size() == target_pos.size());
+
+	workspace.resize (model.qdot_size, body_id.size());
+	update_tree_structure (model, workspace);
+
+	const rbdlMatrixNd &J = workspace.J;
+	const rbdlVectorNd &e = workspace.e;
+	rbdlMatrixNd &A = workspace.normalMatrix;
+	rbdlVectorNd &delta_theta = workspace.deltaTheta;
+
+	Qres = Qinit;
+
+	unsigned int ik_iter;
+
+	for (ik_iter = 0; ik_iter < max_iter; ik_iter++) {
+		ComputeMarkerJacobian (model, Qres, body_id, body_point, target_pos, workspace);
+
+		double Ek = 0.5 * e.squaredNorm();
+
+		double solve_start = IKProfileClock (workspace);
+		if (workspace.useTaskSpace) {
+			// delta_theta = J^T (J J^T + Wn)^-1 e which is the same as below
+			A.noalias() = J * J.transpose();
+			A.diagonal().array() += Ek + 1.0e-3;
+
+			solve_normal_equations (workspace, e, workspace.normalSolution);
+			delta_theta.noalias() = J.transpose() * workspace.normalSolution;
+		} else {
+			// A = J^T J + Wn with Wn = (Ek + 1.0e-3) * I
+			workspace.normalRhs.noalias() = J.transpose() * e;
+			solve_joint_space (model, body_id, workspace, Ek + 1.0e-3, workspace.normalRhs, delta_theta);
+		}
+		profile_solve (workspace, solve_start);
+
+		Qres += delta_theta;
+		record_iteration (workspace, e, delta_theta);
+
+		if (delta_theta.norm() < step_tol) {
+			*steps = ik_iter;
+
+			return true;
+		}
+	}
+
+	*steps = ik_iter;
+
+	return false;
+}
+
+bool SugiharaTaskSpaceIK (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Qinit,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &Qres,
+		double step_tol,
+		unsigned int max_iter,
+		unsigned int *steps,
+		IKWorkspace &workspace
+		) {
+
+	assert (Qinit.size() == model.q_size);
+	assert (body_id.size() == body_point.size());
+	assert (body_id.size() == target_pos.size());
+
+	workspace.resize (model.qdot_size, body_id.size());
+	update_tree_structure (model, workspace);
+
+	rbdlMatrixNd &J = workspace.J;
+	const rbdlVectorNd &e = workspace.e;
+	rbdlMatrixNd &A = workspace.normalMatrix;
+	rbdlVectorNd &delta_theta = workspace.deltaTheta;
+
+	Qres = Qinit;
+
+	unsigned int ik_iter;
+
+	for (ik_iter = 0; ik_iter < max_iter; ik_iter++) {
+		ComputeMarkerJacobian (model, Qres, body_id, body_point, target_pos, workspace);
+
+		// abort if we are getting "close"
+		if (e.norm() < step_tol) {
+			*steps = ik_iter;
+
+			return true;
+		}
+
+		double wn = 1.0e-3;
+
+		double solve_start = IKProfileClock (workspace);
+		if (workspace.useTaskSpace) {
+			// A = J J^T + Ek with Ek = diag (0.5 * e_i^2 + wn)
+			A.noalias() = J * J.transpose();
+			A.diagonal().array() += e.array().square() * 0.5 + wn;
+
+			solve_normal_equations (workspace, e, workspace.normalSolution);
+			delta_theta.noalias() = J.transpose() * workspace.normalSolution;
+		} else {
+			// J^T (J J^T + Ek)^-1 = (J^T Ek^-1 J + I)^-1 J^T Ek^-1, so we scale
+			// the rows of J and e by Ek^-1/2. J gets recomputed in the next
+			// iteration anyway.
+			for (unsigned int i = 0; i < e.size(); i++) {
+				double row_scale = 1. / sqrt (e[i] * e[i] * 0.5 + wn);
+				J.row(i) *= row_scale;
+				workspace.weightedResiduals[i] = e[i] * row_scale;
+			}
+
+			workspace.normalRhs.noalias() = J.transpose() * workspace.weightedResiduals;
+			solve_joint_space (model, body_id, workspace, 1., workspace.normalRhs, delta_theta);
+		}
+		profile_solve (workspace, solve_start);
+
+		Qres += delta_theta;
+		record_iteration (workspace, e, delta_theta);
+
+		if (delta_theta.norm() < step_tol) {
+			*steps = ik_iter;
+
+			return true;
+		}
+	}
+
+	*steps = ik_iter;
+
+	return false;
+}
+
+bool AdaptiveLevenbergMarquardtIK (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Qinit,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &Qres,
+		double step_tol,
+		double &damping,
+		unsigned int max_iter,
+		unsigned int *steps,
+		IKWorkspace &workspace
+		) {
+
+	assert (Qinit.size() == model.q_size);
+	assert (body_id.size() == body_point.size());
+	assert (body_id.size() == target_pos.size());
+
+	workspace.resize (model.qdot_size, body_id.size());
+	update_tree_structure (model, workspace);
+
+	const rbdlMatrixNd &J = workspace.J;
+	rbdlVectorNd &e = workspace.e;
+	rbdlMatrixNd &A = workspace.normalMatrix;
+	rbdlVectorNd &g = workspace.gradient;
+	rbdlVectorNd &delta_theta = workspace.deltaTheta;
+
+	Qres = Qinit;
+
+	ComputeMarkerJacobian (model, Qres, body_id, body_point, target_pos, workspace);
+	g.noalias() = J.transpose() * e;
+	double F = 0.5 * e.squaredNorm();
+
+	if (damping <= 0.) {
+		double max_diagonal = 0.;
+		for (unsigned int i = 0; i < workspace.dofCount; i++) {
+			max_diagonal = std::max (max_diagonal, J.col(i).squaredNorm());
+		}
+		damping = 1.0e-3 * max_diagonal;
+	}
+
+	double nu = 2.;
+	unsigned int ik_iter;
+
+	for (ik_iter = 0; ik_iter < max_iter; ik_iter++) {
+		if (e.norm() < step_tol || g.lpNorm<Eigen::Infinity>() < step_tol) {
+			*steps = ik_iter;
+			return true;
+		}
+
+		double solve_start = IKProfileClock (workspace);
+		if (workspace.useTaskSpace) {
+			A.noalias() = J * J.transpose();
+			A.diagonal().array() += damping;
+
+			solve_normal_equations (workspace, e, workspace.normalSolution);
+			delta_theta.noalias() = J.transpose() * workspace.normalSolution;
+		} else {
+			solve_joint_space (model, body_id, workspace, damping, g, delta_theta);
+		}
+		profile_solve (workspace, solve_start);
+		record_iteration (workspace, e, delta_theta);
+
+		if (delta_theta.norm() < step_tol * (Qres.norm() + step_tol)) {
+			*steps = ik_iter;
+			return true;
+		}
+
+		workspace.trialQ = Qres + delta_theta;
+		double kinematics_start = IKProfileClock (workspace);
+		compute_marker_residuals (model, workspace.trialQ, body_id, body_point, target_pos, workspace.trialResiduals);
+		profile_kinematics (workspace, kinematics_start);
+		double F_trial = 0.5 * workspace.trialResiduals.squaredNorm();
+
+		// gain ratio of actual and predicted reduction
+		double predicted_reduction = 0.5 * delta_theta.dot (damping * delta_theta + g);
+		double rho = (F - F_trial) / predicted_reduction;
+
+		if (rho > 0.) {
+			Qres = workspace.trialQ;
+			ComputeMarkerJacobian (model, Qres, body_id, body_point, target_pos, workspace);
+			g.noalias() = J.transpose() * e;
+
+			double improvement = F - F_trial;
+			F = 0.5 * e.squaredNorm();
+
+			damping *= std::max (1. / 3., 1. - pow (2. * rho - 1., 3));
+			nu = 2.;
+
+			if (improvement < step_tol * F) {
+				*steps = ik_iter + 1;
+				return true;
+			}
+		} else {
+			damping *= nu;
+			nu *= 2.;
+		}
+	}
+
+	*steps = ik_iter;
+
+	return false;
+}
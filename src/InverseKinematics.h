@@ -0,0 +1,307 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#ifndef INVERSE_KINEMATICS_H
+#define INVERSE_KINEMATICS_H
+
+#include <vector>
+#include <memory>
+
+#include <rbdl/rbdl.h>
+
+#include "FitTelemetry.h"
+
+typedef RigidBodyDynamics::Math::Vector3d rbdlVector3d;
+typedef RigidBodyDynamics::Math::VectorNd rbdlVectorNd;
+typedef RigidBodyDynamics::Math::MatrixNd rbdlMatrixNd;
+
+/** Number and accumulated duration (in seconds) of the kinematics
+ * updates, Jacobian evaluations and linear solves of the inverse
+ * kinematics methods.
+ *
+ * The time of the kinematics update that is part of every Jacobian
+ * evaluation is only added to kinematicsTime.
+ */
+struct IKProfile {
+	IKProfile() :
+		kinematicsCount (0),
+		kinematicsTime (0.),
+		jacobianCount (0),
+		jacobianTime (0.),
+		solveCount (0),
+		solveTime (0.)
+	{}
+
+	void reset() {
+		*this = IKProfile();
+	}
+
+	unsigned int kinematicsCount;
+	double kinematicsTime;
+	unsigned int jacobianCount;
+	double jacobianTime;
+	unsigned int solveCount;
+	double solveTime;
+};
+
+/// Scalar type of the joint space normal equations
+enum IKPrecision {
+	IKPrecisionDouble = 0,
+	/// Only the solve of the normal equations is done in single precision.
+	/// The Jacobian and residuals stay double so the iteration still
+	/// converges to the double precision solution, but possibly with more
+	/// steps for badly conditioned problems.
+	IKPrecisionFloat
+};
+
+/** Solver of the joint space normal equations (J^T J + damping I) x = rhs
+ * that works on its own copy of J with a compile time scalar type and
+ * number of degrees of freedom. */
+struct IKNormalSolver {
+	virtual ~IKNormalSolver() {}
+	/// Returns false if the matrix is not positive definite
+	virtual bool solve (const rbdlMatrixNd &J, double damping, const rbdlVectorNd &rhs, rbdlVectorNd &x) = 0;
+};
+
+/// Models with up to this many degrees of freedom use fixed size matrices
+/// in the joint space solves
+const unsigned int IKMaxFixedDofCount = 12;
+
+/** Preallocated storage for the inverse kinematics methods.
+ *
+ * All matrices and factorizations that are needed during an IK iteration
+ * live in here. They are only (re-)allocated when the number of degrees of
+ * freedom or the number of markers changes, so that fitting consecutive
+ * frames of a trial does not touch the heap.
+ *
+ * The damped normal equations of all methods can be formed either in
+ * task space (3 * markerCount unknowns) or in joint space (dofCount
+ * unknowns). Both give the same step, so resize() picks the smaller one.
+ *
+ * Joint space solves of small models use fixed size matrices, and all joint
+ * space solves can be done in single precision, see normalSolver.
+ *
+ * After a call to one of the IK methods e contains the marker residuals of
+ * the last iteration.
+ */
+struct IKWorkspace {
+	IKWorkspace() :
+		dofCount (0),
+		markerCount (0),
+		useTaskSpace (false),
+		useTreeSparsity (false),
+		treeFillThreshold (0.5),
+		useFixedSize (true),
+		precision (IKPrecisionDouble),
+		profile (NULL),
+		telemetry (NULL)
+	{}
+
+	void resize (unsigned int dof_count, unsigned int marker_count);
+	/// Creates normalSolver for the current size, useFixedSize and
+	/// precision. Called by resize() but needs to be called after changing
+	/// useFixedSize or precision of an already sized workspace.
+	void updateNormalSolver();
+
+	unsigned int dofCount;
+	unsigned int markerCount;
+
+	/// Whether the normal equations are formed in task space
+	bool useTaskSpace;
+
+	/// Whether the joint space normal equations are formed and factorized
+	/// along the kinematic tree. J^T J only has entries for pairs of
+	/// degrees of freedom where one is an ancestor of the other. This
+	/// pattern has no fill-in in a L^T L factorization that eliminates
+	/// from the leaves towards the root.
+	bool useTreeSparsity;
+	/// The tree is used if the fraction of nonzero entries in the lower
+	/// triangle of J^T J is at most this value.
+	double treeFillThreshold;
+	/// Parent degree of freedom of every degree of freedom (-1 for the
+	/// ones attached to the root)
+	std::vector<int> dofParent;
+
+	/// Jacobian of a single point (3 x dofCount)
+	rbdlMatrixNd G;
+	/// Motion subspace of every degree of freedom in base coordinates
+	/// (6 x dofCount, angular part first)
+	rbdlMatrixNd jointAxes;
+	/// Stacked Jacobian of all markers (3 * markerCount x dofCount)
+	rbdlMatrixNd J;
+	/// Stacked marker residuals (3 * markerCount)
+	rbdlVectorNd e;
+	/// Row weighted residuals (3 * markerCount), used by
+	/// SugiharaTaskSpaceIK() in joint space
+	rbdlVectorNd weightedResiduals;
+
+	/// Symmetric positive definite matrix of the normal equations
+	/// (3 * markerCount or dofCount square)
+	rbdlMatrixNd normalMatrix;
+	rbdlVectorNd normalRhs;
+	rbdlVectorNd normalSolution;
+	Eigen::LLT<rbdlMatrixNd> normalLLT;
+	/// Only used if normalLLT fails due to round-off
+	Eigen::LDLT<rbdlMatrixNd> normalLDLT;
+
+	rbdlVectorNd deltaTheta;
+
+	/// Whether models with at most IKMaxFixedDofCount degrees of freedom use
+	/// fixed size matrices for the joint space normal equations
+	bool useFixedSize;
+	IKPrecision precision;
+	/// Solver of the joint space normal equations if fixed size matrices
+	/// or single precision are used, NULL otherwise. Tree sparse models
+	/// (see useTreeSparsity) keep using the tree factorization.
+	std::unique_ptr<IKNormalSolver> normalSolver;
+
+	/// State, residuals and gradient J^T e used by
+	/// AdaptiveLevenbergMarquardtIK()
+	rbdlVectorNd trialQ;
+	rbdlVectorNd trialResiduals;
+	rbdlVectorNd gradient;
+
+	/// If set, the IK methods add the timings of their Jacobian
+	/// evaluations and solves to it
+	IKProfile *profile;
+	/// If set, the IK methods record the residual and step norm of every
+	/// iteration in it
+	FitTelemetry *telemetry;
+};
+
+/// Seconds since an arbitrary point in time if profiling is enabled
+double IKProfileClock (const IKWorkspace &workspace);
+
+/** Computes the stacked Jacobian workspace.J and the residuals workspace.e
+ * of all markers at Q.
+ *
+ * The kinematics are updated once and the motion subspace of every joint
+ * is transformed to base coordinates only once. The columns of each
+ * marker are then directly written into J while walking up its chain.
+ *
+ * Expects the workspace to be sized for the model and the markers.
+ */
+void ComputeMarkerJacobian (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Q,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		IKWorkspace &workspace
+		);
+
+/** Same as ComputeMarkerJacobian() but calls CalcPointJacobian() and
+ * CalcBodyToBaseCoordinates() for every marker. */
+void ComputeMarkerJacobianPointwise (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Q,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		IKWorkspace &workspace
+		);
+
+/** Inverse Kinematics using a Levenberg Marquardt with constant lambda
+ */
+bool LevenbergMarquardtIK (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Qinit,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &Qres,
+		double step_tol,
+		double lambda,
+		unsigned int max_iter,
+		unsigned int *steps,
+		IKWorkspace &workspace
+		);
+
+/** Inverse Kinematics method by Sugihara
+ *
+ * Sugihara, T., "Solvability-Unconcerned Inverse Kinematics by the
+ * Levenberg–Marquardt Method," Robotics, IEEE Transactions on , vol.27, no.5,
+ * pp.984,991, Oct. 2011 doi: 10.1109/TRO.2011.2148230
+ */
+bool SugiharaIK (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Qinit,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &Qres,
+		double step_tol,
+		unsigned int max_iter,
+		unsigned int *steps,
+		IKWorkspace &workspace
+		);
+
+/** Inverse Kinematics method by Sugihara with the damping in task space
+ */
+bool SugiharaTaskSpaceIK (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Qinit,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &Qres,
+		double step_tol,
+		unsigned int max_iter,
+		unsigned int *steps,
+		IKWorkspace &workspace
+		);
+
+/** Inverse Kinematics using Levenberg Marquardt with adaptive damping
+ *
+ * The damping is updated from the ratio of actual and predicted
+ * reduction of the squared residual after every step and steps that do
+ * not reduce the residual are rejected as described in
+ *
+ * Nielsen, H. B., "Damping Parameter in Marquardt's Method," Technical
+ * Report IMM-REP-1999-05, Technical University of Denmark, 1999.
+ *
+ * If damping is not positive it is initialized from the diagonal of
+ * J^T J. On return it contains the damping of the last step so that it can
+ * be reused for the next frame.
+ *
+ * Stops when the step, the gradient, the residual or the relative
+ * improvement of the squared residual become smaller than step_tol.
+ */
+bool AdaptiveLevenbergMarquardtIK (
+		RigidBodyDynamics::Model &model,
+		const rbdlVectorNd &Qinit,
+		const std::vector<unsigned int>& body_id,
+		const std::vector<rbdlVector3d>& body_point,
+		const std::vector<rbdlVector3d>& target_pos,
+		rbdlVectorNd &Qres,
+		double step_tol,
+		double &damping,
+		unsigned int max_iter,
+		unsigned int *steps,
+		IKWorkspace &workspace
+		);
+
+/* INVERSE_KINEMATICS_H */
+#endif
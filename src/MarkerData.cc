@@ -25,16 +25,27 @@
 
 #include "Scene.h"
 #include "MarkerData.h"
-#include "c3dfile.h"
+#include "C3DReader.h"
 
 #include <limits>
+#include <algorithm>
+#include <map>
+#include <atomic>
+
+#include <Eigen/Core>
 
 using namespace std;
 
+/// Revisions are unique across all instances such that handles and fit
+/// plans cannot be mistaken for the ones of data that was deleted.
+static std::atomic<unsigned int> next_revision (1);
+
 MarkerData::~MarkerData() {
-	if (c3dfile) {
-		delete c3dfile;
-		c3dfile = NULL;
+	stopPrefetch();
+
+	if (c3dReader) {
+		delete c3dReader;
+		c3dReader = NULL;
 	}
 	for (size_t i = 0; i < markers.size(); i++) {
 		scene->destroyObject<MarkerObject>(markers[i]);
@@ -42,19 +53,33 @@ MarkerData::~MarkerData() {
 }
 
 bool MarkerData::loadFromFile(const char *filename) {
-	if (c3dfile) {
-		delete c3dfile;
-		markers.clear();
-	}
+	stopPrefetch();
 
-	c3dfile = new C3DFile;
-	if (!c3dfile->load (filename)) {
+	C3DReader *reader = new C3DReader;
+	if (!reader->open (filename)) {
 		cerr << "Error loading marker data from file '" << filename << "'!" << endl;
 		abort();
 		return false;
 	}
 
+	// keep the previous data if the file is of no use
+	if (reader->lastFrame < reader->firstFrame) {
+		cerr << "Error: marker data file '" << filename << "' contains no frames!" << endl;
+		delete reader;
+		return false;
+	}
+
+	if (c3dReader) {
+		delete c3dReader;
+		markers.clear();
+	}
+
+	c3dReader = reader;
+
+	updatePositions();
+
 	currentFrame = getFirstFrame();
+	revision = next_revision++;
 
 	if (!scene)
 		return true;
@@ -67,6 +92,195 @@ bool MarkerData::loadFromFile(const char *filename) {
 	return true;
 }
 
+/** Sets up the window of decoded positions for the markers of the c3d
+ * file. The positions are decoded when the frames are accessed.
+ */
+void MarkerData::updatePositions () {
+	std::lock_guard<std::mutex> lock (blockMutex);
+
+	firstFrame = getFirstFrame();
+	frameCount = getLastFrame() - firstFrame + 1;
+
+	// the cache is ordered by label to find markers by binary search
+	std::map<std::string, unsigned int> label_points;
+	for (unsigned int pi = 0; pi < c3dReader->pointLabels.size(); pi++) {
+		const std::string &label = c3dReader->pointLabels[pi];
+		if (label.size() > 0 && label_points.find (label) == label_points.end())
+			label_points[label] = pi;
+	}
+
+	markerLabels.clear();
+	markerPoints.clear();
+	std::map<std::string, unsigned int>::const_iterator label_iter = label_points.begin();
+	for (; label_iter != label_points.end(); label_iter++) {
+		markerLabels.push_back (label_iter->first);
+		markerPoints.push_back (label_iter->second);
+	}
+
+	assert (frameCount > 0);
+
+	blockSlots.assign ((frameCount + blockFrameCount - 1) / blockFrameCount, -1);
+	zeroFrame.assign (markerLabels.size() * 3, 0.f);
+	blocks.clear();
+	prefetchQueue.clear();
+	lastBlock = -1;
+	blockGeneration++;
+	markerBoundsValid = false;
+}
+
+void MarkerData::setFrameWindow (int block_frame_count, unsigned int max_block_count, unsigned int prefetch_block_count) {
+	assert (block_frame_count > 0);
+	assert (max_block_count > prefetch_block_count + 1);
+
+	stopPrefetch();
+
+	blockFrameCount = block_frame_count;
+	maxBlockCount = max_block_count;
+	prefetchBlockCount = prefetch_block_count;
+
+	if (c3dReader)
+		updatePositions();
+}
+
+void MarkerData::decodeBlock (int block, bool rotate, std::vector<float> &positions) {
+	int frame_start = block * blockFrameCount;
+	int block_frames = std::min (blockFrameCount, frameCount - frame_start);
+	size_t marker_count = markerLabels.size();
+
+	positions.resize (block_frames * marker_count * 3);
+
+	float scale_xy = rotate ? -1.0e-3f : 1.0e-3f;
+	float scale_z = 1.0e-3f;
+
+	for (int fi = 0; fi < block_frames; fi++) {
+		float *frame_positions = &positions[fi * marker_count * 3];
+		c3dReader->readPoints (frame_start + fi, markerPoints.data(), marker_count, frame_positions);
+
+		for (size_t mi = 0; mi < marker_count; mi++) {
+			frame_positions[mi * 3] *= scale_xy;
+			frame_positions[mi * 3 + 1] *= scale_xy;
+			frame_positions[mi * 3 + 2] *= scale_z;
+		}
+	}
+}
+
+/// Returns an unused slot or frees the least recently used one
+int MarkerData::findFreeSlot () {
+	if (blocks.size() < maxBlockCount) {
+		blocks.push_back (MarkerFrameBlock());
+		return blocks.size() - 1;
+	}
+
+	int result = 0;
+	for (size_t i = 1; i < blocks.size(); i++) {
+		if (blocks[i].lastUse < blocks[result].lastUse)
+			result = i;
+	}
+
+	if (blocks[result].block != -1)
+		blockSlots[blocks[result].block] = -1;
+	blocks[result].block = -1;
+
+	return result;
+}
+
+/** Makes the block resident and schedules the following blocks for
+ * prefetching. blockMutex must be locked. */
+int MarkerData::useBlock (int block) {
+	int slot = blockSlots[block];
+
+	if (slot == -1) {
+		slot = findFreeSlot();
+		decodeBlock (block, rotateZ, blocks[slot].positions);
+		blocks[slot].block = block;
+		blockSlots[block] = slot;
+	}
+
+	blocks[slot].lastUse = ++useCounter;
+
+	if (block != lastBlock) {
+		lastBlock = block;
+
+		bool queued = false;
+		for (unsigned int i = 1; i <= prefetchBlockCount && block + i < blockSlots.size(); i++) {
+			if (blockSlots[block + i] == -1) {
+				prefetchQueue.push_back (block + i);
+				queued = true;
+			}
+		}
+
+		// only the blocks ahead of the latest access are of interest
+		while (prefetchQueue.size() > prefetchBlockCount)
+			prefetchQueue.pop_front();
+
+		if (queued) {
+			if (!prefetchThread.joinable()) {
+				prefetchQuit = false;
+				prefetchThread = std::thread (&MarkerData::prefetchLoop, this);
+			}
+			prefetchCondition.notify_one();
+		}
+	}
+
+	return slot;
+}
+
+/** Decodes the queued blocks. The decoding happens without holding the
+ * lock such that readers of resident blocks are not blocked. */
+void MarkerData::prefetchLoop () {
+	std::vector<float> positions;
+	std::unique_lock<std::mutex> lock (blockMutex);
+
+	while (true) {
+		prefetchCondition.wait (lock, [this] { return prefetchQuit || !prefetchQueue.empty(); });
+
+		if (prefetchQuit)
+			break;
+
+		int block = prefetchQueue.front();
+		prefetchQueue.pop_front();
+
+		if (blockSlots[block] != -1)
+			continue;
+
+		unsigned int generation = blockGeneration;
+		bool rotate = rotateZ;
+
+		lock.unlock();
+		decodeBlock (block, rotate, positions);
+		lock.lock();
+
+		// the data may have changed or a reader decoded it meanwhile
+		if (generation != blockGeneration || blockSlots[block] != -1)
+			continue;
+
+		int slot = findFreeSlot();
+		blocks[slot].positions.swap (positions);
+		blocks[slot].block = block;
+		blocks[slot].lastUse = ++useCounter;
+		blockSlots[block] = slot;
+	}
+}
+
+void MarkerData::stopPrefetch () {
+	if (!prefetchThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock (blockMutex);
+		prefetchQuit = true;
+	}
+	prefetchCondition.notify_one();
+	prefetchThread.join();
+}
+
+void MarkerData::getFramePositions (int frame, float *xyz) {
+	std::lock_guard<std::mutex> lock (blockMutex);
+
+	const float *positions = getFrame (frame);
+	std::copy (positions, positions + markerLabels.size() * 3, xyz);
+}
+
 void MarkerData::clearMarkers () {
 	for (unsigned int i = 0; i < markers.size(); i++) {
 		scene->destroyObject<MarkerObject>(markers[i]);
@@ -76,18 +290,21 @@ void MarkerData::clearMarkers () {
 }
 
 void MarkerData::enableMarker (const char* marker_name, const Vector3f &color) {
-	assert (c3dfile);
+	assert (c3dReader);
+
+	MarkerHandle handle = getMarkerHandle (marker_name);
 
-	if (markerExists(marker_name)) {
+	if (handle.isValid()) {
 		MarkerObject* scene_marker = scene->createObject<MarkerObject>();
 		scene_marker->color.block<3,1>(0,0) = color;
 
-		Vector3f position = getMarkerCurrentPosition(marker_name);
+		Vector3f position = getMarkerCurrentPosition(handle);
 		scene_marker->transformation.translation = position;
 		scene_marker->mesh = CreateUVSphere (4, 8);
 		scene_marker->transformation.scaling = Vector3f (0.02f, 0.02f, 0.02f);
 		scene_marker->noDepthTest = true;
 		scene_marker->markerName = marker_name;
+		scene_marker->markerHandle = handle;
 
 		markers.push_back (scene_marker);
 	} else {
@@ -96,26 +313,54 @@ void MarkerData::enableMarker (const char* marker_name, const Vector3f &color) {
 }
 
 bool MarkerData::markerExists(const char* marker_name) {
+	return getMarkerIndex (marker_name) != -1;
+}
+
+int MarkerData::getMarkerIndex(const char* marker_name) {
 	std::string point_label(marker_name);
 	
 	point_label = point_label.substr(0, point_label.find_last_not_of(" ") + 1);
 
-	if (c3dfile->label_point_map.find(point_label) == c3dfile->label_point_map.end()) {
-		return false;
+	std::vector<std::string>::const_iterator label_iter = std::lower_bound (markerLabels.begin(), markerLabels.end(), point_label);
+
+	if (label_iter == markerLabels.end() || *label_iter != point_label) {
+		return -1;
 	}
 
-	return true;
+	return static_cast<int>(label_iter - markerLabels.begin());
 }
 
 Vector3f MarkerData::getMarkerCurrentPosition(const char * marker_name) {
-	FloatMarkerData marker_traj = c3dfile->getMarkerTrajectories (marker_name);
+	int marker_index = getMarkerIndex (marker_name);
 
-	int index = currentFrame - getFirstFrame();
+	if (marker_index == -1) {
+		cerr << "Error: marker '" << marker_name << "' does not exist!" << endl;
+		abort();
+	}
 
-	if (rotateZ) 
-		return Vector3f (-marker_traj.x[index], -marker_traj.y[index], marker_traj.z[index]) * 1.0e-3;
-	
-	return Vector3f (marker_traj.x[index], marker_traj.y[index], marker_traj.z[index]) * 1.0e-3;
+	return getMarkerPosition (marker_index, currentFrame);
+}
+
+/** Returns the positions of a marker for all frames from getFirstFrame()
+ * to getLastFrame() (in meters, same as getMarkerCurrentPosition()).
+ */
+std::vector<Vector3f> MarkerData::getMarkerTrajectory(const char * marker_name) {
+	int marker_index = getMarkerIndex (marker_name);
+
+	if (marker_index == -1) {
+		cerr << "Error: marker '" << marker_name << "' does not exist!" << endl;
+		abort();
+	}
+
+	std::vector<Vector3f> result (frameCount);
+	std::lock_guard<std::mutex> lock (blockMutex);
+
+	for (int index = 0; index < frameCount; index++) {
+		const float *position = getFrame (firstFrame + index) + marker_index * 3;
+		result[index] = Vector3f (position[0], position[1], position[2]);
+	}
+
+	return result;
 }
 
 std::string MarkerData::getMarkerName (int object_id) {
@@ -131,21 +376,21 @@ std::string MarkerData::getMarkerName (int object_id) {
 }
 
 int MarkerData::getFirstFrame () {
-	assert (c3dfile);
+	assert (c3dReader);
 
-	return static_cast<int>(c3dfile->header.first_frame);
+	return c3dReader->firstFrame;
 }
 
 int MarkerData::getLastFrame () {
-	assert (c3dfile);
+	assert (c3dReader);
 
-	return static_cast<int>(c3dfile->header.last_frame);
+	return c3dReader->lastFrame;
 }
 
 float MarkerData::getFrameRate () {
-	assert (c3dfile);
+	assert (c3dReader);
 
-	return c3dfile->header.video_sampling_rate;
+	return c3dReader->frameRate;
 }
 
 void MarkerData::setCurrentFrameNumber (int frame_number) {
@@ -157,9 +402,33 @@ void MarkerData::setCurrentFrameNumber (int frame_number) {
 	updateMarkerSceneObjects();
 }
 
+void MarkerData::setRotateZ (bool rotate) {
+	if (rotateZ == rotate)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock (blockMutex);
+
+		rotateZ = rotate;
+
+		// blocks get decoded again with the new orientation
+		for (size_t i = 0; i < blocks.size(); i++) {
+			if (blocks[i].block != -1)
+				blockSlots[blocks[i].block] = -1;
+			blocks[i].block = -1;
+			blocks[i].lastUse = 0;
+		}
+		lastBlock = -1;
+		blockGeneration++;
+		markerBoundsValid = false;
+	}
+
+	updateMarkerSceneObjects();
+}
+
 void MarkerData::updateMarkerSceneObjects() {
 	for (size_t i = 0; i < markers.size(); i++) {
-		Vector3f position = getMarkerCurrentPosition(markers[i]->markerName.c_str());
+		Vector3f position = getMarkerCurrentPosition (markers[i]->markerHandle);
 		markers[i]->transformation.translation = position;
 	}
 }
@@ -168,20 +437,70 @@ void MarkerData::calcDataBoundingBox(Vector3f &min, Vector3f &max) {
 	min = Vector3f (std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
 	max = -min;
 
-	int current_frame_temp = currentFrame;
+	std::vector<Vector3f> marker_min, marker_max;
+	calcMarkerBounds (marker_min, marker_max);
 
-	for (int frame = getFirstFrame(); frame <= getLastFrame(); frame++) {
-		setCurrentFrameNumber (frame);
-		
-		for (size_t mi = 0; mi < markers.size(); mi++) {
-			Vector3f pos = getMarkerCurrentPosition (markers[mi]->markerName.c_str());
+	for (size_t mi = 0; mi < markers.size(); mi++) {
+		int index = markers[mi]->markerHandle.index;
 
-			for (size_t i = 0; i < 2; i++) {
-				min[i] = std::min(pos[i], min[i]);
-				max[i] = std::max(pos[i], max[i]);
+		for (size_t i = 0; i < 3; i++) {
+			min[i] = std::min(marker_min[index][i], min[i]);
+			max[i] = std::max(marker_max[index][i], max[i]);
+		}
+	}
+}
+
+void MarkerData::calcMarkerBounds (std::vector<Vector3f> &min, std::vector<Vector3f> &max) {
+	typedef Eigen::Array<float, 3, Eigen::Dynamic> MarkerArray;
+	typedef Eigen::Array<bool, 1, Eigen::Dynamic> MarkerMask;
+
+	size_t marker_count = markerLabels.size();
+
+	if (!markerBoundsValid) {
+		MarkerArray bounds_min = MarkerArray::Constant (3, marker_count, std::numeric_limits<float>::max());
+		MarkerArray bounds_max = MarkerArray::Constant (3, marker_count, -std::numeric_limits<float>::max());
+		MarkerMask valid (marker_count);
+
+		std::vector<float> block_positions;
+
+		// reads the blocks directly without replacing the ones of the window
+		for (size_t block = 0; block < blockSlots.size(); block++) {
+			const float *positions = NULL;
+			{
+				std::lock_guard<std::mutex> lock (blockMutex);
+				if (blockSlots[block] != -1) {
+					block_positions = blocks[blockSlots[block]].positions;
+					positions = block_positions.data();
+				}
+			}
+
+			if (!positions) {
+				decodeBlock (block, rotateZ, block_positions);
+				positions = block_positions.data();
+			}
+
+			size_t block_frames = block_positions.size() / std::max (marker_count * 3, static_cast<size_t>(1));
+
+			for (size_t fi = 0; fi < block_frames; fi++) {
+				Eigen::Map<const MarkerArray> frame (positions + fi * marker_count * 3, 3, marker_count);
+
+				// invalid samples are zero and must not affect the bounds
+				valid = (frame != 0.f).colwise().any();
+				bounds_min = valid.replicate<3, 1>().select (bounds_min.min (frame), bounds_min);
+				bounds_max = valid.replicate<3, 1>().select (bounds_max.max (frame), bounds_max);
 			}
 		}
+
+		markerBoundsMin.assign (bounds_min.data(), bounds_min.data() + bounds_min.size());
+		markerBoundsMax.assign (bounds_max.data(), bounds_max.data() + bounds_max.size());
+		markerBoundsValid = true;
 	}
 
-	setCurrentFrameNumber(current_frame_temp);
+	min.resize (marker_count);
+	max.resize (marker_count);
+
+	for (size_t mi = 0; mi < marker_count; mi++) {
+		min[mi] = Vector3f (markerBoundsMin[mi * 3], markerBoundsMin[mi * 3 + 1], markerBoundsMin[mi * 3 + 2]);
+		max[mi] = Vector3f (markerBoundsMax[mi * 3], markerBoundsMax[mi * 3 + 1], markerBoundsMax[mi * 3 + 2]);
+	}
 }
@@ -28,37 +28,133 @@
 
 #include <string>
 #include <vector>
+#include <cassert>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "SimpleMath/SimpleMath.h"
 #include "SimpleMath/SimpleMathGL.h"
 
-struct C3DFile;
+struct C3DReader;
 struct Scene;
 
+/** Marker of the marker data that was resolved by its name.
+ *
+ * Handles are obtained once with MarkerData::getMarkerHandle() and allow
+ * to access the marker positions without any name lookups. A handle is
+ * only valid for the data that was loaded when it was resolved.
+ */
+struct MarkerHandle {
+	MarkerHandle() :
+		index (-1),
+		revision (0)
+	{}
+	MarkerHandle (int index_, unsigned int revision_) :
+		index (index_),
+		revision (revision_)
+	{}
+
+	bool isValid() const {
+		return index != -1;
+	}
+
+	/// Index of the marker in the position cache of MarkerData
+	int index;
+	/// Revision of the MarkerData the handle was resolved for
+	unsigned int revision;
+};
+
 struct MarkerObject : public SceneObject {
 	std::string markerName;
+	MarkerHandle markerHandle;
+};
+
+/// Decoded positions of consecutive frames of all markers
+struct MarkerFrameBlock {
+	MarkerFrameBlock() :
+		block (-1),
+		lastUse (0)
+	{}
+
+	/// Index of the block in the recording or -1 if unused
+	int block;
+	unsigned long lastUse;
+	std::vector<float> positions;
 };
 
 struct MarkerData {
 	MarkerData() :
 		scene (NULL),
-		c3dfile (NULL),
+		c3dReader (NULL),
 		currentFrame (-1),
-		rotateZ(false)
+		rotateZ(false),
+		revision (0),
+		firstFrame (0),
+		frameCount (0),
+		blockFrameCount (256),
+		maxBlockCount (32),
+		prefetchBlockCount (4),
+		useCounter (0),
+		lastBlock (-1),
+		blockGeneration (0),
+		prefetchQuit (false),
+		markerBoundsValid (false)
 	{}
 	MarkerData(Scene* scene_) :
 		scene (scene_),
-		c3dfile (NULL),
+		c3dReader (NULL),
 		currentFrame (-1),
-		rotateZ(false)
+		rotateZ(false),
+		revision (0),
+		firstFrame (0),
+		frameCount (0),
+		blockFrameCount (256),
+		maxBlockCount (32),
+		prefetchBlockCount (4),
+		useCounter (0),
+		lastBlock (-1),
+		blockGeneration (0),
+		prefetchQuit (false),
+		markerBoundsValid (false)
 	{}
 	~MarkerData();
 
 	Scene *scene;
-	C3DFile *c3dfile;
+	C3DReader *c3dReader;
 	int currentFrame;
 	std::vector<MarkerObject*> markers;
 	bool rotateZ;
+	/// Incremented whenever new data gets loaded
+	unsigned int revision;
+
+	/** Window of decoded marker positions.
+	 *
+	 * Positions are decoded from the c3d file in blocks of blockFrameCount
+	 * frames in meters with rotateZ applied. A block stores the frames
+	 * frame major, i.e. the coordinates of marker mi in the frame fi of
+	 * the block are at (fi * getMarkerCount() + mi) * 3. At most
+	 * maxBlockCount blocks are kept, the least recently used one gets
+	 * replaced. Whenever the frames of another block are accessed, the
+	 * following prefetchBlockCount blocks are decoded by a background
+	 * thread. Memory use therefore does not depend on the length of the
+	 * recording.
+	 */
+	std::vector<MarkerFrameBlock> blocks;
+	/// Index into blocks for every block of the recording or -1
+	std::vector<int> blockSlots;
+	/// Positions of the frames outside of the data
+	std::vector<float> zeroFrame;
+	/// Labels of the markers in the order of the position cache
+	std::vector<std::string> markerLabels;
+	/// Points of the c3d file in the order of the position cache
+	std::vector<unsigned int> markerPoints;
+	int firstFrame;
+	int frameCount;
+	int blockFrameCount;
+	unsigned int maxBlockCount;
+	unsigned int prefetchBlockCount;
 
 	bool isMarkerObject(int objectid) {
 		for (size_t i = 0; i < markers.size(); i++) {
@@ -74,15 +170,100 @@ struct MarkerData {
 	bool loadFromFile (const char* filename);
 	bool markerExists (const char* marker_name);
 	Vector3f getMarkerCurrentPosition (const char* marker_name);
+	Vector3f getMarkerCurrentPosition (const MarkerHandle &handle) {
+		return getMarkerPosition (handle, currentFrame);
+	}
+	/// Returns the index of the marker in the position cache or -1 if the
+	/// marker does not exist.
+	int getMarkerIndex (const char* marker_name);
+	/// Returns an invalid handle if the marker does not exist.
+	MarkerHandle getMarkerHandle (const char* marker_name) {
+		return MarkerHandle (getMarkerIndex (marker_name), revision);
+	}
+	unsigned int getMarkerCount () const {
+		return markerLabels.size();
+	}
+	/** Position of a single marker. Every call locks the frame window,
+	 * use getFramePositions() to read several markers of a frame. */
+	Vector3f getMarkerPosition (int marker_index, int frame) {
+		std::lock_guard<std::mutex> lock (blockMutex);
+		const float *position = getFrame (frame) + marker_index * 3;
+		return Vector3f (position[0], position[1], position[2]);
+	}
+	Vector3f getMarkerPosition (const MarkerHandle &handle, int frame) {
+		assert (handle.isValid());
+		assert (handle.revision == revision);
+		return getMarkerPosition (handle.index, frame);
+	}
+	/// Copies the getMarkerCount() * 3 coordinates of all markers in the
+	/// given frame to xyz.
+	void getFramePositions (int frame, float *xyz);
+	/// Resizes xyz and copies the positions of the frame into it
+	void getFramePositions (int frame, std::vector<float> &xyz) {
+		xyz.resize (getMarkerCount() * 3);
+		getFramePositions (frame, xyz.data());
+	}
+	/** Sets the size of the window of decoded frames. Blocks of
+	 * block_frame_count frames are decoded at once, at most
+	 * max_block_count blocks are kept in memory and up to
+	 * prefetch_block_count of them are decoded ahead of the accessed
+	 * frames. */
+	void setFrameWindow (int block_frame_count, unsigned int max_block_count, unsigned int prefetch_block_count);
+	std::vector<Vector3f> getMarkerTrajectory (const char* marker_name);
 	std::string getMarkerName (int objectid);
 	int getFirstFrame ();
 	int getLastFrame ();
 	float getFrameRate ();
 	void setCurrentFrameNumber (int frame_number);
+	/// Rotates the data by 180 degrees about the Z axis
+	void setRotateZ (bool rotate);
 	void updateMarkerSceneObjects();
+	/// Bounds of the enabled markers over all frames
 	void calcDataBoundingBox (Vector3f &min, Vector3f &max);
+	/** Bounds of every marker (in the order of the position cache) over
+	 * all frames. Invalid (zero) samples are ignored, markers without
+	 * valid samples get min > max. The bounds are computed once per
+	 * loaded data and orientation. */
+	void calcMarkerBounds (std::vector<Vector3f> &min, std::vector<Vector3f> &max);
 
 	private:
+	void updatePositions ();
+	/** Returns the positions of the frame, blockMutex must be locked.
+	 * Frames outside of the data have all markers at the origin, which
+	 * marks them as invalid. */
+	const float* getFrame (int frame) {
+		if (frame < firstFrame || frame >= firstFrame + frameCount)
+			return zeroFrame.data();
+
+		int index = frame - firstFrame;
+		int block = index / blockFrameCount;
+		int slot = blockSlots[block];
+
+		if (slot == -1 || block != lastBlock)
+			slot = useBlock (block);
+
+		return blocks[slot].positions.data() + (index - block * blockFrameCount) * markerLabels.size() * 3;
+	}
+	int useBlock (int block);
+	int findFreeSlot ();
+	void decodeBlock (int block, bool rotate, std::vector<float> &positions);
+	void prefetchLoop ();
+	void stopPrefetch ();
+
+	unsigned long useCounter;
+	int lastBlock;
+	/// Incremented whenever decoded blocks become invalid
+	unsigned int blockGeneration;
+	std::mutex blockMutex;
+	std::condition_variable prefetchCondition;
+	std::deque<int> prefetchQueue;
+	std::thread prefetchThread;
+	bool prefetchQuit;
+
+	bool markerBoundsValid;
+	std::vector<float> markerBoundsMin;
+	std::vector<float> markerBoundsMax;
+
 	MarkerData (const MarkerData &marker_data) {};
 	MarkerData& operator= (const MarkerData &marker_data) { return *this; };
 };
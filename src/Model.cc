@@ -35,6 +35,7 @@
 #include <fstream>
 #include <clocale>
 #include <algorithm>
+#include <atomic>
 #include <sys/stat.h>
 #include "luatables.h"
 
@@ -50,6 +51,10 @@ typedef RigidBodyDynamics::Math::Vector3d RBDLVector3d;
 typedef RigidBodyDynamics::Math::Matrix3d RBDLMatrix3d;
 typedef RigidBodyDynamics::Math::SpatialTransform SpatialTransform;
 
+/// Revisions are unique across all instances such that fit plans cannot
+/// be mistaken for the ones of a model that was deleted.
+static std::atomic<unsigned int> next_revision (1);
+
 bool file_exists (const char* path) {
 	struct stat s;
 	int err = stat(path, &s);
@@ -637,6 +642,7 @@ void Model::clearModel() {
 
 void Model::updateFromLua() {
 	clearModel();
+	revision = next_revision++;
 
 //	assert (luaTable->L);
 
@@ -882,6 +888,31 @@ bool Model::loadFromFile(const char* filename) {
 	return true;
 }
 
+bool Model::loadFromModel(Model &model) {
+	assert (model.luaTable);
+
+	setlocale(LC_NUMERIC, "C");
+
+	if (rbdlModel) {
+		delete rbdlModel;
+	}
+	rbdlModel = new RigidBodyDynamics::Model;
+
+	if (luaTable) {
+		delete luaTable;
+	}
+	luaTable = new LuaTable();
+
+	LuaTable luatable_temp = LuaTable::fromLuaExpression (model.luaTable->serialize().c_str());
+	*luaTable = luatable_temp;
+
+	fileName = model.fileName;
+	updateFromLua();
+	modelStateQ = model.modelStateQ;
+
+	return true;
+}
+
 void Model::saveToFile(const char* filename) {
 	assert (luaTable);
 	assert (rbdlModel);
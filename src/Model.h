@@ -103,13 +103,15 @@ struct Model {
 		fileName(""),
 		scene(NULL),
 		luaTable(NULL),
-		rbdlModel(NULL)
+		rbdlModel(NULL),
+		revision(0)
 	{}
 	Model(Scene* scene_) :
 		fileName(""),
 		scene (scene_),
 		luaTable (NULL),
-		rbdlModel (NULL)
+		rbdlModel (NULL),
+		revision (0)
 	{}
 	~Model();
 
@@ -118,6 +120,9 @@ struct Model {
 	LuaTable *luaTable;
 	RigidBodyDynamics::Model *rbdlModel;
 	VectorNd modelStateQ;
+	/// Changes whenever the model gets rebuilt by updateFromLua(). Unique
+	/// across all models, 0 if nothing was loaded yet.
+	unsigned int revision;
 
 	std::vector<JointObject*> joints;
 	std::vector<VisualsObject*> visuals;
@@ -238,6 +243,9 @@ struct Model {
 	Vector3f getContactPointLocal (int contact_point_index) const;
 
 	bool loadFromFile (const char* filename);
+	/// Loads the description of the other model. The result shares no Lua
+	/// or RBDL state with it and can therefore be used by another thread.
+	bool loadFromModel (Model &model);
 	void saveToFile (const char* filename);
 	void loadStateFromFile (const char* filename);
 	void saveStateToFile (const char* filename);
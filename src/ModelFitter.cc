@@ -28,15 +28,14 @@
 #include "Model.h"
 #include "MarkerData.h"
 #include "Animation.h"
-#include <fstream>
+#include "InverseKinematics.h"
+#include <algorithm>
+#include <map>
+#include <stdint.h>
 #include <rbdl/rbdl.h>
 
 using namespace std;
 
-typedef RigidBodyDynamics::Math::Vector3d rbdlVector3d;
-typedef RigidBodyDynamics::Math::VectorNd rbdlVectorNd;
-typedef RigidBodyDynamics::Math::MatrixNd rbdlMatrixNd;
-
 template <typename OutType, typename InType>
 OutType ConvertVector(const InType &in_vec) {
 	OutType result = OutType::Zero (in_vec.size());
@@ -47,342 +46,613 @@ OutType ConvertVector(const InType &in_vec) {
 	return result;
 }
 
-struct ModelFitter::ModelFitterInternal {
-	rbdlVectorNd Qinit;
-	rbdlVectorNd Qres;
-	std::map<std::string, int> marker_residual_index;
-	std::vector<unsigned int> body_ids;
-	std::vector<rbdlVector3d> body_points;
-	std::vector<rbdlVector3d> target_pos;
-	std::vector<string> marker_names;
+template <typename OutType, typename InType>
+void CopyVector(const InType &in_vec, OutType &out_vec) {
+	out_vec.resize (in_vec.size());
+	for (size_t i = 0; i < in_vec.size(); i++) {
+		out_vec[i] = in_vec[i];
+	}
+}
+
+/** Everything needed to set up the IK of a frame that only depends on the
+ * model markers and the marker data.
+ *
+ * Looking up the markers in the Lua model and in the C3D data is
+ * expensive, so this is compiled once and reused for all frames until
+ * either the model or the marker data changes.
+ */
+struct FitPlan {
+	FitPlan() :
+		compiled (false),
+		model (NULL),
+		data (NULL),
+		modelRevision (0),
+		dataRevision (0),
+		rotateZ (false),
+		firstFrame (0),
+		frameCount (0)
+	{}
+
+	bool isValidFor (Model *model, MarkerData *data) const;
+	void compile (Model *model, MarkerData *data);
+	/// Fills frameFingerprints from the current marker data
+	void computeFrameFingerprints ();
+	/** Marks the frames whose targets differ from the frame with the same
+	 * number in the old plan or that did not exist in it. Both plans need
+	 * their frame fingerprints. Returns false if the kinematic structure
+	 * changed and therefore all frames are affected. */
+	bool findChangedFrames (const FitPlan &old, std::vector<char> &changed) const;
+
+	/// Whether the marker data can be used for fitting
+	static bool positionValid (const rbdlVector3d &position) {
+		return !(position == rbdlVector3d (0., 0., 0.) || position.squaredNorm() > 1.0e2);
+	}
+	/// Reads the positions of all markers of the frame at once through the
+	/// frame window of the marker data
+	void readFrame (int frame, std::vector<float> &xyz) const {
+		data->getFramePositions (frame, xyz);
+	}
+	/// Position of the plan marker in a frame read by readFrame()
+	rbdlVector3d markerPosition (const std::vector<float> &xyz, unsigned int marker_index) const {
+		const float *position = &xyz[markerHandles[marker_index].index * 3];
+		return rbdlVector3d (position[0], position[1], position[2]);
+	}
+
+	bool compiled;
+	Model *model;
+	MarkerData *data;
+	unsigned int modelRevision;
+	unsigned int dataRevision;
+	bool rotateZ;
+
+	int firstFrame;
+	int frameCount;
+
+	/// Model markers that exist in the marker data
+	std::vector<std::string> markerNames;
+	std::vector<MarkerHandle> markerHandles;
+	std::vector<unsigned int> bodyIds;
+	std::vector<rbdlVector3d> bodyPoints;
+
+	/// Joint types, axes and transformations of the RBDL model. If these
+	/// differ, every frame has to be refitted.
+	std::vector<double> kinematicSignature;
+	/// Hash of the bodies, body points and positions of the markers with
+	/// valid data of every frame. Frames with the same fingerprint have
+	/// the same IK targets, regardless of the data they were read from.
+	std::vector<uint64_t> frameFingerprints;
 };
 
-ModelFitter::ModelFitter() {
-	internal = new ModelFitterInternal();
+static const uint64_t fingerprint_seed = 14695981039346656037ull;
+
+/// Adds the bytes of the values to the FNV-1a hash
+template <typename T>
+static void hash_values (uint64_t &hash, const T *values, size_t count) {
+	const unsigned char *bytes = reinterpret_cast<const unsigned char*>(values);
+	for (size_t i = 0; i < count * sizeof (T); i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
 }
 
-ModelFitter::ModelFitter (Model *model, MarkerData *data, unsigned int maxSteps) :
-		model (model),
-		data (data),
-		tolerance (1.0e-8),
-		success (false),
-		steps (0),
-		maxSteps (maxSteps)
-	{
-		internal = new ModelFitterInternal();
+/// Hash of the times and states of all keyframes
+static uint64_t animation_fingerprint (const Animation &animation) {
+	uint64_t hash = fingerprint_seed;
+	for (size_t ki = 0; ki < animation.keyFrames.size(); ki++) {
+		const AnimationKeyFrame &key_frame = animation.keyFrames[ki];
+		hash_values (hash, &key_frame.time, 1);
+		for (size_t i = 0; i < key_frame.state.size(); i++) {
+			double value = key_frame.state[i];
+			hash_values (hash, &value, 1);
+		}
 	}
 
-ModelFitter::~ModelFitter() {
-	delete internal;
+	return hash;
 }
 
-/** Inverse Kinematics using a Levenberg Marquardt with constant lambda
- */
-bool LevenbergMarquardtIK (
-		RigidBodyDynamics::Model &model,
-		const rbdlVectorNd &Qinit,
-		const std::vector<unsigned int>& body_id,
-		const std::vector<rbdlVector3d>& body_point,
-		const std::vector<rbdlVector3d>& target_pos,
-		rbdlVectorNd &Qres,
-		double step_tol,
-		double lambda,
-		unsigned int max_iter,
-		unsigned int *steps,
-		VectorNd *residuals
-		) {
+static void compute_kinematic_signature (const RigidBodyDynamics::Model &rbdl_model, std::vector<double> &signature) {
+	signature.clear();
+	signature.push_back (rbdl_model.q_size);
+
+	for (size_t j = 1; j < rbdl_model.mJoints.size(); j++) {
+		const RigidBodyDynamics::Joint &joint = rbdl_model.mJoints[j];
+		signature.push_back (rbdl_model.lambda[j]);
+		signature.push_back (joint.mJointType);
+		signature.insert (signature.end(), rbdl_model.X_T[j].E.data(), rbdl_model.X_T[j].E.data() + 9);
+		signature.insert (signature.end(), rbdl_model.X_T[j].r.data(), rbdl_model.X_T[j].r.data() + 3);
+		for (unsigned int di = 0; di < joint.mDoFCount; di++) {
+			signature.insert (signature.end(), joint.mJointAxes[di].data(), joint.mJointAxes[di].data() + 6);
+		}
+	}
 
-	assert (Qinit.size() == model.q_size);
-	assert (body_id.size() == body_point.size());
-	assert (body_id.size() == target_pos.size());
+	for (size_t i = 0; i < rbdl_model.mFixedBodies.size(); i++) {
+		const RigidBodyDynamics::FixedBody &fixed_body = rbdl_model.mFixedBodies[i];
+		signature.push_back (fixed_body.mMovableParent);
+		signature.insert (signature.end(), fixed_body.mParentTransform.E.data(), fixed_body.mParentTransform.E.data() + 9);
+		signature.insert (signature.end(), fixed_body.mParentTransform.r.data(), fixed_body.mParentTransform.r.data() + 3);
+	}
+}
 
-	rbdlMatrixNd J = rbdlMatrixNd::Zero(3 * body_id.size(), model.qdot_size);
-	rbdlVectorNd e = rbdlVectorNd::Zero(3 * body_id.size());
+bool FitPlan::isValidFor (Model *model_, MarkerData *data_) const {
+	return compiled
+		&& model == model_
+		&& data == data_
+		&& modelRevision == model_->revision
+		&& dataRevision == data_->revision
+		&& rotateZ == data_->rotateZ;
+}
 
-	Qres = Qinit;
+void FitPlan::compile (Model *model_, MarkerData *data_) {
+	model = model_;
+	data = data_;
+	modelRevision = model->revision;
+	dataRevision = data->revision;
+	rotateZ = data->rotateZ;
 
-	unsigned int ik_iter;
+	markerNames.clear();
+	markerHandles.clear();
+	bodyIds.clear();
+	bodyPoints.clear();
 
-	for (ik_iter = 0; ik_iter < max_iter; ik_iter++) {
-		UpdateKinematicsCustom (model, &Qres, NULL, NULL);
+	int model_frame_count = model->getFrameCount();
 
-		for (unsigned int k = 0; k < body_id.size(); k++) {
-			rbdlMatrixNd G (rbdlMatrixNd::Zero(3, model.qdot_size));
-			CalcPointJacobian (model, Qres, body_id[k], body_point[k], G, false);
-			rbdlVector3d point_base = CalcBodyToBaseCoordinates (model, Qres, body_id[k], body_point[k], false);
+	for (int frame_id = 1; frame_id <= model_frame_count; frame_id++) {
+		unsigned int body_id = model->frameIdToRbdlId[frame_id];
+		vector<Vector3f> marker_coords = model->getFrameMarkerCoords(frame_id);
+		vector<string> marker_names = model->getFrameMarkerNames(frame_id);
 
-			for (unsigned int i = 0; i < 3; i++) {
-				for (unsigned int j = 0; j < model.qdot_size; j++) {
-					unsigned int row = k * 3 + i;
-					J(row, j) = G (i,j);
-				}
+		assert (marker_coords.size() == marker_names.size());
 
-				e[k * 3 + i] = target_pos[k][i] - point_base[i];
+		for (size_t marker_idx = 0; marker_idx < marker_coords.size(); marker_idx++) {
+			MarkerHandle handle = data->getMarkerHandle (marker_names[marker_idx].c_str());
+			if (!handle.isValid()) {
+				cerr << "Warning: Model marker'" << marker_names[marker_idx] << "' not present in c3d data. Ignoring marker during fit!" << endl;
+				continue;
 			}
+
+			markerNames.push_back (marker_names[marker_idx]);
+			markerHandles.push_back (handle);
+			bodyIds.push_back (body_id);
+			bodyPoints.push_back (ConvertVector<rbdlVector3d, Vector3f> (marker_coords[marker_idx]));
 		}
+	}
 
-		// abort if we are getting "close"
-		if (e.norm() < step_tol) {
-			*residuals = ConvertVector<VectorNd, rbdlVectorNd> (e);
-			*steps = ik_iter;
+	firstFrame = data->getFirstFrame();
+	frameCount = data->getLastFrame() - firstFrame + 1;
 
-			return true;
-		}
+	compute_kinematic_signature (*(model->rbdlModel), kinematicSignature);
+	frameFingerprints.clear();
 
-		rbdlMatrixNd JJTe_lambda2_I = J * J.transpose() + lambda*lambda * rbdlMatrixNd::Identity(e.size(), e.size());
+	compiled = true;
+}
 
-		rbdlVectorNd z (body_id.size() * 3);
-		z = JJTe_lambda2_I.colPivHouseholderQr().solve (e);
+void FitPlan::computeFrameFingerprints () {
+	frameFingerprints.resize (frameCount);
+	std::vector<float> xyz;
 
-		rbdlVectorNd delta_theta = J.transpose() * z;
-		Qres = Qres + delta_theta;
+	for (int fi = 0; fi < frameCount; fi++) {
+		readFrame (firstFrame + fi, xyz);
 
-		if (delta_theta.norm() < step_tol) {
-			*residuals = ConvertVector<VectorNd, rbdlVectorNd> (e);
-			*steps = ik_iter;
-			return true;
+		uint64_t hash = fingerprint_seed;
+		for (size_t mi = 0; mi < markerHandles.size(); mi++) {
+			rbdlVector3d target = markerPosition (xyz, mi);
+			if (!positionValid (target))
+				continue;
+
+			hash_values (hash, &bodyIds[mi], 1);
+			hash_values (hash, bodyPoints[mi].data(), 3);
+			hash_values (hash, target.data(), 3);
 		}
+
+		frameFingerprints[fi] = hash;
 	}
+}
+
+bool FitPlan::findChangedFrames (const FitPlan &old, std::vector<char> &changed) const {
+	assert (frameFingerprints.size() == static_cast<size_t>(frameCount));
+
+	if (!old.compiled
+			|| old.frameFingerprints.size() != static_cast<size_t>(old.frameCount)
+			|| kinematicSignature != old.kinematicSignature)
+		return false;
 
-	*residuals = ConvertVector<VectorNd, rbdlVectorNd> (e);
-	*steps = ik_iter;
+	changed.assign (frameCount, 0);
 
-	return false;
+	for (int fi = 0; fi < frameCount; fi++) {
+		int old_fi = firstFrame + fi - old.firstFrame;
+		if (old_fi < 0 || old_fi >= old.frameCount
+				|| frameFingerprints[fi] != old.frameFingerprints[old_fi])
+			changed[fi] = 1;
+	}
+
+	return true;
 }
 
-/** Inverse Kinematics method by Sugihara
+/** Collects the markers with valid data at frame as IK targets.
  *
- * Sugihara, T., "Solvability-Unconcerned Inverse Kinematics by the
- * Levenberg–Marquardt Method," Robotics, IEEE Transactions on , vol.27, no.5,
- * pp.984,991, Oct. 2011 doi: 10.1109/TRO.2011.2148230
+ * residual_index gets the index of every plan marker in the targets or -1
+ * if it is not used. frame_positions receives all positions of the frame.
+ * The vectors keep their capacity so this does not allocate once the first
+ * frame is set up.
  */
-bool SugiharaIK (
-		RigidBodyDynamics::Model &model,
-		const rbdlVectorNd &Qinit,
-		const std::vector<unsigned int>& body_id,
-		const std::vector<rbdlVector3d>& body_point,
-		const std::vector<rbdlVector3d>& target_pos,
-		rbdlVectorNd &Qres,
-		double step_tol,
-		unsigned int max_iter,
-		unsigned int *steps,
-		VectorNd *residuals
+static void gather_frame_targets (
+		const FitPlan &plan,
+		int frame,
+		std::vector<float> &frame_positions,
+		std::vector<unsigned int> &body_ids,
+		std::vector<rbdlVector3d> &body_points,
+		std::vector<rbdlVector3d> &target_pos,
+		std::vector<int> &residual_index
 		) {
+	body_ids.clear();
+	body_points.clear();
+	target_pos.clear();
+	residual_index.resize (plan.markerNames.size());
 
-	assert (Qinit.size() == model.q_size);
-	assert (body_id.size() == body_point.size());
-	assert (body_id.size() == target_pos.size());
-
-	rbdlMatrixNd J = rbdlMatrixNd::Zero(3 * body_id.size(), model.qdot_size);
-	rbdlVectorNd e = rbdlVectorNd::Zero(3 * body_id.size());
+	int target_count = 0;
+	plan.readFrame (frame, frame_positions);
 
-	Qres = Qinit;
+	for (size_t mi = 0; mi < plan.markerNames.size(); mi++) {
+		rbdlVector3d position = plan.markerPosition (frame_positions, mi);
 
-	unsigned int ik_iter;
-
-	for (ik_iter = 0; ik_iter < max_iter; ik_iter++) {
-		UpdateKinematicsCustom (model, &Qres, NULL, NULL);
+		if (!FitPlan::positionValid (position)) {
+			cerr << "Warning: invalid marker data for marker '" << plan.markerNames[mi] << "' at frame " << frame << ". Not fitting to this marker." << endl;
+			residual_index[mi] = -1;
+			continue;
+		}
 
-		for (unsigned int k = 0; k < body_id.size(); k++) {
-			rbdlMatrixNd G (rbdlMatrixNd::Zero(3, model.qdot_size));
-			CalcPointJacobian (model, Qres, body_id[k], body_point[k], G, false);
-			rbdlVector3d point_base = CalcBodyToBaseCoordinates (model, Qres, body_id[k], body_point[k], false);
+		residual_index[mi] = target_count;
+		target_count++;
 
-			for (unsigned int i = 0; i < 3; i++) {
-				for (unsigned int j = 0; j < model.qdot_size; j++) {
-					unsigned int row = k * 3 + i;
-					J(row, j) = G (i,j);
-				}
+		body_ids.push_back (plan.bodyIds[mi]);
+		body_points.push_back (plan.bodyPoints[mi]);
+		target_pos.push_back (position);
+	}
+}
 
-				e[k * 3 + i] = target_pos[k][i] - point_base[i];
-			}
+/** Interpolates the model state between start (t = 0) and end (t = 1).
+ *
+ * All values are interpolated linearly except for the quaternions of
+ * spherical joints, which are interpolated with slerp along the shorter
+ * arc so that the result stays a unit quaternion.
+ */
+static void interpolate_state (const RigidBodyDynamics::Model &rbdl_model, const VectorNd &start, const VectorNd &end, double t, VectorNd &result) {
+	result = start + t * (end - start);
+
+	for (unsigned int j = 1; j < rbdl_model.mJoints.size(); j++) {
+		if (rbdl_model.mJoints[j].mJointType != RigidBodyDynamics::JointTypeSpherical)
+			continue;
+
+		unsigned int index[4] = {
+			rbdl_model.mJoints[j].q_index,
+			rbdl_model.mJoints[j].q_index + 1,
+			rbdl_model.mJoints[j].q_index + 2,
+			rbdl_model.multdof3_w_index[j]
+		};
+
+		double cos_angle = 0.;
+		for (unsigned int k = 0; k < 4; k++)
+			cos_angle += start[index[k]] * end[index[k]];
+
+		// q and -q are the same rotation
+		double end_sign = 1.;
+		if (cos_angle < 0.) {
+			end_sign = -1.;
+			cos_angle = -cos_angle;
 		}
 
-		double wn = 1.0e-3;
-		double Ek = 0.;
-
-		for (size_t ei = 0; ei < e.size(); ei ++) {
-			Ek += e[ei] * e[ei] * 0.5;
+		double start_weight = 1. - t;
+		double end_weight = t;
+		if (cos_angle < 1. - 1.0e-6) {
+			double angle = acos (cos_angle);
+			start_weight = sin ((1. - t) * angle) / sin (angle);
+			end_weight = sin (t * angle) / sin (angle);
 		}
 
-		rbdlVectorNd ek = J.transpose() * e;
-		rbdlMatrixNd Wn = rbdlMatrixNd::Zero (Qres.size(), Qres.size());
-
-		assert (ek.size() == Qres.size());
-
-		for (size_t wi = 0; wi < Qres.size(); wi++) {
-//			Wn(wi, wi) = ek[wi] * ek[wi] * 0.5 + 1.0e-3;
-			Wn(wi, wi) = Ek + 1.0e-3;
+		double norm = 0.;
+		for (unsigned int k = 0; k < 4; k++) {
+			result[index[k]] = start_weight * start[index[k]] + end_sign * end_weight * end[index[k]];
+			norm += result[index[k]] * result[index[k]];
 		}
 
-		rbdlMatrixNd A = J.transpose() * J + Wn;
-		rbdlVectorNd delta_theta = A.colPivHouseholderQr().solve(J.transpose() * e);
-		Qres = Qres + delta_theta;
+		norm = sqrt (norm);
+		for (unsigned int k = 0; k < 4; k++)
+			result[index[k]] /= norm;
+	}
+}
 
-		if (delta_theta.norm() < step_tol) {
-			*residuals = ConvertVector<VectorNd, rbdlVectorNd> (e);
-			*steps = ik_iter;
+/** Opens the log for a fit starting at frame_start. Fits that continue
+ * the previous frames keep writing to the already opened log. */
+static void open_log (FittingLog &log, const string &filename, FittingLog::Format format, const vector<string> &marker_names, bool restart) {
+	if (!restart
+			&& log.isOpen()
+			&& log.filename == filename
+			&& log.format == format
+			&& log.markerCount == marker_names.size())
+		return;
+
+	log.open (filename, marker_names, format, !restart);
+}
 
-			return true;
+template <typename VectorType>
+void compute_log_row (vector<double> &row, const vector<int> &residual_index, const VectorType &residuals) {
+	row.resize (residual_index.size());
+
+	for (size_t mi = 0; mi < residual_index.size(); mi++) {
+		int ri = residual_index[mi];
+		if (ri == -1) {
+			row[mi] = 0.;
+		} else {
+			Vector3d marker_res (residuals[ri * 3], residuals[ri * 3 + 1], residuals[ri * 3 + 2]); 
+			row[mi] = marker_res.norm();
 		}
 	}
+}
 
-	*residuals = ConvertVector<VectorNd, rbdlVectorNd> (e);
-	*steps = ik_iter;
+struct ModelFitter::ModelFitterInternal {
+	rbdlVectorNd Qinit;
+	rbdlVectorNd Qres;
+	FitPlan plan;
+	/// Index of each plan marker in the residuals or -1 if the marker is
+	/// not used in the current frame
+	std::vector<int> marker_residual_index;
+	std::vector<unsigned int> body_ids;
+	std::vector<rbdlVector3d> body_points;
+	std::vector<rbdlVector3d> target_pos;
+	/// Positions of all markers of the frame that is set up
+	std::vector<float> frame_positions;
+	IKWorkspace workspace;
+	/// Timings that workspace adds to if profiling is enabled
+	IKProfile profile;
+	bool profiling;
+	/// Profile, time and iteration index at the start of the frame that
+	/// is measured for the telemetry
+	IKProfile frameProfile;
+	double frameStart;
+	unsigned long frameIteration;
+	/// Plan and fingerprint of the animation computed by refitAnimation()
+	FitPlan fittedPlan;
+	uint64_t fittedAnimation;
+	FittingLog log;
+	/// Collects the log rows by frame while refitAnimation() runs
+	std::map<int, FittingLogRow> *refitRows;
+	std::vector<double> log_row;
+	/// Log row of the keyframe that was fitted ahead in multi-rate mode
+	std::vector<double> key_log_row;
+	/// Frame that setup() fits or -1 to use the current frame of the data
+	int frame;
+	/// Whether frameCallback cancelled the last fit
+	bool canceled;
+
+	ModelFitterInternal() :
+		fittedAnimation (0),
+		profiling (false),
+		frameStart (0.),
+		frameIteration (0),
+		refitRows (NULL),
+		frame (-1),
+		canceled (false)
+	{}
+};
 
-	return false;
+ModelFitter::ModelFitter() :
+	logFilename ("fitting_log.csv"),
+	logFormat (FittingLog::FormatCSV),
+	keyframeStride (1),
+	refineSteps (5),
+	interpolationTolerance (0.),
+	totalSteps (0),
+	totalFrameCount (0) {
+	internal = new ModelFitterInternal();
 }
 
-bool SugiharaTaskSpaceIK (
-		RigidBodyDynamics::Model &model,
-		const rbdlVectorNd &Qinit,
-		const std::vector<unsigned int>& body_id,
-		const std::vector<rbdlVector3d>& body_point,
-		const std::vector<rbdlVector3d>& target_pos,
-		rbdlVectorNd &Qres,
-		double step_tol,
-		unsigned int max_iter,
-		unsigned int *steps,
-		VectorNd *residuals
-		) {
+ModelFitter::ModelFitter (Model *model, MarkerData *data, unsigned int maxSteps) :
+		model (model),
+		data (data),
+		tolerance (1.0e-8),
+		success (false),
+		steps (0),
+		maxSteps (maxSteps),
+		logFilename ("fitting_log.csv"),
+		logFormat (FittingLog::FormatCSV),
+		keyframeStride (1),
+		refineSteps (5),
+		interpolationTolerance (0.),
+		totalSteps (0),
+		totalFrameCount (0)
+	{
+		internal = new ModelFitterInternal();
+	}
 
-	assert (Qinit.size() == model.q_size);
-	assert (body_id.size() == body_point.size());
-	assert (body_id.size() == target_pos.size());
+ModelFitter::~ModelFitter() {
+	delete internal;
+}
 
-	rbdlMatrixNd J = rbdlMatrixNd::Zero(3 * body_id.size(), model.qdot_size);
-	rbdlVectorNd e = rbdlVectorNd::Zero(3 * body_id.size());
+double vec_average (const VectorNd &vec) {
+	double sum = 0.;
+	for (size_t i = 0; i < vec.size(); i++) 
+		sum += vec[i];
 
-	Qres = Qinit;
+	return sum / vec.size();
+}
 
-	unsigned int ik_iter;
+double vec_standard_deviation (const VectorNd &vec) {
+	double average = vec_average (vec);
+	double diff_sum = 0.;
+	for (size_t i = 0; i < vec.size(); i++) {
+		diff_sum += (vec[i] - average) * (vec[i] - average);
+	}
 
-	for (ik_iter = 0; ik_iter < max_iter; ik_iter++) {
-		UpdateKinematicsCustom (model, &Qres, NULL, NULL);
+	return sqrt (diff_sum / vec.size());
+}
 
-		for (unsigned int k = 0; k < body_id.size(); k++) {
-			rbdlMatrixNd G (rbdlMatrixNd::Zero(3, model.qdot_size));
-			CalcPointJacobian (model, Qres, body_id[k], body_point[k], G, false);
-			rbdlVector3d point_base = CalcBodyToBaseCoordinates (model, Qres, body_id[k], body_point[k], false);
+/// The telemetry needs the profile for its timings
+static void update_workspace_profile (ModelFitter &fitter) {
+	ModelFitter::ModelFitterInternal &internal = *fitter.internal;
+	bool enabled = internal.profiling || fitter.telemetry.isEnabled();
 
-			for (unsigned int i = 0; i < 3; i++) {
-				for (unsigned int j = 0; j < model.qdot_size; j++) {
-					unsigned int row = k * 3 + i;
-					J(row, j) = G (i,j);
-				}
+	internal.workspace.profile = enabled ? &internal.profile : NULL;
+	internal.workspace.telemetry = fitter.telemetry.isEnabled() ? &fitter.telemetry : NULL;
+}
 
-				e[k * 3 + i] = target_pos[k][i] - point_base[i];
-			}
-		}
+void ModelFitter::setProfiling (bool enabled) {
+	internal->profiling = enabled;
+	update_workspace_profile (*this);
+}
 
-		// abort if we are getting "close"
-		if (e.norm() < step_tol) {
-			*residuals = ConvertVector<VectorNd, rbdlVectorNd> (e);
-			*steps = ik_iter;
+IKProfile& ModelFitter::getProfile() {
+	return internal->profile;
+}
 
-			return true;
-		}
+void ModelFitter::enableTelemetry (unsigned int frame_capacity, unsigned int iteration_capacity) {
+	telemetry.reserve (frame_capacity, iteration_capacity);
+	update_workspace_profile (*this);
+}
 
-		double wn = 1.0e-3;
-		rbdlMatrixNd Ek = rbdlMatrixNd::Zero (e.size(), e.size());
-	
-		for (size_t ei = 0; ei < e.size(); ei ++) {
-			Ek(ei,ei) = e[ei] * e[ei] * 0.5 + wn;
-		}
+void ModelFitter::setSinglePrecision (bool enabled) {
+	internal->workspace.precision = enabled ? IKPrecisionFloat : IKPrecisionDouble;
+	internal->workspace.updateNormalSolver();
+}
 
-		rbdlMatrixNd JJT_Ek_wnI = J * J.transpose() + Ek;
+static void begin_frame_telemetry (ModelFitter::ModelFitterInternal &internal, const FitTelemetry &telemetry) {
+	if (!telemetry.isEnabled())
+		return;
 
-		rbdlVectorNd delta_theta = J.transpose() * JJT_Ek_wnI.colPivHouseholderQr().solve (e);
+	internal.frameProfile = internal.profile;
+	internal.frameStart = IKProfileClock (internal.workspace);
+	internal.frameIteration = telemetry.getIterationIndex();
+}
 
-		Qres = Qres + delta_theta;
-		if (delta_theta.norm() < step_tol) {
-			*residuals = ConvertVector<VectorNd, rbdlVectorNd> (e);
-			*steps = ik_iter;
+/** Fills in the timings and iterations since begin_frame_telemetry().
+ * They are split evenly between share frames that were fitted together.
+ */
+static void measure_frame_telemetry (ModelFitter::ModelFitterInternal &internal, const FitTelemetry &telemetry, unsigned int share, FrameTelemetry &result) {
+	const IKProfile &profile = internal.profile;
+	double scale = 1. / static_cast<double>(share);
+
+	result.totalTime = (IKProfileClock (internal.workspace) - internal.frameStart) * scale;
+	result.kinematicsTime = (profile.kinematicsTime - internal.frameProfile.kinematicsTime) * scale;
+	result.jacobianTime = (profile.jacobianTime - internal.frameProfile.jacobianTime) * scale;
+	result.solveTime = (profile.solveTime - internal.frameProfile.solveTime) * scale;
+	result.firstIteration = internal.frameIteration;
+	result.iterationCount = telemetry.getIterationIndex() - internal.frameIteration;
+}
 
-			return true;
-		}
-	}
+static void end_frame_telemetry (ModelFitter &fitter, int frame, bool success) {
+	if (!fitter.telemetry.isEnabled())
+		return;
 
-	*residuals = ConvertVector<VectorNd, rbdlVectorNd> (e);
-	*steps = ik_iter;
+	FrameTelemetry frame_telemetry;
+	measure_frame_telemetry (*fitter.internal, fitter.telemetry, 1, frame_telemetry);
+	frame_telemetry.frame = frame;
+	frame_telemetry.steps = fitter.steps;
+	frame_telemetry.success = success;
+	frame_telemetry.residualNorm = fitter.residuals.norm();
 
-	return false;
+	fitter.telemetry.addFrame (frame_telemetry);
 }
 
-double vec_average (const VectorNd &vec) {
-	double sum = 0.;
-	for (size_t i = 0; i < vec.size(); i++) 
-		sum += vec[i];
+/** Opens the log for the fit of the frames from frame_start on. Nothing
+ * is written while refitAnimation() collects the rows. */
+static void open_fit_log (ModelFitter &fitter, bool restart) {
+	ModelFitter::ModelFitterInternal &internal = *fitter.internal;
+	if (internal.refitRows)
+		return;
 
-	return sum / vec.size();
+	open_log (internal.log, fitter.logFilename, fitter.logFormat, internal.plan.markerNames, restart);
 }
 
-double vec_standard_deviation (const VectorNd &vec) {
-	double average = vec_average (vec);
-	double diff_sum = 0.;
-	for (size_t i = 0; i < vec.size(); i++) {
-		diff_sum += (vec[i] - average) * (vec[i] - average);
+/// Logs internal.log_row for the frame (counted from the first frame)
+static void add_fit_log_row (ModelFitter::ModelFitterInternal &internal, int frame, unsigned int steps) {
+	if (!internal.refitRows) {
+		internal.log.addRow (frame, steps, internal.log_row);
+		return;
 	}
 
-	return sqrt (diff_sum / vec.size());
+	FittingLogRow &row = (*internal.refitRows)[frame];
+	row.frame = frame;
+	row.steps = steps;
+	row.residuals = internal.log_row;
 }
 
-void ModelFitter::setup() {
-	fittedState = initialState;
-	success = false;
-
-	internal->Qinit = ConvertVector<rbdlVectorNd, VectorNd> (initialState);
-	internal->Qres = ConvertVector<rbdlVectorNd, VectorNd> (initialState);
-	residuals = VectorNd::Zero (initialState.size());
+/** Rewrites the log of the previous fit, whose frames were counted from
+ * old_first_frame, with the rows of the refitted frames replaced.
+ *
+ * The columns of the previous log are matched by the marker names. Markers
+ * that were not in the previous log have no valid data in the frames that
+ * were not refitted and get a residual of 0 there.
+ */
+static void merge_refit_log (ModelFitter &fitter, int old_first_frame, const std::map<int, FittingLogRow> &refit_rows) {
+	ModelFitter::ModelFitterInternal &internal = *fitter.internal;
+	const FitPlan &plan = internal.plan;
 
-	internal->body_ids.clear();
-	internal->body_points.clear();
-	internal->target_pos.clear();
-	internal->marker_residual_index.clear();
-	internal->marker_names.clear();
+	internal.log.close();
 
-	int frame_count = model->getFrameCount();
-	int residual_index = 0;
+	std::vector<std::string> old_marker_names;
+	std::vector<FittingLogRow> old_rows;
+	std::map<int, FittingLogRow> rows (refit_rows);
 
-	for (int frame_id = 1; frame_id <= frame_count; frame_id++) {
-		unsigned int body_id = model->frameIdToRbdlId[frame_id];
-		vector<Vector3f> marker_coords = model->getFrameMarkerCoords(frame_id);
-		vector<string> marker_names = model->getFrameMarkerNames(frame_id);
+	if (FittingLog::load (fitter.logFilename, old_marker_names, old_rows)) {
+		std::map<std::string, int> old_column;
+		for (size_t oi = 0; oi < old_marker_names.size(); oi++) {
+			old_column[old_marker_names[oi]] = oi;
+		}
 
-		assert (marker_coords.size() == marker_names.size());
+		std::vector<int> column (plan.markerNames.size(), -1);
+		for (size_t mi = 0; mi < plan.markerNames.size(); mi++) {
+			std::map<std::string, int>::iterator iter = old_column.find (plan.markerNames[mi]);
+			if (iter != old_column.end())
+				column[mi] = iter->second;
+		}
 
-		for (size_t marker_idx = 0; marker_idx < marker_coords.size(); marker_idx++) {
-			if (!data->markerExists(marker_names[marker_idx].c_str())) {
-				cerr << "Warning: Model marker'" << marker_names[marker_idx] << "' not present in c3d data. Ignoring marker during fit!" << endl;
+		for (size_t ri = 0; ri < old_rows.size(); ri++) {
+			int frame = old_rows[ri].frame + old_first_frame - plan.firstFrame;
+			if (frame < 0 || frame >= plan.frameCount || rows.find (frame) != rows.end())
 				continue;
-			}
-			rbdlVector3d marker_data_pos = ConvertVector<rbdlVector3d, Vector3d> (data->getMarkerCurrentPosition (marker_names[marker_idx].c_str()));
-			internal->marker_names.push_back(marker_names[marker_idx]);
 
-			if (marker_data_pos == rbdlVector3d (0., 0., 0.) || marker_data_pos.squaredNorm() > 1.0e2) {
-				cerr << "Warning: invalid marker data for marker '" << marker_names[marker_idx] << "' at frame " << data->currentFrame << ". Not fitting to this marker." << endl;
-				internal->marker_residual_index[marker_names[marker_idx]] = -1;
-				continue;
+			FittingLogRow &row = rows[frame];
+			row.frame = frame;
+			row.steps = old_rows[ri].steps;
+			row.residuals.assign (plan.markerNames.size(), 0.);
+			for (size_t mi = 0; mi < column.size(); mi++) {
+				if (column[mi] != -1 && static_cast<size_t>(column[mi]) < old_rows[ri].residuals.size())
+					row.residuals[mi] = old_rows[ri].residuals[column[mi]];
 			}
+		}
+	} else {
+		cerr << "Warning: could not read the fitting log '" << fitter.logFilename << "'. Only the refitted frames are logged." << endl;
+	}
 
-			internal->marker_residual_index[marker_names[marker_idx]] = residual_index;
-			residual_index++;
-
-			internal->body_ids.push_back (body_id);
-			internal->body_points.push_back (ConvertVector<rbdlVector3d, Vector3d> (marker_coords[marker_idx]));
+	if (!internal.log.open (fitter.logFilename, plan.markerNames, fitter.logFormat))
+		return;
 
-			internal->target_pos.push_back (marker_data_pos);
-		}
+	for (std::map<int, FittingLogRow>::iterator iter = rows.begin(); iter != rows.end(); iter++) {
+		internal.log.addRow (iter->first, iter->second.steps, iter->second.residuals);
 	}
 }
 
+void ModelFitter::prepare() {
+	if (!internal->plan.isValidFor (model, data))
+		internal->plan.compile (model, data);
+}
+
+void ModelFitter::setup() {
+	fittedState = initialState;
+	success = false;
+
+	CopyVector (initialState, internal->Qinit);
+	CopyVector (initialState, internal->Qres);
+
+	prepare();
+
+	int frame = internal->frame == -1 ? data->currentFrame : internal->frame;
+	gather_frame_targets (internal->plan, frame, internal->frame_positions, internal->body_ids, internal->body_points, internal->target_pos, internal->marker_residual_index);
+}
+
 bool ModelFitter::computeModelAnimationFromMarkers (const VectorNd &_initialState, Animation *animation, int frame_start, int frame_end) {
 	assert (model);
 	assert (data);
 	assert (animation);
 
-	int old_current_frame = data->currentFrame;
-
 	double current_time = 0.;
 	double frame_rate = static_cast<double>(data->getFrameRate());
 	int frame_first = data->getFirstFrame();
@@ -395,60 +665,255 @@ bool ModelFitter::computeModelAnimationFromMarkers (const VectorNd &_initialStat
 	if (frame_end == -1 || frame_end > frame_last)
 		frame_end = frame_last;
 
-	ofstream iklog;
-	if (frame_start == frame_first) {
-		iklog.open("fitting_log.csv");
-		setup();
-	
-		iklog << "frame, steps, ";
-		for (size_t i = 0; i < internal->marker_names.size(); i++) {
-			iklog << internal->marker_names[i];
-			if (i != internal->marker_names.size() - 1)
-				iklog << ", ";
-		}
-		iklog << endl;
-	}	else {
-		iklog.open("fitting_log.csv", ios::app);
-	}
+	animation->reserve (std::max (frame_end - frame_start + 1, 0));
+
+	prepare();
+
+	open_fit_log (*this, frame_start == frame_first);
+	internal->canceled = false;
 
 	VectorNd current_state = _initialState;
 
+	// In multi-rate mode the next keyframe gets fitted ahead of the frames
+	// in between, which are initialized by interpolation.
+	unsigned int stride = std::max (keyframeStride, 1u);
+	int key_frame = frame_start;
+	VectorNd key_state = current_state;
+	int next_key_frame = -1;
+	VectorNd next_key_state;
+	unsigned int next_key_steps = 0;
+	bool next_key_success = true;
+	vector<double> &next_key_log_row = internal->key_log_row;
+	VectorNd interpolated_state;
+
 	for (int i = frame_start; i <= frame_end; i++) {
 		current_time = static_cast<double>(i - frame_first) / static_cast<double>(frame_last - frame_first) * data_duration;
-		data->setCurrentFrameNumber (i);
 
-		if (!run (current_state)) {
+		bool frame_success = true;
+		bool is_key_frame = (i - frame_start) % stride == 0;
+
+		if (!is_key_frame && next_key_frame < i) {
+			next_key_frame = std::min (key_frame + static_cast<int>(stride), frame_end);
+
+			internal->frame = next_key_frame;
+			begin_frame_telemetry (*internal, telemetry);
+			next_key_success = run (key_state);
+			end_frame_telemetry (*this, next_key_frame, next_key_success);
+			next_key_state = getFittedState();
+			next_key_steps = steps;
+			compute_log_row (next_key_log_row, internal->marker_residual_index, residuals);
+		}
+
+		// fit frame i without touching the marker data which may be shown
+		// by a different thread
+		internal->frame = i;
+
+		if (i == next_key_frame) {
+			current_state = next_key_state;
+			steps = next_key_steps;
+			frame_success = next_key_success;
+			internal->log_row.swap (next_key_log_row);
+		} else if (is_key_frame) {
+			begin_frame_telemetry (*internal, telemetry);
+			frame_success = run (predictor.predict (i, current_state));
+			end_frame_telemetry (*this, i, frame_success);
+			current_state = getFittedState();
+			compute_log_row (internal->log_row, internal->marker_residual_index, residuals);
+		} else {
+			double t = static_cast<double>(i - key_frame) / static_cast<double>(next_key_frame - key_frame);
+			begin_frame_telemetry (*internal, telemetry);
+			interpolate_state (*(model->rbdlModel), key_state, next_key_state, t, interpolated_state);
+			refineInterpolatedState (interpolated_state);
+			end_frame_telemetry (*this, i, true);
+			current_state = getFittedState();
+			compute_log_row (internal->log_row, internal->marker_residual_index, residuals);
+		}
+
+		if (!frame_success) {
 			result = false;
 			cerr << "Warning: could not fit frame " << i << endl;
 		}
 
-		iklog << i - frame_first << ", ";
-		iklog << steps << ", ";
+		if (is_key_frame || i == next_key_frame) {
+			key_frame = i;
+			key_state = current_state;
+		}
 
-		for (size_t mi = 0; mi < internal->marker_names.size(); mi++) {
-			int ri = internal->marker_residual_index[internal->marker_names[mi]];
-			if (ri == -1) {
-				iklog << 0.;
-			} else {
-				Vector3d marker_res (residuals[ri * 3], residuals[ri * 3 + 1], residuals[ri * 3 + 2]); 
-				iklog << marker_res.norm();
-			}
+		add_fit_log_row (*internal, i - frame_first, steps);
 
-			if (mi != internal->marker_names.size() - 1)
-				iklog << ", ";
-		}
-		iklog << endl;
+		predictor.addState (i, current_state);
+		totalSteps += steps;
+		totalFrameCount++;
 
-		current_state = getFittedState();
 		animation->addPose (current_time, current_state);
+
+		if (frameCallback && !frameCallback (i, current_time, current_state)) {
+			internal->canceled = true;
+			result = false;
+			break;
+		}
 	}
-	iklog.close();
 
-	data->currentFrame = old_current_frame;
+	internal->frame = -1;
 
 	return result;
 }
 
+bool ModelFitter::refineInterpolatedState (const VectorNd &state) {
+	if (interpolationTolerance > 0.) {
+		initialState = state;
+		setup();
+
+		RigidBodyDynamics::Model &rbdl_model = *(model->rbdlModel);
+		UpdateKinematicsCustom (rbdl_model, &internal->Qinit, NULL, NULL);
+
+		residuals.resize (internal->target_pos.size() * 3);
+		double max_residual = 0.;
+		for (size_t ti = 0; ti < internal->target_pos.size(); ti++) {
+			rbdlVector3d residual = internal->target_pos[ti] - CalcBodyToBaseCoordinates (rbdl_model, internal->Qinit, internal->body_ids[ti], internal->body_points[ti], false);
+			residuals[ti * 3] = residual[0];
+			residuals[ti * 3 + 1] = residual[1];
+			residuals[ti * 3 + 2] = residual[2];
+			max_residual = std::max (max_residual, residual.norm());
+		}
+
+		if (max_residual < interpolationTolerance) {
+			fittedState = state;
+			steps = 0;
+			success = true;
+			return true;
+		}
+	}
+
+	unsigned int max_steps = maxSteps;
+	maxSteps = std::min (refineSteps, maxSteps);
+	run (state);
+	maxSteps = max_steps;
+
+	// intermediate frames are not required to converge
+	return true;
+}
+
+bool ModelFitter::refitAnimation (const VectorNd &_initialState, Animation *animation, unsigned int convergence_frames, double convergence_tolerance) {
+	assert (model);
+	assert (data);
+	assert (animation);
+
+	prepare();
+
+	FitPlan &plan = internal->plan;
+	plan.computeFrameFingerprints();
+
+	const FitPlan &fitted_plan = internal->fittedPlan;
+	int frame_first = plan.firstFrame;
+	std::vector<char> changed;
+
+	// only the animation that we produced can be updated
+	if (animation_fingerprint (*animation) != internal->fittedAnimation
+			|| !plan.findChangedFrames (fitted_plan, changed)) {
+		animation->keyFrames.clear();
+		bool result = computeModelAnimationFromMarkers (_initialState, animation);
+		if (internal->canceled) {
+			invalidateFit();
+		} else {
+			internal->fittedPlan = plan;
+			internal->fittedAnimation = animation_fingerprint (*animation);
+		}
+		return result;
+	}
+
+	// renumber the poses if the frame range changed, frames that did not
+	// exist before start from initialState
+	if (plan.firstFrame != fitted_plan.firstFrame || plan.frameCount != fitted_plan.frameCount) {
+		double frame_rate = static_cast<double>(data->getFrameRate());
+		int frame_last = frame_first + plan.frameCount - 1;
+		double data_duration = static_cast<double>(frame_last - frame_first) / frame_rate;
+
+		std::vector<AnimationKeyFrame> key_frames;
+		key_frames.reserve (plan.frameCount);
+		for (int fi = 0; fi < plan.frameCount; fi++) {
+			int old_fi = frame_first + fi - fitted_plan.firstFrame;
+			double time = static_cast<double>(fi) / static_cast<double>(frame_last - frame_first) * data_duration;
+			if (old_fi >= 0 && old_fi < fitted_plan.frameCount)
+				key_frames.push_back (AnimationKeyFrame (time, animation->keyFrames[old_fi].state));
+			else
+				key_frames.push_back (AnimationKeyFrame (time, _initialState));
+		}
+		animation->keyFrames.swap (key_frames);
+	}
+
+	bool result = true;
+	Animation range_animation;
+	int fi = 0;
+
+	// the ranges are logged by frame and merged into the previous log
+	std::map<int, FittingLogRow> refit_rows;
+	internal->refitRows = &refit_rows;
+
+	while (fi < plan.frameCount && !internal->canceled) {
+		if (!changed[fi]) {
+			fi++;
+			continue;
+		}
+
+		int range_start = fi;
+		while (fi < plan.frameCount && changed[fi])
+			fi++;
+
+		// start from the unchanged pose before the range
+		VectorNd current_state = animation->keyFrames[std::max (range_start - 1, 0)].state;
+
+		range_animation.keyFrames.clear();
+		if (!computeModelAnimationFromMarkers (current_state, &range_animation, frame_first + range_start, frame_first + fi - 1))
+			result = false;
+
+		for (size_t ki = 0; ki < range_animation.keyFrames.size(); ki++) {
+			animation->keyFrames[range_start + ki].state = range_animation.keyFrames[ki].state;
+		}
+
+		if (internal->canceled)
+			break;
+
+		current_state = range_animation.keyFrames.back().state;
+
+		// fit the following frames until we are back at the previous fit
+		for (unsigned int ci = 0; ci < convergence_frames && fi < plan.frameCount; ci++) {
+			range_animation.keyFrames.clear();
+			if (!computeModelAnimationFromMarkers (current_state, &range_animation, frame_first + fi, frame_first + fi))
+				result = false;
+
+			if (internal->canceled)
+				break;
+
+			current_state = range_animation.keyFrames[0].state;
+			bool converged = (animation->keyFrames[fi].state - current_state).norm() < convergence_tolerance;
+			animation->keyFrames[fi].state = current_state;
+			fi++;
+
+			if (converged)
+				break;
+		}
+	}
+
+	internal->refitRows = NULL;
+	merge_refit_log (*this, fitted_plan.firstFrame, refit_rows);
+
+	if (internal->canceled) {
+		invalidateFit();
+		return false;
+	}
+
+	internal->fittedPlan = plan;
+	internal->fittedAnimation = animation_fingerprint (*animation);
+
+	return result;
+}
+
+void ModelFitter::invalidateFit() {
+	internal->fittedPlan = FitPlan();
+	internal->fittedAnimation = 0;
+}
+
 void ModelFitter::analyzeAnimation (Animation animation) {
 	assert (model);
 	assert (data);
@@ -460,49 +925,42 @@ void ModelFitter::analyzeAnimation (Animation animation) {
 
 	assert (data_duration == animation.getDuration());
 
-	ofstream iklog;
+	prepare();
+	FitPlan &plan = internal->plan;
 
-	iklog.open("fitting_log.csv");
-	setup();
+	FittingLog &log = internal->log;
+	open_log (log, logFilename, logFormat, plan.markerNames, true);
 
-	iklog << "frame, steps, ";
-	for (size_t i = 0; i < internal->marker_names.size(); i++) {
-		iklog << internal->marker_names[i];
-		if (i != internal->marker_names.size() - 1)
-			iklog << ", ";
-	}
-	iklog << endl;
+	vector<double> &row = internal->log_row;
+	row.resize (plan.markerNames.size());
 
 	for (int i = frame_first; i <= frame_last; i++) {
 		double current_time = static_cast<double>(i - frame_first) / static_cast<double>(frame_last - frame_first) * data_duration;
-		data->setCurrentFrameNumber (i);
 		animation.setCurrentTime (current_time);
 		rbdlVectorNd q = ConvertVector<rbdlVectorNd, VectorNd>(animation.getCurrentPose());
 
-		iklog << i - frame_first << ", ";
-		iklog << 0 << ", ";
-		
-		setup();
-
 		UpdateKinematicsCustom (*(model->rbdlModel), &q, NULL, NULL);
+		plan.readFrame (i, internal->frame_positions);
+
+		for (size_t mi = 0; mi < plan.markerNames.size(); mi++) {
+			rbdlVector3d data_marker = plan.markerPosition (internal->frame_positions, mi);
 
-		for (size_t mi = 0; mi < internal->marker_names.size(); mi++) {
-			string marker_name = internal->marker_names[mi];
-			int ri = internal->marker_residual_index[internal->marker_names[mi]];
-			if (ri == -1) {
-				iklog << 0.;
+			if (!FitPlan::positionValid (data_marker)) {
+				row[mi] = 0.;
 			} else {
-				rbdlVector3d data_marker = internal->target_pos[mi];
-				rbdlVector3d model_marker = CalcBodyToBaseCoordinates (*(model->rbdlModel), q, internal->body_ids[mi], internal->body_points[mi], false);
-				iklog << (data_marker - model_marker).norm();
+				rbdlVector3d model_marker = CalcBodyToBaseCoordinates (*(model->rbdlModel), q, plan.bodyIds[mi], plan.bodyPoints[mi], false);
+				row[mi] = (data_marker - model_marker).norm();
 			}
-
-			if (mi != internal->marker_names.size() - 1)
-				iklog << ", ";
 		}
-		iklog << endl;
+
+		log.addRow (i - frame_first, 0, row);
 	}
-	iklog.close();
+
+	log.close();
+}
+
+void ModelFitter::closeLog() {
+	internal->log.close();
 }
 
 bool LevenbergMarquardtFitter::run (const VectorNd &_initialState) {
@@ -510,8 +968,9 @@ bool LevenbergMarquardtFitter::run (const VectorNd &_initialState) {
 
 	setup();
 
-	success = LevenbergMarquardtIK (*(model->rbdlModel), internal->Qinit, internal->body_ids, internal->body_points, internal->target_pos, internal->Qres, tolerance, lambda, maxSteps, &steps, &residuals);
+	success = LevenbergMarquardtIK (*(model->rbdlModel), internal->Qinit, internal->body_ids, internal->body_points, internal->target_pos, internal->Qres, tolerance, lambda, maxSteps, &steps, internal->workspace);
 	fittedState = ConvertVector<VectorNd, rbdlVectorNd> (internal->Qres);
+	residuals = ConvertVector<VectorNd, rbdlVectorNd> (internal->workspace.e);
 
 	return success;
 }
@@ -521,8 +980,9 @@ bool SugiharaFitter::run (const VectorNd &_initialState) {
 
 	setup();
 
-	success = SugiharaIK (*(model->rbdlModel), internal->Qinit, internal->body_ids, internal->body_points, internal->target_pos, internal->Qres, tolerance, maxSteps, &steps, &residuals);
+	success = SugiharaIK (*(model->rbdlModel), internal->Qinit, internal->body_ids, internal->body_points, internal->target_pos, internal->Qres, tolerance, maxSteps, &steps, internal->workspace);
 	fittedState = ConvertVector<VectorNd, rbdlVectorNd> (internal->Qres);
+	residuals = ConvertVector<VectorNd, rbdlVectorNd> (internal->workspace.e);
 
 	return success;
 }
@@ -532,8 +992,360 @@ bool SugiharaTaskSpaceFitter::run (const VectorNd &_initialState) {
 
 	setup();
 
-	success = SugiharaTaskSpaceIK (*(model->rbdlModel), internal->Qinit, internal->body_ids, internal->body_points, internal->target_pos, internal->Qres, tolerance, maxSteps, &steps, &residuals);
+	success = SugiharaTaskSpaceIK (*(model->rbdlModel), internal->Qinit, internal->body_ids, internal->body_points, internal->target_pos, internal->Qres, tolerance, maxSteps, &steps, internal->workspace);
+	fittedState = ConvertVector<VectorNd, rbdlVectorNd> (internal->Qres);
+	residuals = ConvertVector<VectorNd, rbdlVectorNd> (internal->workspace.e);
+
+	return success;
+}
+
+bool AdaptiveLevenbergMarquardtFitter::run (const VectorNd &_initialState) {
+	initialState = _initialState;
+
+	setup();
+
+	success = AdaptiveLevenbergMarquardtIK (*(model->rbdlModel), internal->Qinit, internal->body_ids, internal->body_points, internal->target_pos, internal->Qres, tolerance, damping, maxSteps, &steps, internal->workspace);
+	fittedState = ConvertVector<VectorNd, rbdlVectorNd> (internal->Qres);
+	residuals = ConvertVector<VectorNd, rbdlVectorNd> (internal->workspace.e);
+
+	return success;
+}
+
+ModelFitter* createModelFitter (const std::string &method, Model *model, MarkerData *data, unsigned int maxSteps) {
+	if (method == "sugihara")
+		return new SugiharaFitter (model, data, maxSteps);
+	else if (method == "sugiharats")
+		return new SugiharaTaskSpaceFitter (model, data, maxSteps);
+	else if (method == "levenberg")
+		return new LevenbergMarquardtFitter (model, data, maxSteps);
+	else if (method == "adaptive")
+		return new AdaptiveLevenbergMarquardtFitter (model, data, maxSteps);
+	else if (method == "window")
+		return new SlidingWindowFitter (model, data, maxSteps);
+
+	return NULL;
+}
+
+/** A frame of the window of SlidingWindowFitter together with the blocks
+ * of the normal equations that belong to it.
+ */
+struct WindowFrame {
+	int frame;
+	rbdlVectorNd q;
+	std::vector<unsigned int> body_ids;
+	std::vector<rbdlVector3d> body_points;
+	std::vector<rbdlVector3d> target_pos;
+	std::vector<int> residual_index;
+	/// Jacobian and residuals of the frame
+	IKWorkspace workspace;
+
+	/// Diagonal block after the forward elimination and its factorization
+	rbdlMatrixNd M;
+	Eigen::LLT<rbdlMatrixNd> llt;
+	rbdlVectorNd rhs;
+	rbdlVectorNd delta;
+};
+
+struct SlidingWindowFitter::SlidingWindowInternal {
+	SlidingWindowInternal() :
+		anchored (false),
+		anchorFrame (0),
+		profile (NULL),
+		telemetry (NULL)
+	{}
+	~SlidingWindowInternal() {
+		for (size_t i = 0; i < window.size(); i++)
+			delete window[i];
+		for (size_t i = 0; i < unused.size(); i++)
+			delete unused[i];
+	}
+
+	/// Frames of the current window in order
+	std::vector<WindowFrame*> window;
+	/// Frames that can be reused for the window
+	std::vector<WindowFrame*> unused;
+
+	/// Last state added to the animation that the window is tied to
+	bool anchored;
+	int anchorFrame;
+	rbdlVectorNd anchor;
+
+	rbdlMatrixNd inverse;
+	rbdlVectorNd temp;
+
+	/// Profile of the fitter or NULL. A solve is one step of the whole
+	/// window without its Jacobian evaluations.
+	IKProfile *profile;
+	/// Telemetry of the fitter or NULL. Every step of the window is
+	/// recorded as one iteration.
+	FitTelemetry *telemetry;
+
+	unsigned int solve (RigidBodyDynamics::Model &model, double smoothness, double lambda, double tolerance, unsigned int max_steps, bool *converged);
+};
+
+/** Performs damped Gauss-Newton steps on the window until the largest step
+ * is below tolerance and returns the number of steps.
+ */
+unsigned int SlidingWindowFitter::SlidingWindowInternal::solve (RigidBodyDynamics::Model &model, double smoothness, double lambda, double tolerance, unsigned int max_steps, bool *converged) {
+	unsigned int n = model.qdot_size;
+	unsigned int frame_count = window.size();
+	double w = smoothness;
+
+	inverse.resize (n, n);
+	temp.resize (n);
+
+	*converged = false;
+
+	for (unsigned int fi = 0; fi < frame_count; fi++)
+		window[fi]->workspace.profile = profile;
+
+	unsigned int step;
+	for (step = 0; step < max_steps; step++) {
+		double step_start = IKProfileClock (window[0]->workspace);
+		double step_jacobian_time = profile ? profile->jacobianTime : 0.;
+		double step_kinematics_time = profile ? profile->kinematicsTime : 0.;
+
+		// forward elimination
+		for (unsigned int fi = 0; fi < frame_count; fi++) {
+			WindowFrame &wf = *window[fi];
+			IKWorkspace &ws = wf.workspace;
+
+			ws.resize (n, wf.body_ids.size());
+			ComputeMarkerJacobian (model, wf.q, wf.body_ids, wf.body_points, wf.target_pos, ws);
+
+			unsigned int neighbour_count = 0;
+			wf.rhs.noalias() = ws.J.transpose() * ws.e;
+
+			if (fi > 0) {
+				wf.rhs -= w * (wf.q - window[fi - 1]->q);
+				neighbour_count++;
+			} else if (anchored) {
+				wf.rhs -= w * (wf.q - anchor);
+				neighbour_count++;
+			}
+
+			if (fi < frame_count - 1) {
+				wf.rhs -= w * (wf.q - window[fi + 1]->q);
+				neighbour_count++;
+			}
+
+			wf.M.noalias() = ws.J.transpose() * ws.J;
+			wf.M.diagonal().array() += lambda * lambda + w * neighbour_count;
+
+			if (fi > 0) {
+				WindowFrame &previous = *window[fi - 1];
+
+				// solve in place to avoid temporaries
+				inverse.setIdentity();
+				previous.llt.solveInPlace (inverse);
+				wf.M.noalias() -= (w * w) * inverse;
+
+				temp = previous.rhs;
+				previous.llt.solveInPlace (temp);
+				wf.rhs.noalias() += w * temp;
+			}
+
+			wf.llt.compute (wf.M);
+			if (wf.llt.info() != Eigen::Success) {
+				cerr << "Warning: could not factorize the window at frame " << wf.frame << endl;
+				return step;
+			}
+		}
+
+		// back substitution
+		double max_delta = 0.;
+		for (int fi = frame_count - 1; fi >= 0; fi--) {
+			WindowFrame &wf = *window[fi];
+
+			wf.delta = wf.rhs;
+			if (fi < static_cast<int>(frame_count) - 1)
+				wf.delta.noalias() += w * window[fi + 1]->delta;
+			wf.llt.solveInPlace (wf.delta);
+
+			max_delta = std::max (max_delta, wf.delta.norm());
+		}
+
+		for (unsigned int fi = 0; fi < frame_count; fi++) {
+			window[fi]->q += window[fi]->delta;
+		}
+
+		if (profile) {
+			profile->solveCount++;
+			profile->solveTime += IKProfileClock (window[0]->workspace) - step_start
+				- (profile->jacobianTime - step_jacobian_time)
+				- (profile->kinematicsTime - step_kinematics_time);
+		}
+
+		if (telemetry) {
+			double residual_squared_norm = 0.;
+			for (unsigned int fi = 0; fi < frame_count; fi++)
+				residual_squared_norm += window[fi]->workspace.e.squaredNorm();
+
+			telemetry->addIteration (sqrt (residual_squared_norm), max_delta);
+		}
+
+		if (max_delta < tolerance) {
+			*converged = true;
+			return step + 1;
+		}
+	}
+
+	return step;
+}
+
+SlidingWindowFitter::SlidingWindowFitter (Model *model, MarkerData *data, unsigned int maxSteps) :
+	ModelFitter (model, data, maxSteps),
+	windowSize (20),
+	windowStep (10),
+	smoothness (1.0e-3),
+	lambda (0.05) {
+	windowInternal = new SlidingWindowInternal();
+}
+
+SlidingWindowFitter::~SlidingWindowFitter() {
+	delete windowInternal;
+}
+
+bool SlidingWindowFitter::run (const VectorNd &_initialState) {
+	initialState = _initialState;
+
+	setup();
+
+	success = LevenbergMarquardtIK (*(model->rbdlModel), internal->Qinit, internal->body_ids, internal->body_points, internal->target_pos, internal->Qres, tolerance, lambda, maxSteps, &steps, internal->workspace);
 	fittedState = ConvertVector<VectorNd, rbdlVectorNd> (internal->Qres);
+	residuals = ConvertVector<VectorNd, rbdlVectorNd> (internal->workspace.e);
 
 	return success;
 }
+
+bool SlidingWindowFitter::computeModelAnimationFromMarkers (const VectorNd &_initialState, Animation *animation, int frame_start, int frame_end) {
+	assert (model);
+	assert (data);
+	assert (animation);
+	assert (windowSize > 0);
+	assert (windowStep > 0 && windowStep <= windowSize);
+
+	double frame_rate = static_cast<double>(data->getFrameRate());
+	int frame_first = data->getFirstFrame();
+	int frame_last = data->getLastFrame();
+	double data_duration = static_cast<double>(frame_last - frame_first) / frame_rate;
+	bool result = true;
+
+	if (frame_start == -1 || frame_start < frame_first)
+		frame_start = frame_first;
+	if (frame_end == -1 || frame_end > frame_last)
+		frame_end = frame_last;
+
+	animation->reserve (std::max (frame_end - frame_start + 1, 0));
+
+	prepare();
+	FitPlan &plan = internal->plan;
+
+	open_fit_log (*this, frame_start == frame_first);
+	internal->canceled = false;
+
+	RigidBodyDynamics::Model &rbdl_model = *(model->rbdlModel);
+	SlidingWindowInternal &wi = *windowInternal;
+	wi.profile = internal->workspace.profile;
+	wi.telemetry = internal->workspace.telemetry;
+
+	// continue the smoothing across calls for consecutive frames
+	wi.anchored = wi.anchored && frame_start == wi.anchorFrame + 1
+		&& ConvertVector<VectorNd, rbdlVectorNd> (wi.anchor) == _initialState;
+
+	rbdlVectorNd initial_state;
+	CopyVector (_initialState, initial_state);
+
+	int next_frame = frame_start;
+	bool canceled = false;
+
+	while (next_frame <= frame_end || wi.window.size() > 0) {
+		// fill the window with new frames
+		while (wi.window.size() < windowSize && next_frame <= frame_end) {
+			WindowFrame *wf = NULL;
+			if (wi.unused.size() > 0) {
+				wf = wi.unused.back();
+				wi.unused.pop_back();
+			} else {
+				wf = new WindowFrame();
+			}
+
+			wf->frame = next_frame;
+			wf->q = wi.window.size() > 0 ? wi.window.back()->q : initial_state;
+			gather_frame_targets (plan, next_frame, internal->frame_positions, wf->body_ids, wf->body_points, wf->target_pos, wf->residual_index);
+
+			wi.window.push_back (wf);
+			next_frame++;
+		}
+
+		bool converged = false;
+		begin_frame_telemetry (*internal, telemetry);
+		steps = wi.solve (rbdl_model, smoothness, lambda, tolerance, maxSteps, &converged);
+		// every solve counts once, regardless of how many frames it commits
+		totalSteps += steps;
+
+		// add the first frames of the window (or all if we are done)
+		unsigned int commit_count = wi.window.size();
+		if (next_frame <= frame_end)
+			commit_count = windowStep;
+
+		// the committed frames share the time and iterations of the window
+		FrameTelemetry frame_telemetry;
+		if (telemetry.isEnabled())
+			measure_frame_telemetry (*internal, telemetry, commit_count, frame_telemetry);
+
+		for (unsigned int ci = 0; ci < commit_count; ci++) {
+			WindowFrame *wf = wi.window[ci];
+
+			if (!converged) {
+				result = false;
+				cerr << "Warning: could not fit frame " << wf->frame << endl;
+			}
+
+			// residuals of the final state
+			ComputeMarkerJacobian (rbdl_model, wf->q, wf->body_ids, wf->body_points, wf->target_pos, wf->workspace);
+			compute_log_row (internal->log_row, wf->residual_index, wf->workspace.e);
+			add_fit_log_row (*internal, wf->frame - frame_first, steps);
+
+			if (telemetry.isEnabled()) {
+				frame_telemetry.frame = wf->frame;
+				frame_telemetry.steps = steps;
+				frame_telemetry.success = converged;
+				frame_telemetry.residualNorm = wf->workspace.e.norm();
+				telemetry.addFrame (frame_telemetry);
+			}
+
+			double current_time = static_cast<double>(wf->frame - frame_first) / static_cast<double>(frame_last - frame_first) * data_duration;
+			fittedState = ConvertVector<VectorNd, rbdlVectorNd> (wf->q);
+			animation->addPose (current_time, fittedState);
+
+			wi.anchor = wf->q;
+			wi.anchored = true;
+			wi.anchorFrame = wf->frame;
+
+			totalFrameCount++;
+
+			wi.unused.push_back (wf);
+
+			if (frameCallback && !frameCallback (wf->frame, current_time, fittedState)) {
+				canceled = true;
+				internal->canceled = true;
+				commit_count = ci + 1;
+				break;
+			}
+		}
+
+		wi.window.erase (wi.window.begin(), wi.window.begin() + commit_count);
+
+		if (canceled) {
+			wi.unused.insert (wi.unused.end(), wi.window.begin(), wi.window.end());
+			wi.window.clear();
+			result = false;
+			break;
+		}
+	}
+
+	success = result;
+
+	return result;
+}
@@ -26,11 +26,18 @@
 #ifndef MODEL_FITTER_H
 #define MODEL_FITTER_H
 
+#include <string>
+#include <functional>
+
 #include "SimpleMath/SimpleMath.h"
+#include "StatePredictor.h"
+#include "FittingLog.h"
+#include "FitTelemetry.h"
 
 struct MarkerData;
 struct Model;
 struct Animation;
+struct IKProfile;
 
 struct ModelFitter {
 	struct ModelFitterInternal;
@@ -44,6 +51,42 @@ struct ModelFitter {
 	unsigned int steps;
 	unsigned int maxSteps;
 
+	/// File that computeModelAnimationFromMarkers() writes the per frame
+	/// marker residuals to. The log stays open between calls that continue
+	/// the previous frames until closeLog() is called.
+	std::string logFilename;
+	FittingLog::Format logFormat;
+
+	/** Multi-rate fitting in computeModelAnimationFromMarkers(): only every
+	 * keyframeStride-th frame is fitted to full tolerance. The frames in
+	 * between start from the interpolation of the neighbouring keyframes
+	 * and are refined with at most refineSteps IK steps. If
+	 * interpolationTolerance is positive, frames whose interpolated
+	 * markers all lie within that distance (in meters) of the data keep
+	 * the interpolated pose. A stride of 1 fits every frame.
+	 *
+	 * \note SlidingWindowFitter ignores these settings.
+	 */
+	unsigned int keyframeStride;
+	unsigned int refineSteps;
+	double interpolationTolerance;
+
+	/// Computes the initial state of each frame in
+	/// computeModelAnimationFromMarkers() from the previous frames.
+	StatePredictor predictor;
+	/// IK steps and frames of all calls to
+	/// computeModelAnimationFromMarkers()
+	unsigned int totalSteps;
+	unsigned int totalFrameCount;
+	/// Per frame timings and iterations of computeModelAnimationFromMarkers(),
+	/// only recorded after enableTelemetry()
+	FitTelemetry telemetry;
+
+	/// Called by computeModelAnimationFromMarkers() for every fitted frame
+	/// with the frame number, its animation time and the fitted state.
+	/// Returning false cancels the fit.
+	std::function<bool (int frame, double time, const VectorNd &state)> frameCallback;
+
 	VectorNd initialState;
 	VectorNd fittedState;
 	VectorNd residuals;
@@ -52,15 +95,54 @@ struct ModelFitter {
 	ModelFitter (Model *model, MarkerData *data, unsigned int maxSteps);
 	virtual ~ModelFitter();
 
+	/// Looks up the model markers in the marker data. Afterwards the
+	/// fitter only reads the RBDL model and the marker data until either
+	/// of them changes, which allows fitting in a different thread.
+	void prepare();
 	void setup();
 	virtual bool run (const VectorNd &initialState) = 0;
 
-	bool computeModelAnimationFromMarkers (const VectorNd &initialState, Animation *animation, int frame_start = -1, int frame_end = -1);
+	virtual bool computeModelAnimationFromMarkers (const VectorNd &initialState, Animation *animation, int frame_start = -1, int frame_end = -1);
+	/** Updates an animation previously computed by refitAnimation() after
+	 * the model markers or the marker data changed.
+	 *
+	 * The IK targets of every frame (bodies, body points and valid marker
+	 * positions) are compared with the ones of the frame with the same
+	 * number in the previous fit. Only the frames whose targets changed or
+	 * that were added to the data are refitted, followed by up to
+	 * convergence_frames frames until the fit is within
+	 * convergence_tolerance of the previous poses again. The rows of the
+	 * refitted frames replace the ones in the log of the previous fit.
+	 *
+	 * If the kinematic structure changed, no animation was fitted yet or
+	 * animation is not the unmodified result of the previous call, all
+	 * frames get fitted starting from initialState.
+	 */
+	bool refitAnimation (const VectorNd &initialState, Animation *animation, unsigned int convergence_frames = 10, double convergence_tolerance = 1.0e-4);
+	/// Makes the next refitAnimation() fit all frames
+	void invalidateFit();
 	void analyzeAnimation (Animation animation);
+	/// Writes all pending rows of the log and closes it.
+	void closeLog();
+
+	/// Enables accumulating the Jacobian and solve timings of the IK
+	/// methods in getProfile()
+	void setProfiling (bool enabled);
+	IKProfile& getProfile();
+	/// Allocates the telemetry buffers for the given number of frames and
+	/// IK iterations. Capacities of 0 disable the telemetry.
+	void enableTelemetry (unsigned int frame_capacity, unsigned int iteration_capacity);
+	/// Solves the joint space normal equations of the IK steps in single
+	/// precision, see IKPrecisionFloat. Not used by SlidingWindowFitter.
+	void setSinglePrecision (bool enabled);
 
 	VectorNd getFittedState() {
 		return fittedState;
 	}
+
+	protected:
+		/// Fits an intermediate frame of the multi-rate mode
+		bool refineInterpolatedState (const VectorNd &state);
 };
 
 struct SugiharaFitter : public ModelFitter {
@@ -90,5 +172,57 @@ struct LevenbergMarquardtFitter : public ModelFitter {
 	double lambda;
 };
 
+/** Levenberg Marquardt fitter that adapts the damping from the gain ratio
+ * of every step, see AdaptiveLevenbergMarquardtIK().
+ *
+ * The damping of the last step of a frame is used as the initial damping
+ * of the next one.
+ */
+struct AdaptiveLevenbergMarquardtFitter : public ModelFitter {
+	AdaptiveLevenbergMarquardtFitter (Model *model, MarkerData *data, unsigned int maxSteps = 200):
+		ModelFitter (model, data, maxSteps),
+		damping (0.)
+	{}
+	virtual ~AdaptiveLevenbergMarquardtFitter() {};
+	virtual bool run (const VectorNd &initialState);
+
+	double damping;
+};
+
+/** Fits windows of consecutive frames jointly.
+ *
+ * Minimizes the squared marker residuals of all frames in the window plus
+ * smoothness times the squared differences of the states of neighbouring
+ * frames using damped Gauss-Newton steps. The normal equations are block
+ * tridiagonal and solved with the block Thomas algorithm so the cost per
+ * step grows linearly with windowSize.
+ *
+ * After a window is solved its first windowStep frames are added to the
+ * animation and the window moves on. The remaining frames are used as
+ * initial guess for the next window, which is tied to the last added
+ * frame by the smoothness term.
+ *
+ * run() fits only the current frame, same as LevenbergMarquardtFitter.
+ */
+struct SlidingWindowFitter : public ModelFitter {
+	SlidingWindowFitter (Model *model, MarkerData *data, unsigned int maxSteps = 200);
+	virtual ~SlidingWindowFitter();
+	virtual bool run (const VectorNd &initialState);
+	virtual bool computeModelAnimationFromMarkers (const VectorNd &initialState, Animation *animation, int frame_start = -1, int frame_end = -1);
+
+	unsigned int windowSize;
+	unsigned int windowStep;
+	double smoothness;
+	double lambda;
+
+	struct SlidingWindowInternal;
+	SlidingWindowInternal *windowInternal;
+};
+
+/** Creates the fitter for the given method name ("sugihara", "sugiharats",
+ * "levenberg", "adaptive" or "window"). Returns NULL for unknown methods.
+ */
+ModelFitter* createModelFitter (const std::string &method, Model *model, MarkerData *data, unsigned int maxSteps = 200);
+
 /* MODEL_FITTER_H */
 #endif 
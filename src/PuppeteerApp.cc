@@ -41,9 +41,11 @@
 #include "MarkerData.h"
 #include "ModelFitter.h"
 #include "Animation.h"
+#include "AnimationFitThread.h"
 #include "Scripting.h"
 
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <ctime>
 
 #include <assert.h>
@@ -53,6 +55,7 @@
 #include <iomanip>
 #include <cstdlib>
 #include <fstream>
+#include <algorithm>
 
 using namespace std;
 
@@ -61,6 +64,22 @@ using namespace SimpleMath::GL;
 const double TIME_SLIDER_RATE = 1000.;
 
 PuppeteerApp::~PuppeteerApp() {
+	// cancels the fit and waits for it
+	if (animationFitThread) {
+		delete animationFitThread;
+		animationFitThread = NULL;
+	}
+
+	if (animationFitter) {
+		delete animationFitter;
+		animationFitter = NULL;
+	}
+
+	if (animationFitModel) {
+		delete animationFitModel;
+		animationFitModel = NULL;
+	}
+
 	if (scene) {
 		delete scene;
 		scene = NULL;
@@ -89,7 +108,12 @@ PuppeteerApp::PuppeteerApp(QWidget *parent)
 	markerModel = NULL;
 	markerData = NULL;
 	modelFitter = NULL;
+	fitterMethod = "sugihara";
 	animationData = NULL;
+	animationFitter = NULL;
+	animationFitModel = NULL;
+	animationFitThread = NULL;
+	animationFitProgress = NULL;
 	activeModelFrame = 0;
 	activeObject = -1;
 
@@ -233,7 +257,7 @@ PuppeteerApp::PuppeteerApp(QWidget *parent)
 }
 
 void print_usage(const char* execname) {
-	cout << "Usage: " << execname << " <modelfile.lua> <mocapdata.c3d> <animation.csv> [-s scriptfile.lua]" << endl;
+	cout << "Usage: " << execname << " <modelfile.lua> <mocapdata.c3d> <animation.csv|animation.anim> [-s scriptfile.lua] [-f fitter]" << endl;
 }
 
 bool PuppeteerApp::parseArgs(int argc, char* argv[]) {
@@ -270,15 +294,26 @@ bool PuppeteerApp::parseArgs(int argc, char* argv[]) {
 
 		TCLAP::ValueArg<string> scripting_file_arg ("s", "script", "scripting file", false, "", "");
 
+		vector<string> fitter_methods;
+		fitter_methods.push_back ("sugihara");
+		fitter_methods.push_back ("sugiharats");
+		fitter_methods.push_back ("levenberg");
+		fitter_methods.push_back ("adaptive");
+		fitter_methods.push_back ("window");
+		TCLAP::ValuesConstraint<string> fitter_constraint (fitter_methods);
+		TCLAP::ValueArg<string> fitter_arg ("f", "fitter", "method used for fitting the model to the markers", false, "sugihara", &fitter_constraint);
+
 		// than we may add the command line option to the command line parser
 		cmd.add( files_Arg );
 		cmd.add( rotateMoCap_Swi );
 		cmd.add( scripting_file_arg );
+		cmd.add( fitter_arg );
 
 		// then we do parse the command line
 		cmd.parse(argc, argv);
 
 		scripting_file = scripting_file_arg.getValue();
+		fitterMethod = fitter_arg.getValue();
 
 		vector<string> files = files_Arg.getValue();
 		for (vector<string>::iterator filePtr = files.begin(); filePtr != files.end(); filePtr++) {
@@ -287,7 +322,8 @@ bool PuppeteerApp::parseArgs(int argc, char* argv[]) {
 				loadModelFile (arg.c_str());
 			else if (arg.substr(arg.size() - 4, 4) == ".c3d")
 				loadMocapFile (arg.c_str(), rotateMoCap_Swi.getValue());
-			else if (arg.substr(arg.size() - 4, 4) == ".csv")
+			else if (arg.substr(arg.size() - 4, 4) == ".csv"
+					|| Animation::formatFromFilename (arg) == Animation::FormatBinary)
 				loadAnimationFile (arg.c_str());
 		}
 	} catch (TCLAP::ArgException &e) {  // here we treat exception that may come 
@@ -318,8 +354,7 @@ bool PuppeteerApp::parseArgs(int argc, char* argv[]) {
 	if (markerData) {
 		drawMocapMarkersCheckBox->setEnabled(true);
 		if (markerModel) {
-			modelFitter = new SugiharaFitter (markerModel, markerData);
-			//		modelFitter = new LevenbergMarquardtFitter (markerModel, markerData);
+			modelFitter = createModelFitter (fitterMethod, markerModel, markerData);
 			autoIKButton->setEnabled(true);
 		}
 	}
@@ -347,6 +382,8 @@ bool PuppeteerApp::parseArgs(int argc, char* argv[]) {
 }
 
 bool PuppeteerApp::loadModelFile (const char* filename) {
+	stopAnimationFit();
+
 	if (markerModel)
 		delete markerModel;
 	markerModel = new Model(scene);
@@ -363,6 +400,8 @@ bool PuppeteerApp::loadModelFile (const char* filename) {
 }
 
 bool PuppeteerApp::loadMocapFile (const char* filename, const bool rotateZ) {
+	stopAnimationFit();
+
 	if (markerData)
 		delete markerData;
 	markerData = new MarkerData (scene);
@@ -380,20 +419,25 @@ bool PuppeteerApp::loadMocapFile (const char* filename, const bool rotateZ) {
 		float fraction_negative = 0.f;
 		int frame_count = markerData->getLastFrame() - markerData->getFirstFrame();
 
-		for (int i = markerData->getFirstFrame(); i < markerData->getLastFrame(); i++) {
-			markerData->setCurrentFrameNumber (i);
-			Vector3f lasi = markerData->getMarkerCurrentPosition("LASI");
-			Vector3f lpsi = markerData->getMarkerCurrentPosition("LPSI");
+		// frames get decoded on access, so long recordings are only sampled
+		int frame_stride = std::max (1, frame_count / 1000);
+		int sample_count = (frame_count + frame_stride - 1) / frame_stride;
+
+		int lasi_index = markerData->getMarkerHandle ("LASI").index * 3;
+		int lpsi_index = markerData->getMarkerHandle ("LPSI").index * 3;
+		std::vector<float> xyz;
+
+		for (int i = markerData->getFirstFrame(); i < markerData->getLastFrame(); i += frame_stride) {
+			markerData->getFramePositions (i, xyz);
+			Vector3f lasi (xyz[lasi_index], xyz[lasi_index + 1], xyz[lasi_index + 2]);
+			Vector3f lpsi (xyz[lpsi_index], xyz[lpsi_index + 1], xyz[lpsi_index + 2]);
 
 			float projection = (lasi - lpsi).normalize().dot(Vector3f (1.f, 0.f, 0.f));
 
 			if (projection < -0.)
-				fraction_negative = fraction_negative + 1.f / static_cast<float>(frame_count);
+				fraction_negative = fraction_negative + 1.f / static_cast<float>(sample_count);
 		}
 
-		// reset current frame
-		markerData->setCurrentFrameNumber (markerData->getFirstFrame());
-
 		if (fraction_negative > 0.5) {
 			QMessageBox rotate_message_box;
 			rotate_message_box.setText("Backwards orientation detected.");
@@ -407,13 +451,11 @@ bool PuppeteerApp::loadMocapFile (const char* filename, const bool rotateZ) {
 			int ret = rotate_message_box.exec();
 
 			if (ret == QMessageBox::Yes) {
-				markerData->rotateZ = true;
-				markerData->updateMarkerSceneObjects();
+				markerData->setRotateZ (true);
 			}
 		}
 	} else if (rotateZ) {
-	  markerData->rotateZ = true;
-	  markerData->updateMarkerSceneObjects();
+	  markerData->setRotateZ (true);
 	  std::cout << "-- INFO::Marker globally rotated about Z axis (as you requested)" << std::endl;
 	}
 
@@ -428,6 +470,12 @@ bool PuppeteerApp::loadMocapFile (const char* filename, const bool rotateZ) {
 }
 
 bool PuppeteerApp::loadAnimationFile (const char* filename) {
+	stopAnimationFit();
+
+	// the loaded poses were not fitted to the current data
+	if (animationFitter)
+		animationFitter->invalidateFit();
+
 	if (animationData)
 		delete animationData;
 	
@@ -538,7 +586,16 @@ void PuppeteerApp::saveModel() {
 }
 
 void PuppeteerApp::loadAnimation() {
-	loadAnimationFile ("animation.csv");	
+	// fit_motion writes animation.csv by default, so an older
+	// animation.anim must not hide a newer animation.csv
+	struct stat anim_stat, csv_stat;
+	bool anim_exists = stat ("animation.anim", &anim_stat) == 0;
+	bool csv_exists = stat ("animation.csv", &csv_stat) == 0;
+
+	if (anim_exists && (!csv_exists || anim_stat.st_mtime > csv_stat.st_mtime))
+		loadAnimationFile ("animation.anim");
+	else
+		loadAnimationFile ("animation.csv");	
 }
 
 void PuppeteerApp::saveAnimation() {
@@ -613,47 +670,29 @@ void PuppeteerApp::assignMarkers() {
 	assert (markerModel);
 	
 	std::vector<string> marker_names;
+	std::vector<MarkerHandle> marker_handles;
 	std::vector<int> frame_ids;
 
-	bool uniqueMarkerName = true;
+	// markers of the data that are already assigned (the model may contain
+	// the same marker name multiple times)
+	std::vector<char> marker_assigned (markerData->getMarkerCount(), 0);
 
 	for (unsigned int i = 0; i < markerModel->modelMarkers.size();++i){
-		uniqueMarkerName = true;
-		for(unsigned int j=0; j < markerData->markerNames.size();++j){
-			if(markerModel->modelMarkers[i]->markerName.compare(
-				 markerData->markerNames[j]) == 0){
-
-				if(marker_names.size() == 0){
-					marker_names.push_back(markerData->markerNames[j]);
-					frame_ids.push_back(markerModel->modelMarkers[i]->frameId);
-				}else{
-					for(unsigned int k = 0; k < marker_names.size(); ++k){
-						if(marker_names[k].compare(markerData->markerNames[j])==0){
-							uniqueMarkerName = false;
-							/**
-							MM 17 March 2017. Somehow a c3d with unique label names
-							ends up with a markerData vector that contains duplications.
-							I'm still not sure how this happens. This might be happening
-							in vendor/c3dfile on the call to load.
-
-							cerr << "Duplicate marker name in c3d file: "
-									 << markerData->markerNames[j]
-									 << endl;
-							*/
-						}
-					}
-					if(uniqueMarkerName){
-						marker_names.push_back(markerData->markerNames[j]);
-						frame_ids.push_back(markerModel->modelMarkers[i]->frameId);
-					}
-				}
-			}
-		}
+		const std::string &marker_name = markerModel->modelMarkers[i]->markerName;
+		MarkerHandle handle = markerData->getMarkerHandle (marker_name.c_str());
+
+		if (!handle.isValid() || marker_assigned[handle.index])
+			continue;
+
+		marker_assigned[handle.index] = 1;
+		marker_names.push_back (marker_name);
+		marker_handles.push_back (handle);
+		frame_ids.push_back (markerModel->modelMarkers[i]->frameId);
 	}
 
 	Vector3f marker_position, local_coords;
 	for (unsigned int i = 0; i < marker_names.size(); i++) {
-		marker_position = markerData->getMarkerCurrentPosition(marker_names[i].c_str());
+		marker_position = markerData->getMarkerCurrentPosition(marker_handles[i]);
 		local_coords = markerModel->calcMarkerLocalCoords(frame_ids[i], marker_position);
 		markerModel->setFrameMarkerCoord (frame_ids[i],marker_names[i].c_str(),local_coords);
 	}
@@ -724,8 +763,7 @@ void PuppeteerApp::updateWidgetValidity() {
 	if (markerData) {
 		drawMocapMarkersCheckBox->setEnabled(true);
 		if (markerModel) {
-			modelFitter = new SugiharaFitter (markerModel, markerData);
-			//		modelFitter = new LevenbergMarquardtFitter (markerModel, markerData);
+			modelFitter = createModelFitter (fitterMethod, markerModel, markerData);
 			autoIKButton->setEnabled(true);
 		}
 	}
@@ -774,14 +812,16 @@ void PuppeteerApp::loadMotionCaptureDataDialog() {
 }
 
 void PuppeteerApp::exportAnimationDialog() {
-	QString file_name = QFileDialog::getSaveFileName(this, tr("Export Animation As .CSV File..."),
+	QString file_name = QFileDialog::getSaveFileName(this, tr("Export Animation..."),
 			"./",
-			tr("CSV files (*.csv)"));
+			tr("CSV files (*.csv);;Binary animation files (*.anim)"));
 
 	if (file_name == "")
 		return;
 
 	assert (animationData);
+	if (markerModel)
+		animationData->stateNames = markerModel->getModelStateNames();
 	animationData->saveToFile (file_name.toLocal8Bit());
 }
 
@@ -812,49 +852,131 @@ void PuppeteerApp::fitAnimation() {
 	if (!markerModel)
 		return;
 
+	if (animationFitThread)
+		return;
+
 	if (!animationData)
 		animationData = new Animation();
 
-	animationData->keyFrames.clear();
-	int frame_count = markerData->getLastFrame() - markerData->getFirstFrame();
+	int frame_count = markerData->getLastFrame() - markerData->getFirstFrame() + 1;
 
-	QProgressDialog progress ("Computing Animation...", "Cancel", 0, frame_count, this);
-	progress.setWindowModality (Qt::WindowModal);
-	progress.setMinimumDuration (0);
+	// the poses are added while the fit is running
+	if (animationData->keyFrames.size() != static_cast<size_t>(frame_count)) {
+		animationData->keyFrames.clear();
+		slideAnimationCheckBox->setChecked(false);
+		slideAnimationCheckBox->setEnabled(false);
+	}
 
-	bool success = true;
-	int i = 0;
+	// The fit runs on its own copy of the model such that we can keep
+	// drawing and editing markerModel.
+	if (!animationFitter) {
+		animationFitModel = new Model();
+		animationFitModel->loadFromModel (*markerModel);
+
+		animationFitter = createModelFitter (fitterMethod, animationFitModel, markerData);
+		animationFitter->tolerance = modelFitter->tolerance;
+		animationFitter->maxSteps = modelFitter->maxSteps;
+		animationFitter->logFilename = modelFitter->logFilename;
+		animationFitter->logFormat = modelFitter->logFormat;
+		animationFitter->predictor.method = modelFitter->predictor.method;
+	} else {
+		animationFitModel->loadFromModel (*markerModel);
+		animationFitter->data = markerData;
+	}
+	animationFitter->prepare();
 
-	auto current_model_state = markerModel->modelStateQ;
+	// telemetry of this fit for puppeteer.telemetry, on average 20 IK
+	// iterations per frame are kept
+	animationFitter->enableTelemetry (frame_count, frame_count * 20);
 
-	for (i = 0; i <= frame_count; i++) {
-		progress.setValue(i);
-		
-		bool fit_result = modelFitter->computeModelAnimationFromMarkers (current_model_state, animationData, markerData->getFirstFrame() + i, markerData->getFirstFrame() + i);
-		current_model_state = animationData->keyFrames[animationData->keyFrames.size()-1].state;
-		if (progress.wasCanceled()) {
-			qDebug() << "canceled!";
-			success = false;
-			break;
-		}
+	animationFitThread = new AnimationFitThread (animationFitter, markerModel->modelStateQ, *animationData, this);
+	connect (animationFitThread, SIGNAL (framesFitted(int)), this, SLOT (animationFramesFitted(int)));
+	connect (animationFitThread, SIGNAL (finished()), this, SLOT (animationFitFinished()));
 
-		if (!fit_result)
-			success = false;
+	animationFitProgress = new QProgressDialog ("Computing Animation...", "Cancel", 0, frame_count, this);
+	animationFitProgress->setMinimumDuration (0);
+	animationFitProgress->setValue (0);
+	connect (animationFitProgress, SIGNAL (canceled()), this, SLOT (cancelAnimationFit()));
+
+	fitAnimationButton->setEnabled(false);
+
+	animationFitThread->start();
+}
+
+void PuppeteerApp::cancelAnimationFit() {
+	if (animationFitThread) {
+		qDebug() << "canceled!";
+		animationFitThread->cancel();
 	}
+}
+
+void PuppeteerApp::stopAnimationFit() {
+	if (!animationFitThread)
+		return;
+
+	animationFitThread->cancel();
+	animationFitThread->wait();
+	finishAnimationFit();
+}
+
+void PuppeteerApp::animationFramesFitted (int fitted_frame_count) {
+	if (!animationFitThread)
+		return;
+
+	bool first_poses = animationData->keyFrames.size() == 0;
+	fitted_frame_count = animationFitThread->takeFittedPoses (animationData);
+
+	if (animationFitProgress && !animationFitThread->wasCanceled())
+		animationFitProgress->setValue (fitted_frame_count);
+
+	if (first_poses && animationData->keyFrames.size() > 0)
+		updateSliderBounds();
+
+	updateGraph();
+}
+
+void PuppeteerApp::animationFitFinished() {
+	if (!animationFitThread)
+		return;
+
+	// ignore the signal of a fit that was already stopped
+	if (sender() && sender() != animationFitThread)
+		return;
+
+	finishAnimationFit();
+}
 
-	progress.setValue (i);
+void PuppeteerApp::finishAnimationFit() {
+	assert (animationFitThread);
 
+	animationFramesFitted (0);
+
+	bool success = animationFitThread->getResult();
+	if (!animationFitThread->wasCanceled())
+		animationData->keyFrames = animationFitThread->getAnimation().keyFrames;
 	if (success) {
 		qDebug() << "fit successful!";
 	} else {
 		qDebug() << "fit failed!";
 	}
 
-	slideAnimationCheckBox->setEnabled(true);
-	slideAnimationCheckBox->setChecked(true);
+	// signals that are still queued must not reach the next fit
+	disconnect (animationFitThread, 0, this, 0);
+	delete animationFitThread;
+	animationFitThread = NULL;
 
-	updateSliderBounds();
-	updateGraph();
+	if (animationFitProgress) {
+		animationFitProgress->close();
+		animationFitProgress->deleteLater();
+		animationFitProgress = NULL;
+	}
+
+	fitAnimationButton->setEnabled(true);
+
+	if (animationData->keyFrames.size() > 0) {
+		updateSliderBounds();
+		updateGraph();
+	}
 
 	emit animation_fitting_complete();
 }
@@ -52,6 +52,8 @@ struct Model;
 struct MarkerData;
 struct ModelFitter;
 struct Animation;
+class AnimationFitThread;
+class QProgressDialog;
 
 class PuppeteerApp : public QMainWindow, public Ui::PuppeteerMainWindow
 {
@@ -66,7 +68,17 @@ public:
 		Model *markerModel;
 		MarkerData *markerData;
 		ModelFitter *modelFitter;
+		/// Name of the method passed to createModelFitter()
+		std::string fitterMethod;
 		Animation *animationData;
+		/// Fitter of fitAnimation() and its copy of markerModel. It is kept
+		/// such that subsequent fits only refit the frames affected by
+		/// changes.
+		ModelFitter *animationFitter;
+		Model *animationFitModel;
+		/// Runs fitAnimation() in the background, NULL if no fit is running
+		AnimationFitThread *animationFitThread;
+		QProgressDialog *animationFitProgress;
 
 		PuppeteerAboutDialog *aboutDialog;
 
@@ -126,6 +138,10 @@ protected:
 			nameToProperty[name] = property;
 		}
 		void updateSliderBounds ();
+		/// Cancels a running animation fit and waits until it has finished.
+		void stopAnimationFit ();
+		/// Takes the result of the animation fit and deletes its thread.
+		void finishAnimationFit ();
 
 public slots:
 		void execAboutDialog();
@@ -152,6 +168,9 @@ public slots:
 		void assignMarkers();
 		void fitModel();
 		void fitAnimation();
+		void cancelAnimationFit();
+		void animationFramesFitted (int fitted_frame_count);
+		void animationFitFinished();
 
 		void updatePropertiesEditor (int object_id);
 		void updatePropertiesForFrame (unsigned int frame_id);
@@ -28,6 +28,9 @@
 
 #include "Scripting.h"
 #include "MarkerData.h"
+#include "Model.h"
+#include "Animation.h"
+#include "ModelFitter.h"
 
 #include <errno.h>
 
@@ -384,9 +387,39 @@ static int mocap_data_enableMarker (lua_State *L) {
 	return 0;
 }
 
+/// Metatable of the marker handles that are passed to Lua
+static const char marker_handle_metatable[] = "puppeteer.MarkerHandle";
+
 ///
-// @function puppeteer.mocap_data.getMarkerPosition
+// @function puppeteer.mocap_data.getMarkerHandle
 // @param marker_name
+// @return handle of the marker or nil if the marker does not exist. The
+// handle is only valid until another motion capture file gets loaded.
+static int mocap_data_getMarkerHandle (lua_State *L) {
+	MarkerData* marker_data = app_ptr->markerData;
+
+	if (!marker_data)
+		luaL_error (L, "No motion capture file loaded!");
+
+	MarkerHandle handle = marker_data->getMarkerHandle (luaL_checkstring (L, 1));
+
+	if (!handle.isValid()) {
+		lua_pushnil (L);
+		return 1;
+	}
+
+	// userdata such that the revision stays with the index
+	MarkerHandle *lua_handle = static_cast<MarkerHandle*>(lua_newuserdata (L, sizeof (MarkerHandle)));
+	*lua_handle = handle;
+	luaL_getmetatable (L, marker_handle_metatable);
+	lua_setmetatable (L, -2);
+
+	return 1;
+}
+
+///
+// @function puppeteer.mocap_data.getMarkerPosition
+// @param marker_name or marker handle
 // @return current marker position 
 static int mocap_data_getMarkerCurrentPosition (lua_State *L) {
 	MarkerData* marker_data = app_ptr->markerData;
@@ -394,8 +427,21 @@ static int mocap_data_getMarkerCurrentPosition (lua_State *L) {
 	if (!marker_data)
 		luaL_error (L, "No motion capture file loaded!");
 
-	const char* marker_name = luaL_checkstring (L, 1);
-	Vector3f position = marker_data->getMarkerCurrentPosition (marker_name);
+	MarkerHandle handle;
+	if (lua_type (L, 1) == LUA_TUSERDATA) {
+		handle = *static_cast<MarkerHandle*>(luaL_checkudata (L, 1, marker_handle_metatable));
+		if (handle.revision != marker_data->revision)
+			luaL_error (L, "Marker handle %d belongs to a previously loaded motion capture file!", handle.index);
+		if (handle.index < 0 || handle.index >= static_cast<int>(marker_data->getMarkerCount()))
+			luaL_error (L, "Invalid marker handle %d!", handle.index);
+	} else {
+		const char* marker_name = luaL_checkstring (L, 1);
+		handle = marker_data->getMarkerHandle (marker_name);
+		if (!handle.isValid())
+			luaL_error (L, "Marker '%s' does not exist!", marker_name);
+	}
+
+	Vector3f position = marker_data->getMarkerCurrentPosition (handle);
 
 	l_pushvector3f (L, position);
 
@@ -409,10 +455,148 @@ static const struct luaL_Reg puppeteer_mocap_data_f[] = {
 	{ "calcDataBoundingBox", mocap_data_calcDataBoundingBox},
 	{ "clearMarkers", mocap_data_clearMarkers},
 	{ "enableMarker", mocap_data_enableMarker},
+	{ "getMarkerHandle", mocap_data_getMarkerHandle},
 	{ "getMarkerCurrentPosition", mocap_data_getMarkerCurrentPosition},
 	{ NULL, NULL}
 };
 
+//
+// Fitting telemetry
+//
+
+/// Returns the fitter of the last animation fit
+static ModelFitter* telemetry_fitter (lua_State *L) {
+	if (app_ptr->animationFitThread)
+		luaL_error (L, "Animation fit still running!");
+
+	if (!app_ptr->animationFitter)
+		luaL_error (L, "No animation fitted yet!");
+
+	return app_ptr->animationFitter;
+}
+
+static void l_setfieldnumber (lua_State *L, const char *name, double value) {
+	lua_pushnumber (L, value);
+	lua_setfield (L, -2, name);
+}
+
+///
+// @function puppeteer.telemetry.getFrameCount
+// @return number of frames of the last animation fit that are stored
+static int telemetry_getFrameCount (lua_State *L) {
+	ModelFitter *fitter = telemetry_fitter (L);
+
+	lua_pushnumber (L, fitter->telemetry.getFrameCount());
+
+	return 1;
+}
+
+/// Returns the telemetry of a fitted frame.
+// @function puppeteer.telemetry.getFrame
+// @param index from 1 (oldest) to getFrameCount()
+// @return table with frame, steps, success, total_time, kinematics_time,
+// jacobian_time, solve_time, residual_norm and the per iteration
+// residual_norms and step_norms (empty if already overwritten)
+static int telemetry_getFrame (lua_State *L) {
+	ModelFitter *fitter = telemetry_fitter (L);
+
+	int index = luaL_checkinteger (L, 1);
+	if (index < 1 || index > static_cast<int>(fitter->telemetry.getFrameCount()))
+		luaL_error (L, "Invalid telemetry frame index %d!", index);
+
+	const FrameTelemetry &frame = fitter->telemetry.getFrame (index - 1);
+
+	lua_newtable (L);
+	l_setfieldnumber (L, "frame", frame.frame);
+	l_setfieldnumber (L, "steps", frame.steps);
+	lua_pushboolean (L, frame.success);
+	lua_setfield (L, -2, "success");
+	l_setfieldnumber (L, "total_time", frame.totalTime);
+	l_setfieldnumber (L, "kinematics_time", frame.kinematicsTime);
+	l_setfieldnumber (L, "jacobian_time", frame.jacobianTime);
+	l_setfieldnumber (L, "solve_time", frame.solveTime);
+	l_setfieldnumber (L, "residual_norm", frame.residualNorm);
+
+	vector<IterationTelemetry> iterations;
+	fitter->telemetry.getIterations (frame, iterations);
+
+	lua_createtable (L, iterations.size(), 0);
+	for (size_t i = 0; i < iterations.size(); i++) {
+		lua_pushnumber (L, iterations[i].residualNorm);
+		lua_rawseti (L, -2, i + 1);
+	}
+	lua_setfield (L, -2, "residual_norms");
+
+	lua_createtable (L, iterations.size(), 0);
+	for (size_t i = 0; i < iterations.size(); i++) {
+		lua_pushnumber (L, iterations[i].stepNorm);
+		lua_rawseti (L, -2, i + 1);
+	}
+	lua_setfield (L, -2, "step_norms");
+
+	return 1;
+}
+
+/// Returns the summary of all frames of the last animation fit.
+// @function puppeteer.telemetry.getSummary
+// @return table with frames, failed_frames, total_steps, max_steps,
+// max_steps_frame, total_time, kinematics_time, jacobian_time, solve_time,
+// max_frame_time, slowest_frame, max_residual_norm and worst_frame
+static int telemetry_getSummary (lua_State *L) {
+	ModelFitter *fitter = telemetry_fitter (L);
+	const FitTelemetrySummary &summary = fitter->telemetry.getSummary();
+
+	lua_newtable (L);
+	l_setfieldnumber (L, "frames", summary.frameCount);
+	l_setfieldnumber (L, "failed_frames", summary.failedFrameCount);
+	l_setfieldnumber (L, "total_steps", summary.totalSteps);
+	l_setfieldnumber (L, "max_steps", summary.maxSteps);
+	l_setfieldnumber (L, "max_steps_frame", summary.maxStepsFrame);
+	l_setfieldnumber (L, "total_time", summary.totalTime);
+	l_setfieldnumber (L, "kinematics_time", summary.kinematicsTime);
+	l_setfieldnumber (L, "jacobian_time", summary.jacobianTime);
+	l_setfieldnumber (L, "solve_time", summary.solveTime);
+	l_setfieldnumber (L, "max_frame_time", summary.maxFrameTime);
+	l_setfieldnumber (L, "slowest_frame", summary.slowestFrame);
+	l_setfieldnumber (L, "max_residual_norm", summary.maxResidualNorm);
+	l_setfieldnumber (L, "worst_frame", summary.worstFrame);
+
+	return 1;
+}
+
+///
+// @function puppeteer.telemetry.saveSummary
+// @param filename
+static int telemetry_saveSummary (lua_State *L) {
+	ModelFitter *fitter = telemetry_fitter (L);
+	string filename = luaL_checkstring (L, 1);
+
+	lua_pushboolean (L, fitter->telemetry.saveSummary (filename));
+
+	return 1;
+}
+
+///
+// @function puppeteer.telemetry.saveFrames
+// @param filename
+static int telemetry_saveFrames (lua_State *L) {
+	ModelFitter *fitter = telemetry_fitter (L);
+	string filename = luaL_checkstring (L, 1);
+
+	lua_pushboolean (L, fitter->telemetry.saveFrames (filename));
+
+	return 1;
+}
+
+static const struct luaL_Reg puppeteer_telemetry_f[] = {
+	{ "getFrameCount", telemetry_getFrameCount},
+	{ "getFrame", telemetry_getFrame},
+	{ "getSummary", telemetry_getSummary},
+	{ "saveSummary", telemetry_saveSummary},
+	{ "saveFrames", telemetry_saveFrames},
+	{ NULL, NULL}
+};
+
 ///
 // @function puppeteer.loadModel
 // @param filename
@@ -435,6 +619,44 @@ static int puppeteer_loadMarkerData (lua_State *L) {
 	return 0;
 }
 
+///
+// @function puppeteer.loadAnimation
+// @param filename of a .csv or .anim file
+static int puppeteer_loadAnimation (lua_State *L) {
+	string filename = luaL_checkstring (L, 1);
+
+	if (!app_ptr->loadAnimationFile (filename.c_str()))
+		luaL_error (L, "Could not load animation from '%s'!", filename.c_str());
+
+	return 0;
+}
+
+///
+// @function puppeteer.saveAnimation
+// @param filename, saved in the binary format if it ends with .anim
+// @param single_precision (optional) stores the states of binary files as
+// float32
+static int puppeteer_saveAnimation (lua_State *L) {
+	string filename = luaL_checkstring (L, 1);
+	bool single_precision = false;
+	if (lua_gettop(L) >= 2)
+		single_precision = lua_toboolean (L, 2);
+
+	if (app_ptr->animationFitThread)
+		luaL_error (L, "Animation fit still running!");
+
+	if (!app_ptr->animationData)
+		luaL_error (L, "No animation loaded!");
+
+	if (app_ptr->markerModel)
+		app_ptr->animationData->stateNames = app_ptr->markerModel->getModelStateNames();
+
+	if (!app_ptr->animationData->saveToFile (filename.c_str(), Animation::formatFromFilename (filename), single_precision))
+		luaL_error (L, "Could not save animation to '%s'!", filename.c_str());
+
+	return 0;
+}
+
 ///
 // @function puppeteer.saveScreenShot 
 // @param filename
@@ -475,6 +697,8 @@ static int puppeteer_setCurrentTime (lua_State *L) {
 static const struct luaL_Reg puppeteer_f[] = {
 	{ "loadModel", puppeteer_loadModel},
 	{ "loadMarkerData", puppeteer_loadMarkerData},
+	{ "loadAnimation", puppeteer_loadAnimation},
+	{ "saveAnimation", puppeteer_saveAnimation},
 	{ "saveScreenShot", puppeteer_saveScreenShot},
 	{ "getCurrentTime", puppeteer_getCurrentTime},
 	{ "setCurrentTime", puppeteer_setCurrentTime},
@@ -643,10 +867,17 @@ void register_functions (lua_State *L){
 	luaL_register (L, NULL, puppeteer_mocap_data_f);
 	lua_setfield (L, puppeteer_table, "mocap_data");
 
+	luaL_newmetatable (L, marker_handle_metatable);
+	lua_pop (L, 1);
+
 	lua_newtable (L); // puppeteer.scene
 	luaL_register (L, NULL, puppeteer_scene_f);
 	lua_setfield (L, puppeteer_table, "scene");
 
+	lua_newtable (L); // puppeteer.telemetry
+	luaL_register (L, NULL, puppeteer_telemetry_f);
+	lua_setfield (L, puppeteer_table, "telemetry");
+
 	lua_pop (L, 1); // puppeteer
 
 	assert (lua_gettop(L) == 0);
@@ -0,0 +1,130 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include "StatePredictor.h"
+
+#include <cmath>
+
+using namespace std;
+
+bool StatePredictor::isStatic () const {
+	if (historyCount < 2)
+		return false;
+
+	for (unsigned int i = 0; i < history[0].size(); i++) {
+		if (fabs (history[0][i] - history[1][i]) > staticThreshold)
+			return false;
+	}
+
+	return true;
+}
+
+VectorNd StatePredictor::predict (int frame, const VectorNd &initial_state) const {
+	if (method == StatePredictionNone
+			|| historyCount == 0
+			|| frame != lastFrame + 1
+			|| initial_state != history[0])
+		return initial_state;
+
+	if (isStatic())
+		return history[0];
+
+	if (method == StatePredictionKalman) {
+		return kalmanPosition + kalmanVelocity;
+	}
+
+	if (method == StatePredictionConstantAcceleration && historyCount >= 3) {
+		// q + qdot + qddot with backward differences
+		return history[0] * 3. - history[1] * 3. + history[2];
+	}
+
+	if (historyCount >= 2) {
+		return history[0] * 2. - history[1];
+	}
+
+	return history[0];
+}
+
+void StatePredictor::addState (int frame, const VectorNd &state) {
+	if (historyCount > 0 && (frame != lastFrame + 1 || state.size() != history[0].size()))
+		historyCount = 0;
+
+	history[2] = history[1];
+	history[1] = history[0];
+	history[0] = state;
+	lastFrame = frame;
+	historyCount = historyCount < 3 ? historyCount + 1 : 3;
+
+	if (method != StatePredictionKalman)
+		return;
+
+	if (historyCount == 1) {
+		kalmanPosition = state;
+		kalmanVelocity = VectorNd::Zero (state.size());
+		kalmanCovariance[0][0] = measurementNoise;
+		kalmanCovariance[0][1] = 0.;
+		kalmanCovariance[1][0] = 0.;
+		kalmanCovariance[1][1] = 1.;
+		return;
+	}
+
+	// prediction with F = [1 1; 0 1] and Q for white noise acceleration
+	double (&P)[2][2] = kalmanCovariance;
+	double p00 = P[0][0] + P[0][1] + P[1][0] + P[1][1] + 0.25 * processNoise;
+	double p01 = P[0][1] + P[1][1] + 0.5 * processNoise;
+	double p11 = P[1][1] + processNoise;
+
+	// update with H = [1 0]
+	double s = p00 + measurementNoise;
+	double k0 = p00 / s;
+	double k1 = p01 / s;
+
+	for (unsigned int i = 0; i < state.size(); i++) {
+		double position = kalmanPosition[i] + kalmanVelocity[i];
+		double innovation = state[i] - position;
+		kalmanPosition[i] = position + k0 * innovation;
+		kalmanVelocity[i] = kalmanVelocity[i] + k1 * innovation;
+	}
+
+	P[0][0] = (1. - k0) * p00;
+	P[0][1] = (1. - k0) * p01;
+	P[1][0] = P[0][1];
+	P[1][1] = p11 - k1 * p01;
+}
+
+bool StatePredictor::parseMethod (const std::string &name, StatePredictionMethod *method) {
+	if (name == "none")
+		*method = StatePredictionNone;
+	else if (name == "velocity")
+		*method = StatePredictionConstantVelocity;
+	else if (name == "acceleration")
+		*method = StatePredictionConstantAcceleration;
+	else if (name == "kalman")
+		*method = StatePredictionKalman;
+	else
+		return false;
+
+	return true;
+}
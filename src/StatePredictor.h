@@ -0,0 +1,102 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#ifndef STATE_PREDICTOR_H
+#define STATE_PREDICTOR_H
+
+#include <string>
+
+#include "SimpleMath/SimpleMath.h"
+
+enum StatePredictionMethod {
+	StatePredictionNone = 0,
+	StatePredictionConstantVelocity,
+	StatePredictionConstantAcceleration,
+	StatePredictionKalman
+};
+
+/** Predicts the initial state of the next frame from the fitted states of
+ * the previous frames.
+ *
+ * The history only grows while the fitted frames are contiguous. Once a
+ * frame is skipped or the caller starts from a different state the
+ * history is dropped and the given initial state is used as it is.
+ *
+ * If the last two states differ by less than staticThreshold in every
+ * coordinate the motion is considered static and the last state is used
+ * without extrapolation, regardless of the method.
+ *
+ * The Kalman filter uses a constant velocity model for every coordinate
+ * with white noise acceleration (processNoise) and measurement noise
+ * (measurementNoise) of the fitted states. As all coordinates share the
+ * same model their covariances are the same and only one is stored.
+ */
+struct StatePredictor {
+	StatePredictor() :
+		method (StatePredictionNone),
+		staticThreshold (1.0e-5),
+		processNoise (1.0e-2),
+		measurementNoise (1.0e-4),
+		lastFrame (0),
+		historyCount (0)
+	{}
+
+	StatePredictionMethod method;
+	double staticThreshold;
+	double processNoise;
+	double measurementNoise;
+
+	int lastFrame;
+	/// Number of valid states in history
+	unsigned int historyCount;
+	/// The last three fitted states, history[0] is the latest
+	VectorNd history[3];
+
+	/// State and covariance of the Kalman filter (position and velocity)
+	VectorNd kalmanPosition;
+	VectorNd kalmanVelocity;
+	double kalmanCovariance[2][2];
+
+	void reset() {
+		historyCount = 0;
+	}
+
+	/** Returns the initial state for frame.
+	 *
+	 * If frame does not follow the last fitted frame or initial_state is
+	 * not the last fitted state, initial_state is returned.
+	 */
+	VectorNd predict (int frame, const VectorNd &initial_state) const;
+
+	/// Adds the fitted state of frame to the history
+	void addState (int frame, const VectorNd &state);
+
+	bool isStatic () const;
+
+	static bool parseMethod (const std::string &name, StatePredictionMethod *method);
+};
+
+/* STATE_PREDICTOR_H */
+#endif
@@ -0,0 +1,405 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <random>
+
+#include <unistd.h>
+
+#include "timer.h"
+
+#include "Model.h"
+#include "MarkerData.h"
+#include "Animation.h"
+#include "ModelFitter.h"
+#include "InverseKinematics.h"
+#include "C3DWriter.h"
+
+#include <rbdl/rbdl.h>
+
+using namespace std;
+
+/** Benchmark of the ModelFitter implementations on synthetic data.
+ *
+ * Generates a model with a floating base and five chains of revolute
+ * joints (similar to the model of bench_jacobian) with the requested
+ * number of degrees of freedom and markers per body. The ground truth
+ * motion is a set of sinusoids from which the marker trajectories are
+ * computed and written to a C3D file. Every fitter then fits the data
+ * starting from the true pose of the first frame.
+ *
+ * The results are written as CSV with one line per fitter so that they
+ * can be compared across versions.
+ */
+
+const unsigned int chain_count = 5;
+
+unsigned int dof_count = 26;
+unsigned int markers_per_body = 3;
+unsigned int frame_count = 200;
+double frame_rate = 100.;
+double noise = 0.;
+unsigned int max_steps = 200;
+string fitter_methods = "sugihara,sugiharats,levenberg,adaptive,window";
+string output_filename = "";
+bool single_precision = false;
+
+void print_usage(const char* execname) {
+	cout << "Usage: " << execname << " [--dof count] [--markers count] [--frames count] [--rate hz] [--noise mm] [-s count] [--fitters list] [--float] [--output file.csv]" << endl;
+	cout << "--dof count     : degrees of freedom of the model, at least 6 (default 26)." << endl;
+	cout << "--markers count : markers per body (default 3)." << endl;
+	cout << "--frames count  : number of frames of the motion (default 200)." << endl;
+	cout << "--rate hz       : frame rate of the motion (default 100)." << endl;
+	cout << "--noise mm      : standard deviation of the marker noise (default 0)." << endl;
+	cout << "-s count        : maximum number of IK steps per frame (default 200)." << endl;
+	cout << "--fitters list  : comma separated fitter methods (default " << fitter_methods << ")." << endl;
+	cout << "--float         : solves the normal equations in single precision." << endl;
+	cout << "--output file   : writes the results to file instead of stdout." << endl;
+}
+
+template <typename T>
+bool parse_number (int argc, char* argv[], int &i, T &value) {
+	if (i + 1 >= argc)
+		return false;
+
+	istringstream convert (argv[i + 1]);
+	if (!(convert >> value)) {
+		cerr << "Error: cannot parse number argument of " << argv[i] << ": " << argv[i + 1] << endl;
+		return false;
+	}
+
+	i++;
+	return true;
+}
+
+bool parse_args (int argc, char* argv[]) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg (argv[i]);
+		if (arg == "--dof") {
+			if (!parse_number (argc, argv, i, dof_count) || dof_count < 6)
+				return false;
+		} else if (arg == "--markers") {
+			if (!parse_number (argc, argv, i, markers_per_body) || markers_per_body == 0)
+				return false;
+		} else if (arg == "--frames") {
+			if (!parse_number (argc, argv, i, frame_count) || frame_count < 2)
+				return false;
+		} else if (arg == "--rate") {
+			if (!parse_number (argc, argv, i, frame_rate) || frame_rate <= 0.)
+				return false;
+		} else if (arg == "--noise") {
+			if (!parse_number (argc, argv, i, noise))
+				return false;
+		} else if (arg == "-s") {
+			if (!parse_number (argc, argv, i, max_steps))
+				return false;
+		} else if (arg == "--fitters" && i + 1 < argc) {
+			fitter_methods = argv[++i];
+		} else if (arg == "--float") {
+			single_precision = true;
+		} else if (arg == "--output" && i + 1 < argc) {
+			output_filename = argv[++i];
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Writes the model as a lua file. Body 0 is the floating base, the
+ * remaining revolute joints are distributed over the chains. */
+void write_model (const char* filename, vector<string> &body_names) {
+	ofstream model_file (filename);
+
+	unsigned int revolute_count = dof_count - 6;
+	vector<unsigned int> chain_lengths (chain_count, revolute_count / chain_count);
+	for (unsigned int c = 0; c < revolute_count % chain_count; c++)
+		chain_lengths[c]++;
+
+	model_file << "return {" << endl << "\tframes = {" << endl;
+
+	body_names.clear();
+	for (unsigned int c = 0; c <= chain_count; c++) {
+		unsigned int length = c == 0 ? 1 : chain_lengths[c - 1];
+
+		for (unsigned int l = 0; l < length; l++) {
+			ostringstream name;
+			ostringstream parent;
+			ostringstream joint;
+			Vector3d offset (0., 0., -0.4);
+
+			if (c == 0) {
+				name << "pelvis";
+				parent << "ROOT";
+				joint << "{ 0, 0, 0, 1, 0, 0 }, { 0, 0, 0, 0, 1, 0 }, { 0, 0, 0, 0, 0, 1 }, { 0, 0, 1, 0, 0, 0 }, { 0, 1, 0, 0, 0, 0 }, { 1, 0, 0, 0, 0, 0 }";
+				offset = Vector3d (0., 0., 1.);
+			} else {
+				name << "chain" << c << "_" << l;
+				if (l == 0) {
+					parent << "pelvis";
+					offset = Vector3d (0.2 * c - 0.6, 0., 0.);
+				} else {
+					parent << "chain" << c << "_" << l - 1;
+				}
+				joint << ((l % 2 == 0) ? "{ 1, 0, 0, 0, 0, 0 }" : "{ 0, 1, 0, 0, 0, 0 }");
+			}
+
+			// the floating base needs at least three markers to be observable
+			unsigned int marker_count = markers_per_body;
+			if (c == 0 && marker_count < 3)
+				marker_count = 3;
+
+			model_file << "\t\t{" << endl
+				<< "\t\t\tname = \"" << name.str() << "\"," << endl
+				<< "\t\t\tparent = \"" << parent.str() << "\"," << endl
+				<< "\t\t\tjoint = { " << joint.str() << " }," << endl
+				<< "\t\t\tjoint_frame = { r = { " << offset[0] << ", " << offset[1] << ", " << offset[2] << " } }," << endl
+				<< "\t\t\tbody = { mass = 1., com = { 0., 0., -0.2 }, inertia = { { 0.1, 0., 0. }, { 0., 0.1, 0. }, { 0., 0., 0.1 } } }," << endl
+				<< "\t\t\tmarkers = {" << endl;
+
+			for (unsigned int m = 0; m < marker_count; m++) {
+				char marker_name[16];
+				snprintf (marker_name, sizeof (marker_name), "B%03dM%02d", static_cast<int>(body_names.size()), m);
+				double angle = 2. * M_PI * m / marker_count;
+				model_file << "\t\t\t\t" << marker_name << " = { "
+					<< 0.08 * cos (angle) << ", " << 0.08 * sin (angle) << ", " << -0.3 * (m + 1) / marker_count
+					<< " }," << endl;
+			}
+
+			model_file << "\t\t\t}," << endl << "\t\t}," << endl;
+			body_names.push_back (name.str());
+		}
+	}
+
+	model_file << "\t}" << endl << "}" << endl;
+}
+
+/// Ground truth state of the model at time t
+void ground_truth_state (double t, VectorNd &q) {
+	for (unsigned int i = 0; i < q.size(); i++) {
+		double frequency = 0.3 + 0.1 * (i % 5);
+		double amplitude = i < 3 ? 0.1 : 0.4;
+		q[i] = amplitude * sin (2. * M_PI * frequency * t + i);
+	}
+}
+
+/// Marker of the model with its body and local coordinates
+struct BenchMarker {
+	string name;
+	unsigned int bodyId;
+	rbdlVector3d bodyPoint;
+};
+
+void marker_positions (Model &model, const vector<BenchMarker> &markers, const VectorNd &q, vector<Vector3d> &positions) {
+	rbdlVectorNd rbdl_q (q.size());
+	for (unsigned int i = 0; i < q.size(); i++)
+		rbdl_q[i] = q[i];
+
+	RigidBodyDynamics::UpdateKinematicsCustom (*model.rbdlModel, &rbdl_q, NULL, NULL);
+
+	positions.resize (markers.size());
+	for (unsigned int mi = 0; mi < markers.size(); mi++) {
+		rbdlVector3d position = RigidBodyDynamics::CalcBodyToBaseCoordinates (*model.rbdlModel, rbdl_q, markers[mi].bodyId, markers[mi].bodyPoint, false);
+		positions[mi] = Vector3d (position[0], position[1], position[2]);
+	}
+}
+
+/// Generates the data and runs all fitters on it
+int run_benchmark (const char *model_filename, const char *data_filename, const char *log_filename) {
+	vector<string> body_names;
+	write_model (model_filename, body_names);
+
+	Model model;
+	if (!model.loadFromFile (model_filename))
+		return 1;
+
+	vector<BenchMarker> markers;
+	for (unsigned int frame_id = 1; frame_id <= body_names.size(); frame_id++) {
+		vector<string> names = model.getFrameMarkerNames (frame_id);
+		vector<Vector3f> coords = model.getFrameMarkerCoords (frame_id);
+		for (unsigned int mi = 0; mi < names.size(); mi++) {
+			BenchMarker marker;
+			marker.name = names[mi];
+			marker.bodyId = model.frameIdToRbdlId[frame_id];
+			marker.bodyPoint = rbdlVector3d (coords[mi][0], coords[mi][1], coords[mi][2]);
+			markers.push_back (marker);
+		}
+	}
+
+	// ground truth and marker data
+	unsigned int q_size = model.rbdlModel->q_size;
+	vector<VectorNd> true_states (frame_count, VectorNd::Zero (q_size));
+	vector<vector<Vector3d> > positions (frame_count);
+
+	std::mt19937 random_engine (1);
+	std::normal_distribution<double> noise_distribution (0., noise * 1.0e-3);
+
+	for (unsigned int f = 0; f < frame_count; f++) {
+		ground_truth_state (f / frame_rate, true_states[f]);
+		marker_positions (model, markers, true_states[f], positions[f]);
+
+		if (noise > 0.) {
+			for (unsigned int mi = 0; mi < markers.size(); mi++) {
+				for (unsigned int j = 0; j < 3; j++)
+					positions[f][mi][j] += noise_distribution (random_engine);
+			}
+		}
+	}
+
+	vector<string> labels (markers.size());
+	for (unsigned int mi = 0; mi < markers.size(); mi++)
+		labels[mi] = markers[mi].name;
+
+	// trajectories in millimeters
+	vector<float> xyz (frame_count * markers.size() * 3);
+	for (unsigned int f = 0; f < frame_count; f++) {
+		for (unsigned int mi = 0; mi < markers.size(); mi++) {
+			for (unsigned int j = 0; j < 3; j++)
+				xyz[(f * markers.size() + mi) * 3 + j] = static_cast<float>(positions[f][mi][j] * 1.0e3);
+		}
+	}
+
+	if (!C3DWriter::writePoints (data_filename, labels, xyz, static_cast<float>(frame_rate)))
+		return 1;
+
+	MarkerData data;
+	if (!data.loadFromFile (data_filename))
+		return 1;
+
+	ofstream output_file;
+	if (output_filename != "")
+		output_file.open (output_filename.c_str());
+	ostream &out = output_filename != "" ? output_file : cout;
+
+	out << "fitter,precision,dofs,markers,frames,success,duration_s,frames_per_s,steps_per_frame,"
+		<< "kinematics_count,kinematics_us,jacobian_count,jacobian_us,solve_count,solve_us,residual_rms_mm,residual_max_mm,state_rms_error" << endl;
+
+	istringstream method_stream (fitter_methods);
+	string method;
+	while (getline (method_stream, method, ',')) {
+		ModelFitter *fitter = createModelFitter (method, &model, &data, max_steps);
+		if (!fitter) {
+			cerr << "Error: unknown fitter method " << method << endl;
+			return 1;
+		}
+
+		fitter->logFilename = log_filename;
+		fitter->setProfiling (true);
+		fitter->setSinglePrecision (single_precision);
+
+		vector<VectorNd> fitted_states (frame_count, VectorNd::Zero (q_size));
+		int first_frame = data.getFirstFrame();
+		fitter->frameCallback = [&] (int frame, double time, const VectorNd &state) {
+			fitted_states[frame - first_frame] = state;
+			return true;
+		};
+
+		Animation animation;
+		TimerInfo timer;
+
+		timer_start (&timer);
+		bool success = fitter->computeModelAnimationFromMarkers (true_states[0], &animation);
+		double duration = timer_stop (&timer);
+		fitter->closeLog();
+
+		// accuracy with respect to the marker data and the true states
+		double residual_sum = 0.;
+		double residual_max = 0.;
+		double state_error_sum = 0.;
+		vector<Vector3d> fitted_positions;
+		for (unsigned int f = 0; f < frame_count; f++) {
+			marker_positions (model, markers, fitted_states[f], fitted_positions);
+			for (unsigned int mi = 0; mi < markers.size(); mi++) {
+				double residual = (fitted_positions[mi] - positions[f][mi]).norm();
+				residual_sum += residual * residual;
+				residual_max = std::max (residual_max, residual);
+			}
+
+			for (unsigned int i = 0; i < q_size; i++) {
+				double error = fitted_states[f][i] - true_states[f][i];
+				state_error_sum += error * error;
+			}
+		}
+
+		const IKProfile &profile = fitter->getProfile();
+		out << method << ","
+			<< (single_precision ? "float" : "double") << ","
+			<< model.rbdlModel->qdot_size << ","
+			<< markers.size() << ","
+			<< frame_count << ","
+			<< success << ","
+			<< duration << ","
+			<< frame_count / duration << ","
+			<< static_cast<double>(fitter->totalSteps) / fitter->totalFrameCount << ","
+			<< profile.kinematicsCount << ","
+			<< (profile.kinematicsCount > 0 ? profile.kinematicsTime * 1.0e6 / profile.kinematicsCount : 0.) << ","
+			<< profile.jacobianCount << ","
+			<< (profile.jacobianCount > 0 ? profile.jacobianTime * 1.0e6 / profile.jacobianCount : 0.) << ","
+			<< profile.solveCount << ","
+			<< (profile.solveCount > 0 ? profile.solveTime * 1.0e6 / profile.solveCount : 0.) << ","
+			<< sqrt (residual_sum / (frame_count * markers.size())) * 1.0e3 << ","
+			<< residual_max * 1.0e3 << ","
+			<< sqrt (state_error_sum / (frame_count * q_size))
+			<< endl;
+
+		delete fitter;
+	}
+
+	return 0;
+}
+
+int main (int argc, char* argv[]) {
+	if (!parse_args (argc, argv)) {
+		print_usage (argv[0]);
+		return 1;
+	}
+
+	// the generated model, data and log are removed at the end
+	const char *tmp_dir = getenv ("TMPDIR");
+	string work_dir = string (tmp_dir ? tmp_dir : "/tmp") + "/bench_fit_XXXXXX";
+	if (!mkdtemp (&work_dir[0])) {
+		cerr << "Error: could not create a temporary directory." << endl;
+		return 1;
+	}
+	string model_filename = work_dir + "/model.lua";
+	string data_filename = work_dir + "/data.c3d";
+	string log_filename = work_dir + "/log.csv";
+
+	int result = run_benchmark (model_filename.c_str(), data_filename.c_str(), log_filename.c_str());
+
+	remove (model_filename.c_str());
+	remove (data_filename.c_str());
+	remove (log_filename.c_str());
+	rmdir (work_dir.c_str());
+
+	return result;
+}
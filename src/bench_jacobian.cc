@@ -0,0 +1,132 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <iostream>
+#include <cstdlib>
+
+#include "timer.h"
+
+#include "InverseKinematics.h"
+
+using namespace std;
+using namespace RigidBodyDynamics;
+using namespace RigidBodyDynamics::Math;
+
+/** Micro benchmark comparing ComputeMarkerJacobian() with the per marker
+ * evaluation of ComputeMarkerJacobianPointwise().
+ *
+ * The model roughly resembles a human: a floating base with five chains
+ * of revolute joints (two legs, two arms, head) and three markers on every
+ * body.
+ */
+
+const unsigned int chain_count = 5;
+const unsigned int chain_length = 4;
+const unsigned int markers_per_body = 3;
+
+void build_model (Model &model, std::vector<unsigned int> &body_ids, std::vector<Vector3d> &body_points) {
+	Body body (1., Vector3d (0., 0., -0.2), Vector3d (0.1, 0.1, 0.1));
+
+	unsigned int pelvis_trans = model.AddBody (0, Xtrans (Vector3d (0., 0., 0.)), Joint (JointTypeTranslationXYZ), Body(), "pelvis_trans");
+	unsigned int pelvis = model.AddBody (pelvis_trans, Xtrans (Vector3d (0., 0., 0.)), Joint (JointTypeEulerZYX), body, "pelvis");
+
+	Joint joint_rot_x (SpatialVector (1., 0., 0., 0., 0., 0.));
+	Joint joint_rot_y (SpatialVector (0., 1., 0., 0., 0., 0.));
+
+	std::vector<unsigned int> bodies (1, pelvis);
+
+	for (unsigned int c = 0; c < chain_count; c++) {
+		unsigned int parent = pelvis;
+		Vector3d offset (0.2 * c - 0.4, 0., 0.);
+
+		for (unsigned int l = 0; l < chain_length; l++) {
+			parent = model.AddBody (parent, Xtrans (offset), (l % 2 == 0) ? joint_rot_x : joint_rot_y, body);
+			bodies.push_back (parent);
+			offset = Vector3d (0., 0., -0.4);
+		}
+	}
+
+	for (unsigned int i = 0; i < bodies.size(); i++) {
+		for (unsigned int m = 0; m < markers_per_body; m++) {
+			body_ids.push_back (bodies[i]);
+			body_points.push_back (Vector3d (0.05 * m, 0.05, -0.1 * m));
+		}
+	}
+}
+
+int main (int argc, char* argv[]) {
+	unsigned int evaluations = 10000;
+	if (argc > 1)
+		evaluations = atoi (argv[1]);
+
+	Model model;
+	std::vector<unsigned int> body_ids;
+	std::vector<Vector3d> body_points;
+
+	build_model (model, body_ids, body_points);
+
+	std::vector<Vector3d> target_pos (body_ids.size(), Vector3d::Zero());
+
+	VectorNd Q = VectorNd::Zero (model.q_size);
+	for (unsigned int i = 0; i < Q.size(); i++) {
+		Q[i] = 0.1 * (i % 7) - 0.3;
+	}
+
+	IKWorkspace workspace;
+	workspace.resize (model.qdot_size, body_ids.size());
+
+	cout << "Model dofs: " << model.qdot_size << " markers: " << body_ids.size() << " evaluations: " << evaluations << endl;
+
+	TimerInfo timer;
+
+	timer_start (&timer);
+	for (unsigned int i = 0; i < evaluations; i++) {
+		ComputeMarkerJacobianPointwise (model, Q, body_ids, body_points, target_pos, workspace);
+	}
+	double duration_pointwise = timer_stop (&timer);
+	MatrixNd J_pointwise = workspace.J;
+	VectorNd e_pointwise = workspace.e;
+
+	timer_start (&timer);
+	for (unsigned int i = 0; i < evaluations; i++) {
+		ComputeMarkerJacobian (model, Q, body_ids, body_points, target_pos, workspace);
+	}
+	double duration_batched = timer_stop (&timer);
+
+	double jacobian_error = (workspace.J - J_pointwise).cwiseAbs().maxCoeff();
+	double residual_error = (workspace.e - e_pointwise).cwiseAbs().maxCoeff();
+
+	cout << "pointwise: " << duration_pointwise * 1.0e6 / evaluations << " us per evaluation" << endl;
+	cout << "batched  : " << duration_batched * 1.0e6 / evaluations << " us per evaluation" << endl;
+	cout << "speedup  : " << duration_pointwise / duration_batched << endl;
+	cout << "max deviation jacobian: " << jacobian_error << " residuals: " << residual_error << endl;
+
+	if (jacobian_error > 1.0e-10 || residual_error > 1.0e-10) {
+		cerr << "Error: batched and pointwise jacobians differ!" << endl;
+		return 1;
+	}
+
+	return 0;
+}
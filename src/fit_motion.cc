@@ -25,6 +25,16 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "timer.h"
 
@@ -51,12 +61,60 @@ MarkerData *data = NULL;
 Animation *animation = NULL;
 ModelFitter *fitter = NULL;
 string fitter_method = "sugihara";
+string data_filename = "";
+/// All c3d files of the command line and of --batch
+vector<string> data_filenames;
+string batch_path = "";
+string output_dir = "";
+bool thread_count_given = false;
 bool analyze_mode = false;
 unsigned int max_steps = 100;
+unsigned int thread_count = 1;
+unsigned int chunk_overlap = 50;
+StatePredictionMethod prediction_method = StatePredictionNone;
+FittingLog::Format log_format = FittingLog::FormatCSV;
+Animation::Format animation_format = Animation::FormatCSV;
+unsigned int keyframe_stride = 1;
+unsigned int refine_steps = 5;
+double interpolation_tolerance = 0.;
+string telemetry_filename = "";
+bool single_precision = false;
+
+/// Maximum deviation of two fits of the same frame for which we consider
+/// them to have converged to the same pose.
+const double seam_tolerance = 1.0e-4;
 
 void print_usage(const char* execname) {
-	cout << "Usage: " << execname << " <modelfile.lua> <mocapdata.c3d> [motion.csv] [--levenberg] [-s count]" << endl;
+	cout << "Usage: " << execname << " <modelfile.lua> <mocapdata.c3d> [motion.csv|motion.anim] [--levenberg|--sugiharats|--adaptive|--window] [-s count] [--threads count] [--overlap count] [--predict method] [--binary-log] [--binary-animation] [--stride count] [--refine-steps count] [--interpolate distance] [--telemetry file.csv] [--float]" << endl;
+	cout << "       " << execname << " <modelfile.lua> <trial1.c3d> <trial2.c3d> ... [options] [--output-dir dir]" << endl;
+	cout << "       " << execname << " <modelfile.lua> --batch <directory|trials.txt> [options] [--output-dir dir]" << endl;
 	cout << "-s count    : sets the maximum number of IK steps to count (default 200)." << endl;
+	cout << "--adaptive  : uses Levenberg Marquardt with adaptive damping." << endl;
+	cout << "--window    : fits windows of frames jointly with a smoothness term." << endl;
+	cout << "--threads count : fits the frames in count chunks in parallel (default 1). In" << endl
+		<< "                  batch mode the number of trials fitted in parallel (default" << endl
+		<< "                  number of cores)." << endl;
+	cout << "--batch path : fits all c3d files in the directory or listed (one per line)" << endl
+		<< "                  in the text file. Also used if multiple c3d files are given." << endl;
+	cout << "--output-dir dir : directory for the animation (<trial>_animation.csv) and" << endl
+		<< "                  the log (<trial>_fitting_log.csv) of every trial in batch" << endl
+		<< "                  mode (default: directory of the trial)." << endl;
+	cout << "--overlap count : number of frames each chunk is fitted ahead of its" << endl
+		<< "                  first frame to converge to the serial solution (default 50)." << endl;
+	cout << "--predict method : initial state of each frame: none (previous frame, default)," << endl
+		<< "                  velocity, acceleration or kalman." << endl;
+	cout << "--stride count : fits only every count-th frame to full tolerance and refines" << endl
+		<< "                  the interpolated frames in between (default 1)." << endl;
+	cout << "--refine-steps count : maximum IK steps of the interpolated frames (default 5)." << endl;
+	cout << "--interpolate distance : keeps the interpolated pose if all markers are within" << endl
+		<< "                  distance (in meters) of the data (default 0, always refine)." << endl;
+	cout << "--telemetry file : writes a summary of the per frame solver telemetry" << endl
+		<< "                  (time split into kinematics, jacobian and solve) to file." << endl;
+	cout << "--float : solves the IK normal equations in single precision." << endl;
+	cout << "--binary-log : writes the fitting log in the compact binary format to" << endl
+		<< "                  fitting_log.bin instead of fitting_log.csv." << endl;
+	cout << "--binary-animation : writes the animation in the binary format to" << endl
+		<< "                  animation.anim instead of animation.csv." << endl;
 	cout << "" << endl;
 	cout << "Note: when specifying motion file no inverse kinematics is performed. Instead it" << endl
 		<< "analyzes the the motion file and saves the result to the file fitting_log.csv" << endl;
@@ -73,15 +131,74 @@ bool parse_args (int argc, char* argv[]) {
 			}
 			i++;
 			continue;
+		} else if ((arg == "--threads") && (argc > i + 1)) {
+			istringstream convert (argv[i + 1]);
+			if (!(convert >> thread_count) || thread_count == 0) {
+				cerr << "Error: cannot parse number argument of --threads: " << argv[i+1] << endl;
+				return false;
+			}
+			thread_count_given = true;
+			i++;
+			continue;
+		} else if ((arg == "--batch") && (argc > i + 1)) {
+			batch_path = argv[i + 1];
+			i++;
+			continue;
+		} else if ((arg == "--output-dir") && (argc > i + 1)) {
+			output_dir = argv[i + 1];
+			i++;
+			continue;
+		} else if ((arg == "--overlap") && (argc > i + 1)) {
+			istringstream convert (argv[i + 1]);
+			if (!(convert >> chunk_overlap)) {
+				cerr << "Error: cannot parse number argument of --overlap: " << argv[i+1] << endl;
+				return false;
+			}
+			i++;
+			continue;
+		} else if ((arg == "--stride") && (argc > i + 1)) {
+			istringstream convert (argv[i + 1]);
+			if (!(convert >> keyframe_stride) || keyframe_stride == 0) {
+				cerr << "Error: cannot parse number argument of --stride: " << argv[i+1] << endl;
+				return false;
+			}
+			i++;
+			continue;
+		} else if ((arg == "--refine-steps") && (argc > i + 1)) {
+			istringstream convert (argv[i + 1]);
+			if (!(convert >> refine_steps)) {
+				cerr << "Error: cannot parse number argument of --refine-steps: " << argv[i+1] << endl;
+				return false;
+			}
+			i++;
+			continue;
+		} else if ((arg == "--interpolate") && (argc > i + 1)) {
+			istringstream convert (argv[i + 1]);
+			if (!(convert >> interpolation_tolerance)) {
+				cerr << "Error: cannot parse number argument of --interpolate: " << argv[i+1] << endl;
+				return false;
+			}
+			i++;
+			continue;
+		} else if ((arg == "--telemetry") && (argc > i + 1)) {
+			telemetry_filename = argv[i + 1];
+			i++;
+			continue;
+		} else if ((arg == "--predict") && (argc > i + 1)) {
+			if (!StatePredictor::parseMethod (argv[i + 1], &prediction_method)) {
+				cerr << "Error: unknown prediction method: " << argv[i+1] << endl;
+				return false;
+			}
+			i++;
+			continue;
 		} else if (arg.substr(arg.size() - 4, 4) == ".lua") {
 			model = new Model();
 			if (!model->loadFromFile (arg.c_str()))
 				return false;
 		} else if (arg.substr(arg.size() - 4, 4) == ".c3d") {
-			data = new MarkerData();
-			if(!data->loadFromFile (arg.c_str())) 
-				return false;
-		} else if (arg.substr(arg.size() - 4, 4) == ".csv") {
+			data_filenames.push_back (arg);
+		} else if (arg.substr(arg.size() - 4, 4) == ".csv"
+				|| Animation::formatFromFilename (arg) == Animation::FormatBinary) {
 			analyze_mode = true;
 			animation = new Animation();
 			animation->loadFromFile (arg.c_str());
@@ -89,27 +206,506 @@ bool parse_args (int argc, char* argv[]) {
 			fitter_method = "levenberg";
 		} else if (arg == "--sugiharats") {
 			fitter_method = "sugiharats";
+		} else if (arg == "--adaptive") {
+			fitter_method = "adaptive";
+		} else if (arg == "--window") {
+			fitter_method = "window";
+		} else if (arg == "--float") {
+			single_precision = true;
+		} else if (arg == "--binary-log") {
+			log_format = FittingLog::FormatBinary;
+		} else if (arg == "--binary-animation") {
+			animation_format = Animation::FormatBinary;
 		} else {
 			return false;
 		}
 	}
 
+	// a single trial is loaded right away, multiple ones are fitted in
+	// batch mode
+	if (data_filenames.size() == 1 && batch_path == "") {
+		data_filename = data_filenames[0];
+		data = new MarkerData();
+		if(!data->loadFromFile (data_filename.c_str())) 
+			return false;
+	}
+
+	return true;
+}
+
+ModelFitter* create_fitter (Model *fit_model, MarkerData *fit_data) {
+	ModelFitter *result = createModelFitter (fitter_method, fit_model, fit_data, max_steps);
+	result->predictor.method = prediction_method;
+	result->logFormat = log_format;
+	result->keyframeStride = keyframe_stride;
+	result->refineSteps = refine_steps;
+	result->interpolationTolerance = interpolation_tolerance;
+	result->setSinglePrecision (single_precision);
+	if (log_format == FittingLog::FormatBinary)
+		result->logFilename = "fitting_log.bin";
+
+	if (telemetry_filename != "") {
+		unsigned int frame_count = fit_data->getLastFrame() - fit_data->getFirstFrame() + 1;
+		result->enableTelemetry (frame_count, frame_count * 20);
+	}
+
+	return result;
+}
+
+/** A range of frames that is fitted by its own worker thread.
+ *
+ * The chunk starts fitting at frame_start which lies up to --overlap frames
+ * before owned_start. These warm-up frames let the fit converge to the
+ * same pose as a serial run would and only the frames in
+ * [owned_start, owned_end] end up in the final animation.
+ */
+struct FitChunk {
+	FitChunk() :
+		frame_start (0),
+		owned_start (0),
+		owned_end (0),
+		model (NULL),
+		data (NULL),
+		fitter (NULL),
+		result (false)
+	{}
+	~FitChunk() {
+		delete fitter;
+		delete data;
+		delete model;
+	}
+
+	int frame_start;
+	int owned_start;
+	int owned_end;
+	Model *model;
+	MarkerData *data;
+	ModelFitter *fitter;
+	Animation animation;
+	bool result;
+	std::string logFilename;
+
+	VectorNd& getPose (int frame) {
+		assert (frame >= frame_start && frame <= owned_end);
+		return animation.keyFrames[frame - frame_start].state;
+	}
+};
+
+void delete_chunks (std::vector<FitChunk*> &chunks) {
+	for (size_t ci = 0; ci < chunks.size(); ci++) {
+		delete chunks[ci];
+	}
+	chunks.clear();
+}
+
+void fit_chunk (FitChunk *chunk, VectorNd initial_state) {
+	chunk->result = chunk->fitter->computeModelAnimationFromMarkers (initial_state, &chunk->animation, chunk->frame_start, chunk->owned_end);
+}
+
+/** Merges the fitting logs of the chunks into a single log file.
+ *
+ * Only the rows of the frames owned by the chunks are used. Rows that
+ * appear in the repair log replace the rows of the chunks.
+ */
+void merge_fitting_logs (const std::vector<FitChunk*> &chunks, const std::string &repair_log_filename, const std::string &log_filename) {
+	int frame_first = data->getFirstFrame();
+	std::vector<std::string> marker_names;
+	std::map<int, FittingLogRow> rows;
+
+	for (size_t ci = 0; ci <= chunks.size(); ci++) {
+		bool is_repair_log = (ci == chunks.size());
+		std::string chunk_log_filename = is_repair_log ? repair_log_filename : chunks[ci]->logFilename;
+
+		std::vector<std::string> chunk_marker_names;
+		std::vector<FittingLogRow> chunk_rows;
+		if (!FittingLog::load (chunk_log_filename, chunk_marker_names, chunk_rows))
+			continue;
+
+		if (marker_names.size() == 0)
+			marker_names = chunk_marker_names;
+
+		for (size_t ri = 0; ri < chunk_rows.size(); ri++) {
+			int frame = chunk_rows[ri].frame;
+			if (is_repair_log 
+					|| (frame >= chunks[ci]->owned_start - frame_first && frame <= chunks[ci]->owned_end - frame_first))
+				rows[frame] = chunk_rows[ri];
+		}
+		remove (chunk_log_filename.c_str());
+	}
+
+	FittingLog log;
+	if (!log.open (log_filename, marker_names, fitter->logFormat))
+		return;
+
+	for (std::map<int, FittingLogRow>::iterator iter = rows.begin(); iter != rows.end(); iter++) {
+		log.addRow (iter->first, iter->second.steps, iter->second.residuals);
+	}
+	log.close();
+}
+
+/** Fits the animation in thread_count chunks that are processed in parallel.
+ *
+ * Each chunk uses its own copy of the model and marker data. After all
+ * chunks are fitted the seams are checked: if the warm-up of a chunk did
+ * not converge to the pose of the previous chunk, its frames get refitted
+ * serially starting from the pose of the previous chunk until the result
+ * coincides with the parallel fit.
+ */
+bool compute_chunked_animation (Animation *result_animation) {
+	int frame_first = data->getFirstFrame();
+	int frame_last = data->getLastFrame();
+	int frame_count = frame_last - frame_first + 1;
+	int chunk_count = std::min (static_cast<int>(thread_count), frame_count);
+
+	std::vector<FitChunk*> chunks;
+	for (int ci = 0; ci < chunk_count; ci++) {
+		FitChunk *chunk = new FitChunk();
+		chunk->owned_start = frame_first + (ci * frame_count) / chunk_count;
+		chunk->owned_end = frame_first + ((ci + 1) * frame_count) / chunk_count - 1;
+		chunk->frame_start = std::max (frame_first, chunk->owned_start - static_cast<int>(chunk_overlap));
+		chunks.push_back (chunk);
+
+		// Lua states and the kinematic quantities of the RBDL model must not
+		// be shared between threads, therefore every chunk gets its own copy.
+		chunk->model = new Model();
+		chunk->data = new MarkerData();
+		if (!chunk->model->loadFromModel (*model)
+				|| !chunk->data->loadFromFile (data_filename.c_str())) {
+			delete_chunks (chunks);
+			return false;
+		}
+
+		ostringstream log_filename;
+		log_filename << fitter->logFilename << ".chunk" << ci;
+		chunk->logFilename = log_filename.str();
+		remove (chunk->logFilename.c_str());
+
+		chunk->fitter = create_fitter (chunk->model, chunk->data);
+		chunk->fitter->logFilename = chunk->logFilename;
+	}
+
+	std::vector<std::thread> workers;
+	for (int ci = 0; ci < chunk_count; ci++) {
+		workers.push_back (std::thread (fit_chunk, chunks[ci], model->modelStateQ));
+	}
+	for (size_t wi = 0; wi < workers.size(); wi++) {
+		workers[wi].join();
+	}
+
+	bool result = true;
+	for (int ci = 0; ci < chunk_count; ci++) {
+		result = result && chunks[ci]->result;
+		chunks[ci]->fitter->closeLog();
+	}
+
+	// reconcile the seams between the chunks
+	std::string log_filename = fitter->logFilename;
+	std::string repair_log_filename = log_filename + ".repair";
+	remove (repair_log_filename.c_str());
+	fitter->logFilename = repair_log_filename;
+
+	for (int ci = 1; ci < chunk_count; ci++) {
+		FitChunk *previous = chunks[ci - 1];
+		FitChunk *chunk = chunks[ci];
+
+		VectorNd current_state = previous->getPose (previous->owned_end);
+		if (chunk->frame_start < chunk->owned_start
+				&& (chunk->getPose(chunk->owned_start - 1) - current_state).norm() < seam_tolerance)
+			continue;
+
+		cout << "Reconciling seam at frame " << chunk->owned_start << endl;
+
+		int frame;
+		for (frame = chunk->owned_start; frame <= chunk->owned_end; frame++) {
+			Animation repair_animation;
+			if (!fitter->computeModelAnimationFromMarkers (current_state, &repair_animation, frame, frame)) 
+				result = false;
+
+			current_state = repair_animation.keyFrames[0].state;
+			bool converged = (chunk->getPose(frame) - current_state).norm() < seam_tolerance;
+			chunk->getPose(frame) = current_state;
+
+			if (converged)
+				break;
+		}
+
+		cout << "Refitted " << std::min (frame, chunk->owned_end) - chunk->owned_start + 1 << " frames" << endl;
+	}
+
+	fitter->closeLog();
+	fitter->logFilename = log_filename;
+	merge_fitting_logs (chunks, repair_log_filename, log_filename);
+
+	result_animation->reserve (chunks[chunk_count - 1]->owned_end - chunks[0]->owned_start + 1);
+
+	for (int ci = 0; ci < chunk_count; ci++) {
+		FitChunk *chunk = chunks[ci];
+		for (int frame = chunk->owned_start; frame <= chunk->owned_end; frame++) {
+			result_animation->addPose (chunk->animation.keyFrames[frame - chunk->frame_start].time, chunk->getPose(frame));
+		}
+
+		fitter->totalSteps += chunk->fitter->totalSteps;
+		fitter->totalFrameCount += chunk->fitter->totalFrameCount;
+		fitter->telemetry.mergeSummary (chunk->fitter->telemetry.getSummary());
+	}
+	delete_chunks (chunks);
+
+	return result;
+}
+
+/// A c3d file that is fitted in batch mode
+struct FitTrial {
+	FitTrial() :
+		size (0),
+		frameCount (0),
+		steps (0),
+		duration (0.),
+		result (false)
+	{}
+
+	std::string filename;
+	std::string outputStem;
+	/// File size, used to estimate the fitting time
+	off_t size;
+
+	int frameCount;
+	unsigned int steps;
+	double duration;
+	bool result;
+};
+
+/** Distributes the trials to the workers.
+ *
+ * Every worker has its own queue of trials. It takes trials from the front
+ * of its queue and, once it is empty, steals from the back of the queues
+ * of the other workers. The queues are filled round robin with the largest
+ * trials first, such that the long trials start early and the short ones
+ * at the end fill the gaps.
+ */
+struct TrialPool {
+	struct Queue {
+		std::mutex mutex;
+		std::deque<FitTrial*> trials;
+	};
+
+	TrialPool (unsigned int worker_count) :
+		queues (worker_count)
+	{}
+
+	void add (const std::vector<FitTrial*> &trials) {
+		for (size_t ti = 0; ti < trials.size(); ti++)
+			queues[ti % queues.size()].trials.push_back (trials[ti]);
+	}
+
+	/// Returns the next trial of the worker or NULL if all are taken
+	FitTrial* next (unsigned int worker) {
+		for (unsigned int qi = 0; qi < queues.size(); qi++) {
+			Queue &queue = queues[(worker + qi) % queues.size()];
+			std::lock_guard<std::mutex> lock (queue.mutex);
+
+			if (queue.trials.empty())
+				continue;
+
+			FitTrial *result = NULL;
+			if (qi == 0) {
+				result = queue.trials.front();
+				queue.trials.pop_front();
+			} else {
+				result = queue.trials.back();
+				queue.trials.pop_back();
+			}
+
+			return result;
+		}
+
+		return NULL;
+	}
+
+	std::vector<Queue> queues;
+};
+
+std::mutex output_mutex;
+
+void fit_trial (FitTrial *trial, Model *trial_model) {
+	MarkerData trial_data;
+	if (!trial_data.loadFromFile (trial->filename.c_str()))
+		return;
+
+	trial->frameCount = trial_data.getLastFrame() - trial_data.getFirstFrame() + 1;
+
+	ModelFitter *trial_fitter = create_fitter (trial_model, &trial_data);
+	trial_fitter->logFilename = trial->outputStem + (log_format == FittingLog::FormatBinary ? "_fitting_log.bin" : "_fitting_log.csv");
+
+	Animation trial_animation;
+	TimerInfo timer;
+	timer_start (&timer);
+	trial->result = trial_fitter->computeModelAnimationFromMarkers (trial_model->modelStateQ, &trial_animation, trial_data.getFirstFrame(), trial_data.getLastFrame());
+	trial_fitter->closeLog();
+	trial->duration = timer_stop (&timer);
+	trial->steps = trial_fitter->totalSteps;
+
+	trial_animation.stateNames = trial_model->getModelStateNames();
+	trial_animation.saveToFile ((trial->outputStem + (animation_format == Animation::FormatBinary ? "_animation.anim" : "_animation.csv")).c_str(), animation_format);
+	if (telemetry_filename != "")
+		trial_fitter->telemetry.saveSummary (trial->outputStem + "_telemetry.csv");
+
+	delete trial_fitter;
+
+	std::lock_guard<std::mutex> lock (output_mutex);
+	cout << trial->filename << ": " << trial->frameCount << " frames in " << trial->duration << "s, "
+		<< trial->steps << " IK steps" << (trial->result ? "" : " (fit failed)") << endl;
+}
+
+void fit_trials (TrialPool *pool, unsigned int worker, Model *worker_model) {
+	FitTrial *trial = NULL;
+	while ((trial = pool->next (worker)) != NULL) {
+		fit_trial (trial, worker_model);
+	}
+}
+
+/// Adds the c3d files of a directory or of a text file with one path per line
+bool collect_batch_filenames (const std::string &path, std::vector<std::string> &filenames) {
+	DIR *dir = opendir (path.c_str());
+	if (dir) {
+		std::vector<std::string> dir_filenames;
+		struct dirent *entry;
+		while ((entry = readdir (dir)) != NULL) {
+			std::string name (entry->d_name);
+			if (name.size() > 4 && name.substr (name.size() - 4, 4) == ".c3d")
+				dir_filenames.push_back (path + "/" + name);
+		}
+		closedir (dir);
+
+		std::sort (dir_filenames.begin(), dir_filenames.end());
+		filenames.insert (filenames.end(), dir_filenames.begin(), dir_filenames.end());
+		return true;
+	}
+
+	ifstream list_file (path.c_str());
+	if (!list_file) {
+		cerr << "Error: could not open batch directory or list " << path << endl;
+		return false;
+	}
+
+	std::string line;
+	while (getline (list_file, line)) {
+		line = line.substr (0, line.find_last_not_of (" \t\r") + 1);
+		if (line.size() > 0 && line[0] != '#')
+			filenames.push_back (line);
+	}
+
 	return true;
 }
 
+/** Fits all trials of data_filenames with the model that was loaded once.
+ *
+ * Each worker thread fits its trials with its own copy of the model, which
+ * is made from the already parsed model instead of the file.
+ */
+bool compute_batch () {
+	std::vector<FitTrial*> trials;
+	for (size_t fi = 0; fi < data_filenames.size(); fi++) {
+		struct stat file_stat;
+		if (stat (data_filenames[fi].c_str(), &file_stat) != 0) {
+			cerr << "Warning: skipping missing trial " << data_filenames[fi] << endl;
+			continue;
+		}
+
+		FitTrial *trial = new FitTrial();
+		trial->filename = data_filenames[fi];
+		trial->size = file_stat.st_size;
+
+		std::string stem = trial->filename.substr (0, trial->filename.size() - 4);
+		if (output_dir != "") {
+			size_t separator = stem.find_last_of ('/');
+			stem = output_dir + "/" + (separator == std::string::npos ? stem : stem.substr (separator + 1));
+		}
+		trial->outputStem = stem;
+
+		trials.push_back (trial);
+	}
+
+	if (trials.size() == 0) {
+		cerr << "Error: no trials to fit!" << endl;
+		return false;
+	}
+
+	// largest first for load balancing
+	std::vector<FitTrial*> sorted_trials (trials);
+	std::stable_sort (sorted_trials.begin(), sorted_trials.end(), [] (const FitTrial *a, const FitTrial *b) {
+		return a->size > b->size;
+	});
+
+	unsigned int worker_count = thread_count;
+	if (!thread_count_given)
+		worker_count = std::max (std::thread::hardware_concurrency(), 1u);
+	worker_count = std::min (worker_count, static_cast<unsigned int>(trials.size()));
+
+	TrialPool pool (worker_count);
+	pool.add (sorted_trials);
+
+	// the copies are made here as serializing the Lua state of the model
+	// is not thread safe
+	std::vector<Model*> worker_models;
+	for (unsigned int wi = 0; wi < worker_count; wi++) {
+		Model *worker_model = new Model();
+		worker_model->loadFromModel (*model);
+		worker_models.push_back (worker_model);
+	}
+
+	cout << "Fitting " << trials.size() << " trials with " << worker_count << " threads" << endl;
+
+	TimerInfo timer;
+	timer_start (&timer);
+
+	std::vector<std::thread> workers;
+	for (unsigned int wi = 0; wi < worker_count; wi++) {
+		workers.push_back (std::thread (fit_trials, &pool, wi, worker_models[wi]));
+	}
+	for (size_t wi = 0; wi < workers.size(); wi++) {
+		workers[wi].join();
+	}
+
+	bool result = true;
+	unsigned int failed_count = 0;
+	int total_frames = 0;
+	for (size_t ti = 0; ti < trials.size(); ti++) {
+		if (!trials[ti]->result) {
+			result = false;
+			failed_count++;
+		}
+		total_frames += trials[ti]->frameCount;
+		delete trials[ti];
+	}
+
+	for (unsigned int wi = 0; wi < worker_count; wi++) {
+		delete worker_models[wi];
+	}
+
+	cout << "Duration: " << timer_stop (&timer) << " for " << total_frames << " frames of " << trials.size() << " trials";
+	if (failed_count > 0)
+		cout << ", " << failed_count << " failed";
+	cout << endl;
+
+	return result;
+}
+
 int main (int argc, char* argv[]) {
 	parse_args (argc, argv);
 
+	if (model && batch_path != "" && !collect_batch_filenames (batch_path, data_filenames))
+		return 1;
+
+	if (model && !data && data_filenames.size() > 0 && !analyze_mode) {
+		bool result = compute_batch();
+		delete model;
+		return result ? 0 : 1;
+	}
+
 	if (!model || !data)
 		print_usage(argv[0]);
 
-	if (fitter_method == "sugihara") {
-		fitter = new SugiharaFitter(model, data, max_steps);
-	} else if (fitter_method == "sugiharats") {
-		fitter = new SugiharaTaskSpaceFitter(model, data, max_steps);
-	} else {
-		fitter = new LevenbergMarquardtFitter (model, data, max_steps);
-	}
+	fitter = create_fitter (model, data);
 
 	if (analyze_mode) {
 		fitter->analyzeAnimation (*animation);
@@ -121,20 +717,38 @@ int main (int argc, char* argv[]) {
 	TimerInfo timer;
 
 	timer_start(&timer);
-	bool result = fitter->computeModelAnimationFromMarkers (model->modelStateQ, animation, data->getFirstFrame(), data->getLastFrame());
+	bool result = false;
+	if (thread_count > 1) {
+		result = compute_chunked_animation (animation);
+	} else {
+		result = fitter->computeModelAnimationFromMarkers (model->modelStateQ, animation, data->getFirstFrame(), data->getLastFrame());
+		fitter->closeLog();
+	}
 	cout << "Duration: " << timer_stop(&timer) << endl;
+	if (fitter->totalFrameCount > 0) {
+		cout << "IK steps: " << fitter->totalSteps << " for " << fitter->totalFrameCount << " fitted frames ("
+			<< static_cast<double>(fitter->totalSteps) / fitter->totalFrameCount << " per frame)" << endl;
+	}
+
+	if (telemetry_filename != "") {
+		const FitTelemetrySummary &summary = fitter->telemetry.getSummary();
+		cout << "Time in kinematics: " << summary.kinematicsTime << " jacobians: " << summary.jacobianTime << " solves: " << summary.solveTime << endl;
+		cout << "Slowest frame: " << summary.slowestFrame << " (" << summary.maxFrameTime << "s) most steps: " << summary.maxStepsFrame << " (" << summary.maxSteps << ")" << endl;
+		fitter->telemetry.saveSummary (telemetry_filename);
+	}
 
 	if (!result) {
 		cout << "Fit failed!" << endl;
 	} else {
 		cout << "Fit successful!" << endl;
 	}
-	animation->saveToFile ("animation.csv");
+	animation->stateNames = model->getModelStateNames();
+	animation->saveToFile (animation_format == Animation::FormatBinary ? "animation.anim" : "animation.csv", animation_format);
 
 	delete fitter;
 	delete animation;
 	delete model;
 	delete data;
 
-	return result;
+	return result ? 0 : 1;
 }
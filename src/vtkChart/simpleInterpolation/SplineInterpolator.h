@@ -9,7 +9,7 @@
 #include <sstream>
 #include <string>
 
-#include "string_utils.h"
+#include "CSVReader.h"
 
 template <typename VectorType>
 struct SplineInterpolator {
@@ -51,8 +51,9 @@ struct SplineInterpolator {
 
 template <typename VectorType>
 inline bool SplineInterpolator<VectorType>::generateFromCSV (const char* filename) {
-	std::ifstream infile (filename);
-	if (!infile) {
+	CSVReader csv_reader;
+	csv_reader.skipNonNumericRows = false;
+	if (!csv_reader.load (filename)) {
 		std::cerr << "Error spline input file from '" << filename << "'" << std::endl;
 		abort();
 		return false;
@@ -61,46 +62,19 @@ inline bool SplineInterpolator<VectorType>::generateFromCSV (const char* filenam
 	t_values.clear();
 	p_values.clear();
 
-	int line_index = 0;
-	std::string line;
-	std::string previous_line;
+	for (size_t ri = 0; ri < csv_reader.getRowCount(); ri++) {
+		const double *row = csv_reader.getRow (ri);
+		size_t column_count = csv_reader.getColumnCount (ri);
 
-	while (!infile.eof()) {
-		previous_line = line;
-		getline (infile, line);
-
-		if (infile.eof()) {
-			break;
-		} else {
-			line_index++;
-		}
-
-		std::vector<std::string> tokens = tokenize_csv_strip_whitespaces (line);
-		if (tokens.size() == 0)
-			continue;
-
-		VectorType state = VectorType::Zero (tokens.size() - 1);
-		for (size_t i = 0; i < tokens.size(); i++) {
-			double value;
-			std::stringstream value_stream (tokens[i]);
-			if (!(value_stream >> value)) {
-				std::cerr << "Error: could not convert std::string '" << tokens[i] << "' to number in " << filename << ", line " << line_index << ", column " << i << std::endl;
-				abort();
-			}
-
-			if (i == 0)
-				t_values.push_back(value);
-			else {
-				state[i - 1] = value;
-			}
+		VectorType state = VectorType::Zero (column_count - 1);
+		for (size_t i = 1; i < column_count; i++) {
+			state[i - 1] = row[i];
 		}
 
+		t_values.push_back(row[0]);
 		p_values.push_back(state);
-//		std::cout << " At t = " << t_values[t_values.size() - 1] << " added " << p_values[p_values.size() - 1].transpose() << std::endl;
 	}
 
-	infile.close();
-
 	initialized = false;
 
 	return true;
@@ -29,6 +29,8 @@
 #include "Animation.h"
 
 #include <iostream>
+#include <cstdio>
+#include <stdint.h>
 
 using namespace std;
 
@@ -97,6 +99,52 @@ TEST ( TestAnimationAddThreePoses ) {
 	CHECK_EQUAL (pose1, animation.keyFrames[2].state);	
 }
 
+TEST ( TestAnimationAddPoseBeforeFirst ) {
+	Animation animation;
+
+	VectorNd pose0 (1);
+	pose0 << 0.;
+	VectorNd pose1 (1);
+	pose1 << 1.;
+	VectorNd pose2 (1);
+	pose2 << 2.;
+
+	animation.addPose (2., pose2);
+	animation.addPose (0., pose0);
+	animation.addPose (1., pose1);
+
+	CHECK_EQUAL (3, animation.keyFrames.size());
+	CHECK_EQUAL (0., animation.keyFrames[0].time);
+	CHECK_EQUAL (1., animation.keyFrames[1].time);
+	CHECK_EQUAL (2., animation.keyFrames[2].time);
+	CHECK_EQUAL (pose1, animation.keyFrames[1].state);
+}
+
+TEST ( TestAnimationAddPoses ) {
+	Animation animation;
+
+	VectorNd pose_a (1);
+	pose_a << 1.;
+	VectorNd pose_b (1);
+	pose_b << 2.;
+
+	vector<AnimationKeyFrame> poses;
+	for (int i = 0; i < 10; i++) {
+		poses.push_back (AnimationKeyFrame ((i * 7) % 10, pose_a));
+	}
+	// same time as an existing keyframe is added after it
+	poses.push_back (AnimationKeyFrame (3., pose_b));
+
+	animation.addPoses (poses);
+
+	CHECK_EQUAL (11, animation.keyFrames.size());
+	for (size_t i = 1; i < animation.keyFrames.size(); i++) {
+		CHECK (animation.keyFrames[i - 1].time <= animation.keyFrames[i].time);
+	}
+	CHECK_EQUAL (3., animation.keyFrames[4].time);
+	CHECK_EQUAL (pose_b, animation.keyFrames[4].state);
+}
+
 TEST ( TestAnimationGetInterpolated ) {
 	Animation animation;
 
@@ -129,3 +177,107 @@ TEST ( TestAnimationGetInterpolated ) {
 	pose = animation.getCurrentPose();
 	CHECK_EQUAL (pose_5, pose);
 }
+
+static void fill_test_animation (Animation &animation, int frame_count) {
+	for (int i = 0; i < frame_count; i++) {
+		VectorNd pose (3);
+		pose << 0.1 * i, -0.25 * i, 1. / (i + 1);
+		animation.addPose (i / 100., pose);
+	}
+}
+
+TEST ( TestAnimationSaveLoadBinary ) {
+	const char *filename = "animation_test.anim";
+	Animation animation;
+	fill_test_animation (animation, 50);
+	animation.stateNames.push_back ("pelvis_x");
+	animation.stateNames.push_back ("pelvis_y");
+	animation.stateNames.push_back ("knee_rot_y");
+
+	CHECK_EQUAL (Animation::FormatBinary, Animation::formatFromFilename (filename));
+	CHECK (animation.saveToFile (filename, Animation::FormatBinary));
+
+	Animation loaded;
+	CHECK (loaded.loadFromFile (filename));
+	CHECK_EQUAL (animation.keyFrames.size(), loaded.keyFrames.size());
+	CHECK_EQUAL (3u, loaded.stateNames.size());
+	CHECK_EQUAL (string ("knee_rot_y"), loaded.stateNames[2]);
+
+	for (size_t i = 0; i < animation.keyFrames.size(); i++) {
+		CHECK (animation.keyFrames[i] == loaded.keyFrames[i]);
+	}
+
+	remove (filename);
+}
+
+TEST ( TestAnimationSaveLoadBinarySinglePrecision ) {
+	const char *filename = "animation_test.anim";
+	Animation animation;
+	fill_test_animation (animation, 50);
+
+	CHECK (animation.saveToFile (filename, Animation::FormatBinary, true));
+
+	Animation loaded;
+	CHECK (loaded.loadFromFile (filename));
+	CHECK_EQUAL (animation.keyFrames.size(), loaded.keyFrames.size());
+	CHECK_EQUAL (0u, loaded.stateNames.size());
+
+	for (size_t i = 0; i < animation.keyFrames.size(); i++) {
+		CHECK_EQUAL (animation.keyFrames[i].time, loaded.keyFrames[i].time);
+		CHECK_ARRAY_CLOSE (animation.keyFrames[i].state.data(), loaded.keyFrames[i].state.data(), 3, TEST_PREC);
+	}
+
+	remove (filename);
+}
+
+/// Overwrites the value at offset of a saved binary animation
+template <typename T>
+static void patch_binary_animation (const char *filename, long offset, T value) {
+	FILE *anim_file = fopen (filename, "r+b");
+	fseek (anim_file, offset, SEEK_SET);
+	fwrite (&value, sizeof (value), 1, anim_file);
+	fclose (anim_file);
+}
+
+TEST ( TestAnimationLoadBinaryCorruptHeader ) {
+	const char *filename = "animation_test.anim";
+	Animation animation;
+	fill_test_animation (animation, 50);
+
+	// keyFrameCount * 32 bytes per frame overflows to a small size
+	CHECK (animation.saveToFile (filename, Animation::FormatBinary));
+	patch_binary_animation (filename, 16, (static_cast<uint64_t>(1) << 59) + 1);
+
+	Animation loaded;
+	CHECK (!loaded.loadFromFile (filename));
+	CHECK_EQUAL (0u, loaded.keyFrames.size());
+
+	// state count that does not fit into the file
+	CHECK (animation.saveToFile (filename, Animation::FormatBinary));
+	patch_binary_animation (filename, 8, static_cast<uint32_t>(0x40000000));
+
+	CHECK (!loaded.loadFromFile (filename));
+	CHECK_EQUAL (0u, loaded.keyFrames.size());
+
+	remove (filename);
+}
+
+TEST ( TestAnimationSaveLoadCSV ) {
+	const char *filename = "animation_test.csv";
+	Animation animation;
+	fill_test_animation (animation, 20);
+
+	CHECK_EQUAL (Animation::FormatCSV, Animation::formatFromFilename (filename));
+	animation.saveToFile (filename);
+
+	Animation loaded;
+	CHECK (loaded.loadFromFile (filename));
+	CHECK_EQUAL (animation.keyFrames.size(), loaded.keyFrames.size());
+
+	for (size_t i = 0; i < animation.keyFrames.size(); i++) {
+		CHECK_CLOSE (animation.keyFrames[i].time, loaded.keyFrames[i].time, TEST_PREC);
+		CHECK_ARRAY_CLOSE (animation.keyFrames[i].state.data(), loaded.keyFrames[i].state.data(), 3, TEST_PREC);
+	}
+
+	remove (filename);
+}
@@ -0,0 +1,208 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "C3DReader.h"
+#include "C3DWriter.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static const int test_point_count = 3;
+static const int test_frame_count = 20;
+
+static float test_coordinate (int frame, int point, int axis) {
+	return 100.f * point + 10.f * axis + frame * 0.5f;
+}
+
+/** Writes a file with three points (the second one is invalid in odd
+ * frames) and one analog sample per frame. */
+static void write_test_c3d (const char *filename, C3DReader::ProcessorType processor_type, bool float_format) {
+	C3DWriter writer (processor_type);
+	float scale = float_format ? -0.1f : 0.1f;
+
+	// header with the parameters in block 2 and the data in block 3
+	writer.bytes.push_back (2);
+	writer.bytes.push_back (0x50);
+	writer.addInt16 (test_point_count);
+	writer.addInt16 (1);
+	writer.addInt16 (1);
+	writer.addInt16 (test_frame_count);
+	writer.addInt16 (0);
+	writer.addFloat (scale);
+	writer.addInt16 (3);
+	writer.addInt16 (1);
+	writer.addFloat (200.f);
+	writer.pad();
+
+	writer.beginParameters();
+	writer.addGroup (1, "POINT");
+
+	writer.addParameter ("USED", 1, 2, 0, 1);
+	writer.addInt16 (test_point_count);
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("SCALE", 1, 4, 0, 1);
+	writer.addFloat (scale);
+	writer.bytes.push_back (0);
+
+	writer.addParameter ("LABELS", 1, -1, 4, test_point_count);
+	writer.bytes.insert (writer.bytes.end(), "LASIRASISAC ", "LASIRASISAC " + 12);
+	writer.bytes.push_back (0);
+
+	writer.endParameters();
+
+	for (int frame = 0; frame < test_frame_count; frame++) {
+		for (int point = 0; point < test_point_count; point++) {
+			bool valid = point != 1 || frame % 2 == 0;
+			for (int axis = 0; axis < 3; axis++) {
+				if (float_format)
+					writer.addFloat (test_coordinate (frame, point, axis));
+				else
+					writer.addInt16 (static_cast<int>(test_coordinate (frame, point, axis) / scale + 0.5f));
+			}
+
+			if (float_format)
+				writer.addFloat (valid ? 1.f : -1.f);
+			else
+				writer.addInt16 (valid ? 1 : -1);
+		}
+
+		// analog sample
+		if (float_format)
+			writer.addFloat (123.f);
+		else
+			writer.addInt16 (123);
+	}
+
+	writer.save (filename);
+}
+
+static void check_test_c3d (C3DReader::ProcessorType processor_type, bool float_format) {
+	const char *filename = "c3d_reader_test.c3d";
+	write_test_c3d (filename, processor_type, float_format);
+
+	C3DReader reader;
+	CHECK (reader.open (filename));
+	CHECK_EQUAL (processor_type, reader.processorType);
+	CHECK_EQUAL (float_format, reader.floatFormat);
+	CHECK_EQUAL (1, reader.firstFrame);
+	CHECK_EQUAL (test_frame_count, reader.lastFrame);
+	CHECK_EQUAL (test_point_count, static_cast<int>(reader.pointCount));
+	CHECK_CLOSE (200.f, reader.frameRate, 1.0e-4f);
+
+	CHECK_EQUAL (3u, reader.pointLabels.size());
+	CHECK_EQUAL (string ("LASI"), reader.pointLabels[0]);
+	CHECK_EQUAL (string ("SAC"), reader.pointLabels[2]);
+
+	float xyz[test_point_count * 3];
+	for (int frame = 0; frame < test_frame_count; frame++) {
+		reader.readFrame (frame, xyz);
+
+		for (int point = 0; point < test_point_count; point++) {
+			bool valid = point != 1 || frame % 2 == 0;
+			for (int axis = 0; axis < 3; axis++) {
+				CHECK_CLOSE (valid ? test_coordinate (frame, point, axis) : 0.f, xyz[point * 3 + axis], 0.06f);
+			}
+		}
+	}
+
+	unsigned int points[1] = { 2 };
+	reader.readPoints (5, points, 1, xyz);
+	CHECK_CLOSE (test_coordinate (5, 2, 1), xyz[1], 0.06f);
+
+	reader.close();
+	remove (filename);
+}
+
+TEST ( TestC3DReaderIntelInteger ) {
+	check_test_c3d (C3DReader::ProcessorIntel, false);
+}
+
+TEST ( TestC3DReaderIntelFloat ) {
+	check_test_c3d (C3DReader::ProcessorIntel, true);
+}
+
+TEST ( TestC3DReaderDEC ) {
+	check_test_c3d (C3DReader::ProcessorDEC, false);
+	check_test_c3d (C3DReader::ProcessorDEC, true);
+}
+
+TEST ( TestC3DReaderMIPS ) {
+	check_test_c3d (C3DReader::ProcessorMIPS, false);
+	check_test_c3d (C3DReader::ProcessorMIPS, true);
+}
+
+TEST ( TestC3DWriterPoints ) {
+	const char *filename = "c3d_writer_test.c3d";
+
+	vector<string> labels;
+	labels.push_back ("HEAD");
+	labels.push_back ("RKNE");
+	labels.push_back ("C7");
+
+	vector<float> xyz;
+	for (int frame = 0; frame < test_frame_count; frame++) {
+		for (int point = 0; point < 3; point++) {
+			for (int axis = 0; axis < 3; axis++)
+				xyz.push_back (test_coordinate (frame, point, axis));
+		}
+	}
+
+	CHECK (C3DWriter::writePoints (filename, labels, xyz, 150.f));
+
+	C3DReader reader;
+	CHECK (reader.open (filename));
+	CHECK_EQUAL (test_frame_count, reader.getFrameCount());
+	CHECK_EQUAL (3u, reader.pointLabels.size());
+	CHECK_EQUAL (string ("C7"), reader.pointLabels[2]);
+	CHECK_CLOSE (150.f, reader.frameRate, 1.0e-4f);
+	CHECK_EQUAL (1u, reader.getParameterStrings ("POINT", "UNITS").size());
+	CHECK_EQUAL (string ("mm"), reader.getParameterStrings ("POINT", "UNITS")[0]);
+
+	float frame_xyz[9];
+	reader.readFrame (test_frame_count - 1, frame_xyz);
+	CHECK_ARRAY_CLOSE (&xyz[(test_frame_count - 1) * 9], frame_xyz, 9, 1.0e-5f);
+
+	reader.close();
+	remove (filename);
+}
+
+TEST ( TestC3DReaderInvalidFile ) {
+	const char *filename = "c3d_reader_invalid.c3d";
+	FILE *c3d_file = fopen (filename, "wb");
+	fputs ("not a c3d file", c3d_file);
+	fclose (c3d_file);
+
+	C3DReader reader;
+	CHECK (!reader.open (filename));
+	CHECK (!reader.isOpen());
+
+	remove (filename);
+}
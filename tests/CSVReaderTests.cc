@@ -0,0 +1,140 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "CSVReader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <clocale>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+using namespace std;
+
+static void write_test_csv (const char *filename, const string &content) {
+	FILE *csv_file = fopen (filename, "wb");
+	fwrite (content.data(), 1, content.size(), csv_file);
+	fclose (csv_file);
+}
+
+TEST ( TestCSVReaderParseDouble ) {
+	const char *numbers[] = {
+		"0", "-1", "+2.5", "3.14159265358979", ".5", "7.", "-0.000123", "1e3", "1.5E-7",
+		"123456789012345678901234567890", "4.9e-320", "1.7976931348623157e308", "0.1"
+	};
+
+	for (size_t i = 0; i < sizeof (numbers) / sizeof (numbers[0]); i++) {
+		const char *number = numbers[i];
+		double value = 0.;
+		CHECK (CSVReader::parseDouble (number, number + string (number).size(), value));
+		CHECK_EQUAL (strtod (number, NULL), value);
+	}
+
+	const char *invalid[] = { "", "-", ".", "abc", "1.2.3", "1e", "2x", "e5" };
+	for (size_t i = 0; i < sizeof (invalid) / sizeof (invalid[0]); i++) {
+		const char *number = invalid[i];
+		double value = 0.;
+		CHECK (!CSVReader::parseDouble (number, number + string (number).size(), value));
+	}
+}
+
+TEST ( TestCSVReaderSkipsHeaderRows ) {
+	const char *filename = "csv_reader_test.csv";
+	write_test_csv (filename, "time, q0, q1\n\n0, 1.5, -2\r\n0.1,\t2.5, -3\n  0.2 3.5 -4");
+
+	CSVReader reader;
+	CHECK (reader.load (filename));
+	CHECK_EQUAL (3u, reader.getRowCount());
+	CHECK_EQUAL (3u, reader.getColumnCount (2));
+	CHECK_EQUAL (0.1, reader.getRow (1)[0]);
+	CHECK_EQUAL (2.5, reader.getRow (1)[1]);
+	CHECK_EQUAL (-4., reader.getRow (2)[2]);
+
+	remove (filename);
+}
+
+TEST ( TestCSVReaderEmptyField ) {
+	const char *filename = "csv_reader_test.csv";
+	write_test_csv (filename, "0, 1.5, 2\n0.1, , 2.5\n");
+
+	CSVReader reader;
+	CHECK (!reader.load (filename));
+	CHECK_EQUAL (2, reader.errorLine);
+	CHECK_EQUAL (1, reader.errorColumn);
+	CHECK_EQUAL (0u, reader.getRowCount());
+
+	// a comma at the end of the line does not start a new field
+	write_test_csv (filename, "0, 1.5, 2,\n");
+	CHECK (reader.load (filename));
+	CHECK_EQUAL (1u, reader.getRowCount());
+	CHECK_EQUAL (3u, reader.getColumnCount (0));
+
+	remove (filename);
+}
+
+TEST ( TestCSVReaderParseDoubleLocale ) {
+	// long mantissas are not handled by the fast path and must not depend
+	// on the locale (e.g. decimal commas set by Qt)
+	const char *number = "0.12345678901234567890123";
+	std::string previous_locale = setlocale (LC_NUMERIC, NULL);
+	setlocale (LC_NUMERIC, "de_DE.UTF-8");
+
+	double value = 0.;
+	CHECK (CSVReader::parseDouble (number, number + strlen (number), value));
+	CHECK_CLOSE (0.12345678901234567890123, value, 1.0e-16);
+
+	setlocale (LC_NUMERIC, previous_locale.c_str());
+}
+
+TEST ( TestCSVReaderMultipleThreads ) {
+	const char *filename = "csv_reader_test.csv";
+	const int row_count = 1000;
+
+	string content = "time, value\n";
+	for (int i = 0; i < row_count; i++) {
+		char line[64];
+		snprintf (line, sizeof (line), "%d, %d.25, %d\n", i, i, (i % 3) + 1);
+		content += line;
+	}
+	write_test_csv (filename, content);
+
+	for (unsigned int thread_count = 1; thread_count < 8; thread_count++) {
+		CSVReader reader;
+		CHECK (reader.load (filename, thread_count));
+		CHECK_EQUAL (static_cast<size_t>(row_count), reader.getRowCount());
+
+		for (int i = 0; i < row_count; i++) {
+			CHECK_EQUAL (static_cast<size_t>(3), reader.getColumnCount (i));
+			CHECK_EQUAL (static_cast<double>(i), reader.getRow (i)[0]);
+			CHECK_EQUAL (i + 0.25, reader.getRow (i)[1]);
+			CHECK_EQUAL (static_cast<double>((i % 3) + 1), reader.getRow (i)[2]);
+		}
+	}
+
+	remove (filename);
+}
@@ -0,0 +1,122 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "FitTelemetry.h"
+
+#include <iostream>
+
+using namespace std;
+
+/// Records a frame with steps iterations whose norms encode the frame
+static void add_test_frame (FitTelemetry &telemetry, int frame, unsigned int steps) {
+	FrameTelemetry frame_telemetry;
+	frame_telemetry.frame = frame;
+	frame_telemetry.steps = steps;
+	frame_telemetry.success = frame % 3 != 0;
+	frame_telemetry.totalTime = 1.0e-3 * frame;
+	frame_telemetry.kinematicsTime = 1.0e-4 * frame;
+	frame_telemetry.jacobianTime = 2.0e-4 * frame;
+	frame_telemetry.solveTime = 3.0e-4 * frame;
+	frame_telemetry.residualNorm = 1. / (frame + 1);
+	frame_telemetry.firstIteration = telemetry.getIterationIndex();
+
+	for (unsigned int i = 0; i < steps; i++) {
+		telemetry.addIteration (frame + 0.1 * i, 0.01 * i);
+	}
+
+	frame_telemetry.iterationCount = steps;
+	telemetry.addFrame (frame_telemetry);
+}
+
+TEST ( TestFitTelemetryDisabled ) {
+	FitTelemetry telemetry;
+	CHECK (!telemetry.isEnabled());
+
+	add_test_frame (telemetry, 1, 4);
+	CHECK_EQUAL (0u, telemetry.getFrameCount());
+	CHECK_EQUAL (0u, telemetry.getSummary().frameCount);
+}
+
+TEST ( TestFitTelemetryRingBuffer ) {
+	FitTelemetry telemetry;
+	telemetry.reserve (4, 10);
+	CHECK (telemetry.isEnabled());
+
+	for (int frame = 0; frame < 6; frame++) {
+		add_test_frame (telemetry, frame, 3);
+	}
+
+	// only the last 4 frames and the iterations of the last 3 are kept
+	CHECK_EQUAL (4u, telemetry.getFrameCount());
+	CHECK_EQUAL (2, telemetry.getFrame (0).frame);
+	CHECK_EQUAL (5, telemetry.getFrame (3).frame);
+
+	vector<IterationTelemetry> iterations;
+	CHECK (!telemetry.getIterations (telemetry.getFrame (0), iterations));
+	CHECK (telemetry.getIterations (telemetry.getFrame (1), iterations));
+	CHECK_EQUAL (3u, iterations.size());
+	CHECK_CLOSE (3.2, iterations[2].residualNorm, 1.0e-12);
+	CHECK_CLOSE (0.02, iterations[2].stepNorm, 1.0e-12);
+
+	CHECK (telemetry.getIterations (telemetry.getFrame (3), iterations));
+	CHECK_CLOSE (5., iterations[0].residualNorm, 1.0e-12);
+
+	telemetry.clear();
+	CHECK_EQUAL (0u, telemetry.getFrameCount());
+}
+
+TEST ( TestFitTelemetrySummary ) {
+	FitTelemetry telemetry;
+	telemetry.reserve (2, 4);
+
+	for (int frame = 0; frame < 5; frame++) {
+		add_test_frame (telemetry, frame, frame == 2 ? 7 : 1);
+	}
+
+	// the summary includes the overwritten frames
+	const FitTelemetrySummary &summary = telemetry.getSummary();
+	CHECK_EQUAL (5u, summary.frameCount);
+	CHECK_EQUAL (2u, summary.failedFrameCount);
+	CHECK_EQUAL (11u, summary.totalSteps);
+	CHECK_EQUAL (7u, summary.maxSteps);
+	CHECK_EQUAL (2, summary.maxStepsFrame);
+	CHECK_CLOSE (10.0e-3, summary.totalTime, 1.0e-12);
+	CHECK_CLOSE (3.0e-3, summary.solveTime, 1.0e-12);
+	CHECK_EQUAL (4, summary.slowestFrame);
+	CHECK_EQUAL (0, summary.worstFrame);
+	CHECK_CLOSE (1., summary.maxResidualNorm, 1.0e-12);
+
+	FitTelemetry other;
+	other.reserve (1, 1);
+	add_test_frame (other, 10, 9);
+
+	telemetry.mergeSummary (other.getSummary());
+	CHECK_EQUAL (6u, telemetry.getSummary().frameCount);
+	CHECK_EQUAL (9u, telemetry.getSummary().maxSteps);
+	CHECK_EQUAL (10, telemetry.getSummary().slowestFrame);
+	CHECK_EQUAL (0, telemetry.getSummary().worstFrame);
+}
@@ -0,0 +1,164 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2015 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "FittingLog.h"
+
+#include <cstdio>
+#include <cstring>
+#include <clocale>
+#include <iostream>
+
+using namespace std;
+
+static vector<string> log_marker_names () {
+	vector<string> result;
+	result.push_back ("LASI");
+	result.push_back ("RASI");
+	result.push_back ("SACR");
+	return result;
+}
+
+static vector<double> log_residuals (double scale) {
+	vector<double> result (3);
+	result[0] = 0.25 * scale;
+	result[1] = 0.;
+	result[2] = 1.5e-3 * scale;
+	return result;
+}
+
+static void check_log_roundtrip (FittingLog::Format format, double prec) {
+	const char *filename = "fitting_log_test.log";
+	const int row_count = 1000;
+
+	FittingLog log;
+	CHECK (log.open (filename, log_marker_names(), format));
+	for (int i = 0; i < row_count; i++) {
+		log.addRow (i, i % 7, log_residuals (i));
+	}
+	log.close();
+	CHECK (!log.isOpen());
+
+	vector<string> marker_names;
+	vector<FittingLogRow> rows;
+	CHECK (FittingLog::load (filename, marker_names, rows));
+	remove (filename);
+
+	CHECK (log_marker_names() == marker_names);
+	CHECK_EQUAL (static_cast<size_t>(row_count), rows.size());
+
+	for (size_t i = 0; i < rows.size(); i++) {
+		CHECK_EQUAL (static_cast<int>(i), rows[i].frame);
+		CHECK_EQUAL (static_cast<unsigned int>(i % 7), rows[i].steps);
+		CHECK_ARRAY_CLOSE (&log_residuals (i)[0], &rows[i].residuals[0], 3, prec * i);
+	}
+}
+
+TEST ( TestFittingLogCSV ) {
+	// %g prints 6 significant digits
+	check_log_roundtrip (FittingLog::FormatCSV, 1.0e-5);
+}
+
+TEST ( TestFittingLogBinary ) {
+	check_log_roundtrip (FittingLog::FormatBinary, 1.0e-6);
+}
+
+TEST ( TestFittingLogAppend ) {
+	const char *filename = "fitting_log_append_test.csv";
+	remove (filename);
+
+	FittingLog log;
+	CHECK (log.open (filename, log_marker_names(), FittingLog::FormatCSV, true));
+	log.addRow (0, 1, log_residuals (1.));
+	log.close();
+
+	CHECK (log.open (filename, log_marker_names(), FittingLog::FormatCSV, true));
+	log.addRow (1, 2, log_residuals (2.));
+	log.flush();
+	log.addRow (2, 3, log_residuals (3.));
+	log.close();
+
+	vector<string> marker_names;
+	vector<FittingLogRow> rows;
+	CHECK (FittingLog::load (filename, marker_names, rows));
+	remove (filename);
+
+	CHECK_EQUAL (static_cast<size_t>(3), marker_names.size());
+	CHECK_EQUAL (static_cast<size_t>(3), rows.size());
+	CHECK_EQUAL (2, rows[2].frame);
+	CHECK_EQUAL (3u, rows[2].steps);
+}
+
+TEST ( TestFittingLogDecimalCommaLocale ) {
+	const char *filename = "fitting_log_locale_test.csv";
+	string previous_locale = setlocale (LC_NUMERIC, NULL);
+
+	const char *comma_locales[] = { "de_DE.UTF-8", "de_DE.utf8", "de_DE", "German_Germany.1252", NULL };
+	bool comma_locale_found = false;
+	for (int i = 0; comma_locales[i] != NULL; i++) {
+		if (setlocale (LC_NUMERIC, comma_locales[i]) && localeconv()->decimal_point[0] == ',') {
+			comma_locale_found = true;
+			break;
+		}
+	}
+
+	if (!comma_locale_found) {
+		setlocale (LC_NUMERIC, previous_locale.c_str());
+		cerr << "Warning: no locale with a decimal comma available, skipping " << __FUNCTION__ << endl;
+		return;
+	}
+
+	FittingLog log;
+	CHECK (log.open (filename, log_marker_names(), FittingLog::FormatCSV));
+	log.addRow (0, 1, log_residuals (1.));
+	log.close();
+
+	string text;
+	FILE *in = fopen (filename, "rb");
+	CHECK (in != NULL);
+	if (in) {
+		char buffer[256];
+		size_t count;
+		while ((count = fread (buffer, 1, sizeof (buffer), in)) > 0)
+			text.append (buffer, count);
+		fclose (in);
+	}
+	CHECK (strstr (text.c_str(), "0.25") != NULL);
+	CHECK (strstr (text.c_str(), "0,25") == NULL);
+
+	vector<string> marker_names;
+	vector<FittingLogRow> rows;
+	CHECK (FittingLog::load (filename, marker_names, rows));
+	remove (filename);
+
+	setlocale (LC_NUMERIC, previous_locale.c_str());
+
+	CHECK_EQUAL (static_cast<size_t>(1), rows.size());
+	if (rows.size() == 1) {
+		CHECK_EQUAL (static_cast<size_t>(3), rows[0].residuals.size());
+		CHECK_ARRAY_CLOSE (&log_residuals (1.)[0], &rows[0].residuals[0], 3, 1.0e-12);
+	}
+}
@@ -0,0 +1,123 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "InverseKinematics.h"
+
+#include <cstdlib>
+
+using namespace std;
+
+using namespace RigidBodyDynamics;
+using namespace RigidBodyDynamics::Math;
+
+/*
+ * Built as a separate executable (runallocationtests) as it replaces the
+ * global malloc, realloc and calloc through the glibc internals. Only the
+ * calls between the count_allocations toggles are counted.
+ *
+ * Note: this only covers the IK kernels. ModelFitter::run() still
+ * allocates per frame (e.g. ConvertVector() and setting up the marker
+ * targets).
+ */
+extern "C" void* __libc_malloc (size_t size);
+extern "C" void* __libc_realloc (void *ptr, size_t size);
+extern "C" void* __libc_calloc (size_t count, size_t size);
+
+static bool count_allocations = false;
+static size_t allocation_count = 0;
+
+extern "C" void* malloc (size_t size) __THROW {
+	if (count_allocations)
+		allocation_count++;
+	return __libc_malloc (size);
+}
+
+extern "C" void* realloc (void *ptr, size_t size) __THROW {
+	if (count_allocations)
+		allocation_count++;
+	return __libc_realloc (ptr, size);
+}
+
+extern "C" void* calloc (size_t count, size_t size) __THROW {
+	if (count_allocations)
+		allocation_count++;
+	return __libc_calloc (count, size);
+}
+
+TEST ( TestIKDoesNotAllocate ) {
+	Model model;
+	Body body (1., Vector3d (0., 0.5, 0.), Vector3d (1., 1., 1.));
+	Joint joint_rot_z (SpatialVector (0., 0., 1., 0., 0., 0.));
+	Joint joint_rot_x (SpatialVector (1., 0., 0., 0., 0., 0.));
+
+	unsigned int base_id = model.AddBody (0, Xtrans (Vector3d (0., 0., 0.)), joint_rot_z, body, "base");
+	unsigned int upper_id = model.AddBody (base_id, Xtrans (Vector3d (0., 1., 0.)), joint_rot_x, body, "upper");
+	unsigned int lower_id = model.AddBody (upper_id, Xtrans (Vector3d (0., 1., 0.)), joint_rot_z, body, "lower");
+
+	std::vector<unsigned int> body_ids;
+	std::vector<Vector3d> body_points;
+	body_ids.push_back (base_id);
+	body_points.push_back (Vector3d (0.2, 0.5, 0.));
+	body_ids.push_back (upper_id);
+	body_points.push_back (Vector3d (0., 0.5, 0.1));
+	body_ids.push_back (lower_id);
+	body_points.push_back (Vector3d (0.1, 0.5, 0.));
+	body_ids.push_back (lower_id);
+	body_points.push_back (Vector3d (0., 1., 0.));
+
+	VectorNd Q_target = VectorNd::Zero (model.q_size);
+	Q_target << 0.3, -0.2, 0.4;
+	UpdateKinematicsCustom (model, &Q_target, NULL, NULL);
+
+	std::vector<Vector3d> target_pos;
+	for (size_t i = 0; i < body_ids.size(); i++) {
+		target_pos.push_back (CalcBodyToBaseCoordinates (model, Q_target, body_ids[i], body_points[i], false));
+	}
+
+	VectorNd Qinit = VectorNd::Zero (model.q_size);
+	VectorNd Qres = VectorNd::Zero (model.q_size);
+	IKWorkspace workspace;
+	unsigned int steps = 0;
+
+	// first calls size the workspace
+	LevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 0.05, 100, &steps, workspace);
+	SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	SugiharaTaskSpaceIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	double damping = 0.;
+	AdaptiveLevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, damping, 100, &steps, workspace);
+
+	allocation_count = 0;
+	count_allocations = true;
+	LevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 0.05, 100, &steps, workspace);
+	SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	SugiharaTaskSpaceIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	damping = 0.;
+	AdaptiveLevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, damping, 100, &steps, workspace);
+	count_allocations = false;
+
+	CHECK_EQUAL (0u, allocation_count);
+}
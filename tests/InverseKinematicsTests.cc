@@ -0,0 +1,336 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "InverseKinematics.h"
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+using namespace RigidBodyDynamics;
+using namespace RigidBodyDynamics::Math;
+
+const double TEST_PREC = 1.0e-6;
+
+struct ChainFixture {
+	ChainFixture () {
+		Body body (1., Vector3d (0., 0.5, 0.), Vector3d (1., 1., 1.));
+		Joint joint_rot_z (SpatialVector (0., 0., 1., 0., 0., 0.));
+		Joint joint_rot_x (SpatialVector (1., 0., 0., 0., 0., 0.));
+
+		unsigned int base_id = model.AddBody (0, Xtrans (Vector3d (0., 0., 0.)), joint_rot_z, body, "base");
+		unsigned int upper_id = model.AddBody (base_id, Xtrans (Vector3d (0., 1., 0.)), joint_rot_x, body, "upper");
+		unsigned int lower_id = model.AddBody (upper_id, Xtrans (Vector3d (0., 1., 0.)), joint_rot_z, body, "lower");
+
+		body_ids.push_back (base_id);
+		body_points.push_back (Vector3d (0.2, 0.5, 0.));
+		body_ids.push_back (upper_id);
+		body_points.push_back (Vector3d (0., 0.5, 0.1));
+		body_ids.push_back (lower_id);
+		body_points.push_back (Vector3d (0.1, 0.5, 0.));
+		body_ids.push_back (lower_id);
+		body_points.push_back (Vector3d (0., 1., 0.));
+
+		Q_target = VectorNd::Zero (model.q_size);
+		Q_target << 0.3, -0.2, 0.4;
+		UpdateKinematicsCustom (model, &Q_target, NULL, NULL);
+
+		for (size_t i = 0; i < body_ids.size(); i++) {
+			target_pos.push_back (CalcBodyToBaseCoordinates (model, Q_target, body_ids[i], body_points[i], false));
+		}
+
+		Qinit = VectorNd::Zero (model.q_size);
+		Qres = VectorNd::Zero (model.q_size);
+	}
+
+	Model model;
+	std::vector<unsigned int> body_ids;
+	std::vector<Vector3d> body_points;
+	std::vector<Vector3d> target_pos;
+	VectorNd Q_target;
+	VectorNd Qinit;
+	VectorNd Qres;
+	IKWorkspace workspace;
+};
+
+TEST ( TestComputeMarkerJacobianMatchesPointwise ) {
+	Model model;
+	Body body (1., Vector3d (0., 0.5, 0.), Vector3d (1., 1., 1.));
+
+	unsigned int base_id = model.AddBody (0, Xtrans (Vector3d (0., 0., 0.)), Joint (JointTypeEulerZYX), body, "base");
+	unsigned int arm_id = model.AddBody (base_id, Xtrans (Vector3d (0., 1., 0.)), Joint (SpatialVector (0., 1., 0., 0., 0., 0.)), body, "arm");
+	unsigned int hand_id = model.AddBody (arm_id, Xtrans (Vector3d (0.3, 1., 0.)), Joint (JointTypeFixed), body, "hand");
+
+	std::vector<unsigned int> body_ids;
+	std::vector<Vector3d> body_points;
+	std::vector<Vector3d> target_pos;
+
+	body_ids.push_back (base_id);
+	body_points.push_back (Vector3d (0.1, 0.2, 0.3));
+	body_ids.push_back (arm_id);
+	body_points.push_back (Vector3d (-0.2, 0.5, 0.1));
+	body_ids.push_back (arm_id);
+	body_points.push_back (Vector3d (0.2, 0.7, 0.));
+	body_ids.push_back (hand_id);
+	body_points.push_back (Vector3d (0., 0.3, 0.2));
+
+	for (size_t i = 0; i < body_ids.size(); i++) {
+		target_pos.push_back (Vector3d (0.1 * i, 1., -0.5));
+	}
+
+	VectorNd Q (model.q_size);
+	Q << 0.3, -0.2, 0.4, 1.1;
+
+	IKWorkspace workspace;
+	workspace.resize (model.qdot_size, body_ids.size());
+
+	ComputeMarkerJacobianPointwise (model, Q, body_ids, body_points, target_pos, workspace);
+	MatrixNd J_pointwise = workspace.J;
+	VectorNd e_pointwise = workspace.e;
+
+	ComputeMarkerJacobian (model, Q, body_ids, body_points, target_pos, workspace);
+
+	CHECK_ARRAY_CLOSE (J_pointwise.data(), workspace.J.data(), J_pointwise.size(), TEST_PREC);
+	CHECK_ARRAY_CLOSE (e_pointwise.data(), workspace.e.data(), e_pointwise.size(), TEST_PREC);
+}
+
+TEST_FIXTURE ( ChainFixture, TestLevenbergMarquardtIK ) {
+	unsigned int steps = 0;
+	bool result = LevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 0.05, 100, &steps, workspace);
+
+	CHECK (result);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres.data(), Q_target.size(), TEST_PREC);
+}
+
+TEST_FIXTURE ( ChainFixture, TestSugiharaIK ) {
+	unsigned int steps = 0;
+	bool result = SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+
+	CHECK (result);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres.data(), Q_target.size(), TEST_PREC);
+}
+
+TEST_FIXTURE ( ChainFixture, TestSugiharaTaskSpaceIK ) {
+	unsigned int steps = 0;
+	bool result = SugiharaTaskSpaceIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+
+	CHECK (result);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres.data(), Q_target.size(), TEST_PREC);
+}
+
+TEST_FIXTURE ( ChainFixture, TestAdaptiveLevenbergMarquardtIK ) {
+	unsigned int steps = 0;
+	double damping = 0.;
+	bool result = AdaptiveLevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, damping, 100, &steps, workspace);
+
+	CHECK (result);
+	CHECK (damping > 0.);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres.data(), Q_target.size(), TEST_PREC);
+}
+
+TEST_FIXTURE ( ChainFixture, TestIKNormalSolvers ) {
+	VectorNd Qres_dynamic = VectorNd::Zero (model.q_size);
+	unsigned int steps_dynamic = 0;
+
+	IKWorkspace dynamic_workspace;
+	dynamic_workspace.useFixedSize = false;
+	SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres_dynamic, 1.0e-12, 100, &steps_dynamic, dynamic_workspace);
+	CHECK (!dynamic_workspace.normalSolver);
+
+	unsigned int steps = 0;
+	bool result = SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	CHECK (workspace.normalSolver);
+	CHECK (result);
+	CHECK_EQUAL (steps_dynamic, steps);
+	CHECK_ARRAY_CLOSE (Qres_dynamic.data(), Qres.data(), Q_target.size(), TEST_PREC);
+
+	// single precision solves still converge to the double precision result
+	workspace.precision = IKPrecisionFloat;
+	workspace.updateNormalSolver();
+	CHECK (workspace.normalSolver);
+
+	result = SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	CHECK (result);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres.data(), Q_target.size(), TEST_PREC);
+
+	workspace.useFixedSize = false;
+	workspace.updateNormalSolver();
+	CHECK (workspace.normalSolver);
+
+	double damping = 0.;
+	result = AdaptiveLevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, damping, 100, &steps, workspace);
+	CHECK (result);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres.data(), Q_target.size(), TEST_PREC);
+}
+
+TEST ( TestIKFixedSizeSolverFourDofs ) {
+	// 4 x 4 matrices are vectorized and need aligned allocations of the
+	// fixed size solver
+	Model model;
+	Body body (1., Vector3d (0., 0.5, 0.), Vector3d (1., 1., 1.));
+	Joint joint_rot_z (SpatialVector (0., 0., 1., 0., 0., 0.));
+	Joint joint_rot_x (SpatialVector (1., 0., 0., 0., 0., 0.));
+
+	std::vector<unsigned int> body_ids;
+	std::vector<Vector3d> body_points;
+	unsigned int parent_id = 0;
+	for (unsigned int i = 0; i < 4; i++) {
+		parent_id = model.AddBody (parent_id, Xtrans (Vector3d (0., i > 0 ? 1. : 0., 0.)), i % 2 == 0 ? joint_rot_z : joint_rot_x, body);
+		body_ids.push_back (parent_id);
+		body_points.push_back (Vector3d (0.1, 0.5, 0.));
+		body_ids.push_back (parent_id);
+		body_points.push_back (Vector3d (0., 1., 0.1));
+	}
+
+	VectorNd Q_target = VectorNd::Zero (model.q_size);
+	Q_target << 0.3, -0.2, 0.4, 0.1;
+	UpdateKinematicsCustom (model, &Q_target, NULL, NULL);
+
+	std::vector<Vector3d> target_pos;
+	for (size_t i = 0; i < body_ids.size(); i++) {
+		target_pos.push_back (CalcBodyToBaseCoordinates (model, Q_target, body_ids[i], body_points[i], false));
+	}
+
+	VectorNd Qinit = VectorNd::Zero (model.q_size);
+	VectorNd Qres = VectorNd::Zero (model.q_size);
+	unsigned int steps = 0;
+
+	IKWorkspace workspace;
+	workspace.resize (model.qdot_size, body_ids.size());
+	CHECK (workspace.normalSolver);
+#if defined(EIGEN_MAX_STATIC_ALIGN_BYTES) && EIGEN_MAX_STATIC_ALIGN_BYTES > 0
+	CHECK_EQUAL (0u, reinterpret_cast<size_t>(workspace.normalSolver.get()) % EIGEN_MAX_STATIC_ALIGN_BYTES);
+#endif
+
+	bool result = SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	CHECK (result);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres.data(), Q_target.size(), TEST_PREC);
+
+	workspace.precision = IKPrecisionFloat;
+	workspace.updateNormalSolver();
+	CHECK (workspace.normalSolver);
+
+	result = SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	CHECK (result);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres.data(), Q_target.size(), TEST_PREC);
+}
+
+TEST ( TestIKTaskSpaceFormulation ) {
+	// redundant chain with more degrees of freedom than marker coordinates
+	Model model;
+	Body body (1., Vector3d (0., 0.5, 0.), Vector3d (1., 1., 1.));
+	Joint joint_rot_z (SpatialVector (0., 0., 1., 0., 0., 0.));
+	Joint joint_rot_x (SpatialVector (1., 0., 0., 0., 0., 0.));
+
+	unsigned int body_id = 0;
+	for (unsigned int i = 0; i < 6; i++) {
+		body_id = model.AddBody (body_id, Xtrans (Vector3d (0., (i == 0) ? 0. : 0.5, 0.)), (i % 2 == 0) ? joint_rot_z : joint_rot_x, body);
+	}
+
+	std::vector<unsigned int> body_ids (1, body_id);
+	std::vector<Vector3d> body_points (1, Vector3d (0., 0.5, 0.));
+	std::vector<Vector3d> target_pos (1, Vector3d (0.8, 2., 0.6));
+
+	VectorNd Qinit = VectorNd::Constant (model.q_size, 0.1);
+	VectorNd Qres = VectorNd::Zero (model.q_size);
+	IKWorkspace workspace;
+	unsigned int steps = 0;
+
+	bool result = LevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 0.05, 100, &steps, workspace);
+	CHECK (workspace.useTaskSpace);
+	CHECK (result);
+	CHECK (workspace.e.norm() < TEST_PREC);
+
+	result = SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	CHECK (result);
+	CHECK (workspace.e.norm() < TEST_PREC);
+
+	result = SugiharaTaskSpaceIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, 100, &steps, workspace);
+	CHECK (result);
+	CHECK (workspace.e.norm() < TEST_PREC);
+
+	double damping = 0.;
+	result = AdaptiveLevenbergMarquardtIK (model, Qinit, body_ids, body_points, target_pos, Qres, 1.0e-12, damping, 100, &steps, workspace);
+	CHECK (result);
+	CHECK (workspace.e.norm() < TEST_PREC);
+}
+
+TEST ( TestIKTreeSparsity ) {
+	// a base with three branches of two bodies each
+	Model model;
+	Body body (1., Vector3d (0., 0.5, 0.), Vector3d (1., 1., 1.));
+	Joint joint_rot_z (SpatialVector (0., 0., 1., 0., 0., 0.));
+	Joint joint_rot_x (SpatialVector (1., 0., 0., 0., 0., 0.));
+
+	unsigned int base_id = model.AddBody (0, Xtrans (Vector3d (0., 0., 0.)), joint_rot_z, body);
+
+	std::vector<unsigned int> body_ids;
+	std::vector<Vector3d> body_points;
+
+	for (unsigned int b = 0; b < 3; b++) {
+		unsigned int upper_id = model.AddBody (base_id, Xtrans (Vector3d (0.3 * b, 0.5, 0.)), joint_rot_x, body);
+		unsigned int lower_id = model.AddBody (upper_id, Xtrans (Vector3d (0., 0.5, 0.)), joint_rot_z, body);
+
+		body_ids.push_back (upper_id);
+		body_points.push_back (Vector3d (0.1, 0.2, 0.));
+		body_ids.push_back (lower_id);
+		body_points.push_back (Vector3d (0., 0.5, 0.1));
+		body_ids.push_back (lower_id);
+		body_points.push_back (Vector3d (0.2, 0.3, 0.));
+	}
+
+	VectorNd Q_target (model.q_size);
+	Q_target << 0.2, 0.3, -0.4, 0.1, 0.5, -0.2, 0.3;
+
+	std::vector<Vector3d> target_pos;
+	UpdateKinematicsCustom (model, &Q_target, NULL, NULL);
+	for (size_t i = 0; i < body_ids.size(); i++) {
+		target_pos.push_back (CalcBodyToBaseCoordinates (model, Q_target, body_ids[i], body_points[i], false));
+	}
+
+	VectorNd Qinit = VectorNd::Zero (model.q_size);
+	VectorNd Qres_dense = VectorNd::Zero (model.q_size);
+	VectorNd Qres_tree = VectorNd::Zero (model.q_size);
+	unsigned int steps_dense = 0;
+	unsigned int steps_tree = 0;
+
+	IKWorkspace dense_workspace;
+	dense_workspace.treeFillThreshold = 0.;
+	SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres_dense, 1.0e-12, 100, &steps_dense, dense_workspace);
+	CHECK (!dense_workspace.useTreeSparsity);
+
+	IKWorkspace tree_workspace;
+	tree_workspace.treeFillThreshold = 1.;
+	bool result = SugiharaIK (model, Qinit, body_ids, body_points, target_pos, Qres_tree, 1.0e-12, 100, &steps_tree, tree_workspace);
+	CHECK (tree_workspace.useTreeSparsity);
+
+	CHECK (result);
+	CHECK_EQUAL (steps_dense, steps_tree);
+	CHECK_ARRAY_CLOSE (Q_target.data(), Qres_tree.data(), Q_target.size(), TEST_PREC);
+	CHECK_ARRAY_CLOSE (Qres_dense.data(), Qres_tree.data(), Q_target.size(), TEST_PREC);
+}
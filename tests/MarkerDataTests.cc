@@ -0,0 +1,137 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "Scene.h"
+#include "MarkerData.h"
+#include "C3DReader.h"
+#include "C3DWriter.h"
+
+#include <cstdio>
+#include <random>
+
+using namespace std;
+
+static const int test_marker_count = 5;
+static const int test_frame_count = 200;
+
+/// Writes a trial whose labels are not sorted such that the position
+/// cache of MarkerData uses a different marker order than the file
+static void write_test_trial (const char *filename, int frame_count) {
+	vector<string> labels;
+	labels.push_back ("RKNE");
+	labels.push_back ("LASI");
+	labels.push_back ("RASI");
+	labels.push_back ("LKNE");
+	labels.push_back ("C7");
+
+	vector<float> xyz;
+	for (int frame = 0; frame < frame_count; frame++) {
+		for (int marker = 0; marker < test_marker_count; marker++) {
+			xyz.push_back (100.f * marker + frame);
+			xyz.push_back (-2.f * frame);
+			xyz.push_back (1000.f + marker);
+		}
+	}
+
+	CHECK (C3DWriter::writePoints (filename, labels, xyz, 100.f));
+}
+
+TEST ( TestMarkerDataFrameWindow ) {
+	const char *filename = "marker_data_test.c3d";
+	write_test_trial (filename, test_frame_count);
+
+	C3DReader reader;
+	CHECK (reader.open (filename));
+
+	MarkerData data;
+	CHECK (data.loadFromFile (filename));
+	CHECK_EQUAL (static_cast<unsigned int>(test_marker_count), data.getMarkerCount());
+
+	// 25 blocks of which only 4 are kept
+	data.setFrameWindow (8, 4, 2);
+
+	vector<unsigned int> points (test_marker_count);
+	vector<int> indices (test_marker_count);
+	for (int pi = 0; pi < test_marker_count; pi++) {
+		points[pi] = pi;
+		indices[pi] = data.getMarkerHandle (reader.pointLabels[pi].c_str()).index;
+		CHECK (indices[pi] != -1);
+	}
+
+	std::mt19937 random_engine (1);
+	std::uniform_int_distribution<int> frame_distribution (0, test_frame_count - 1);
+
+	vector<float> expected (test_marker_count * 3);
+	vector<float> xyz;
+	int frame_index = 0;
+	for (int i = 0; i < 1000; i++) {
+		// random jumps with runs of consecutive frames in between that
+		// trigger the prefetching
+		frame_index = (i % 10 == 0) ? frame_distribution (random_engine) : (frame_index + 1) % test_frame_count;
+		int frame = data.getFirstFrame() + frame_index;
+
+		reader.readPoints (frame_index, points.data(), test_marker_count, expected.data());
+		data.getFramePositions (frame, xyz);
+
+		for (int pi = 0; pi < test_marker_count; pi++) {
+			Vector3f position = data.getMarkerPosition (indices[pi], frame);
+			for (int j = 0; j < 3; j++) {
+				CHECK_CLOSE (expected[pi * 3 + j] * 1.0e-3f, xyz[indices[pi] * 3 + j], 1.0e-6f);
+				CHECK_EQUAL (xyz[indices[pi] * 3 + j], position[j]);
+			}
+		}
+	}
+
+	CHECK (data.blocks.size() <= 4);
+
+	// frames outside of the data are invalid
+	data.getFramePositions (data.getLastFrame() + 1, xyz);
+	for (size_t i = 0; i < xyz.size(); i++)
+		CHECK_EQUAL (0.f, xyz[i]);
+
+	remove (filename);
+}
+
+TEST ( TestMarkerDataRejectsEmptyTrial ) {
+	const char *filename = "marker_data_test.c3d";
+	const char *empty_filename = "marker_data_empty_test.c3d";
+	write_test_trial (filename, test_frame_count);
+	write_test_trial (empty_filename, 0);
+
+	MarkerData data;
+	CHECK (data.loadFromFile (filename));
+	unsigned int revision = data.revision;
+
+	CHECK (!data.loadFromFile (empty_filename));
+
+	// the previous data stays usable
+	CHECK_EQUAL (revision, data.revision);
+	CHECK_EQUAL (test_frame_count, data.getLastFrame() - data.getFirstFrame() + 1);
+
+	remove (filename);
+	remove (empty_filename);
+}
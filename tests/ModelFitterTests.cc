@@ -0,0 +1,298 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2016 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "Model.h"
+#include "MarkerData.h"
+#include "Animation.h"
+#include "ModelFitter.h"
+#include "C3DWriter.h"
+#include "InverseKinematics.h"
+
+#include <rbdl/rbdl.h>
+
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+
+using namespace std;
+
+const double TEST_PREC = 1.0e-4;
+
+static const int test_frame_count = 30;
+static const double test_frame_rate = 100.;
+
+/// Chain of three bodies with revolute joints and three markers each
+static void write_test_model (const char *filename) {
+	ofstream model_file (filename);
+
+	const char* parents[3] = { "ROOT", "body0", "body1" };
+	const char* joints[3] = { "{ 0, 0, 1, 0, 0, 0 }", "{ 1, 0, 0, 0, 0, 0 }", "{ 0, 1, 0, 0, 0, 0 }" };
+
+	model_file << "return {" << endl << "\tframes = {" << endl;
+	for (int b = 0; b < 3; b++) {
+		model_file << "\t\t{" << endl
+			<< "\t\t\tname = \"body" << b << "\"," << endl
+			<< "\t\t\tparent = \"" << parents[b] << "\"," << endl
+			<< "\t\t\tjoint = { " << joints[b] << " }," << endl
+			<< "\t\t\tjoint_frame = { r = { 0, 0, " << (b == 0 ? 1. : -0.4) << " } }," << endl
+			<< "\t\t\tbody = { mass = 1., com = { 0., 0., -0.2 }, inertia = { { 0.1, 0., 0. }, { 0., 0.1, 0. }, { 0., 0., 0.1 } } }," << endl
+			<< "\t\t\tmarkers = {" << endl
+			<< "\t\t\t\tB" << b << "M0 = { 0.08, 0., -0.1 }," << endl
+			<< "\t\t\t\tB" << b << "M1 = { 0., 0.08, -0.2 }," << endl
+			<< "\t\t\t\tB" << b << "M2 = { -0.08, 0., -0.3 }," << endl
+			<< "\t\t\t}," << endl
+			<< "\t\t}," << endl;
+	}
+	model_file << "\t}" << endl << "}" << endl;
+}
+
+/// Marker B2M2 only has valid data in a few frames
+static bool test_marker_valid (const string &name, int frame) {
+	return name != "B2M2" || (frame >= 10 && frame <= 15);
+}
+
+static void test_state (int frame, VectorNd &q) {
+	double t = frame / test_frame_rate;
+	for (unsigned int i = 0; i < q.size(); i++)
+		q[i] = 0.4 * sin (2. * M_PI * (0.5 + 0.2 * i) * t + i);
+}
+
+/// Writes the marker trajectories of test_state() in millimeters
+static void write_test_data (Model &model, const char *filename) {
+	RigidBodyDynamics::Model &rbdl_model = *model.rbdlModel;
+	VectorNd q = VectorNd::Zero (rbdl_model.q_size);
+	rbdlVectorNd rbdl_q (rbdl_model.q_size);
+
+	vector<string> labels;
+	vector<float> xyz;
+	for (int frame = 0; frame < test_frame_count; frame++) {
+		test_state (frame, q);
+		for (unsigned int i = 0; i < q.size(); i++)
+			rbdl_q[i] = q[i];
+		RigidBodyDynamics::UpdateKinematicsCustom (rbdl_model, &rbdl_q, NULL, NULL);
+
+		for (unsigned int frame_id = 1; frame_id <= 3; frame_id++) {
+			vector<string> names = model.getFrameMarkerNames (frame_id);
+			vector<Vector3f> coords = model.getFrameMarkerCoords (frame_id);
+			for (unsigned int mi = 0; mi < names.size(); mi++) {
+				if (frame == 0)
+					labels.push_back (names[mi]);
+
+				rbdlVector3d body_point (coords[mi][0], coords[mi][1], coords[mi][2]);
+				rbdlVector3d position = RigidBodyDynamics::CalcBodyToBaseCoordinates (rbdl_model, rbdl_q, model.frameIdToRbdlId[frame_id], body_point, false);
+				if (!test_marker_valid (names[mi], frame))
+					position.setZero();
+				for (unsigned int j = 0; j < 3; j++)
+					xyz.push_back (static_cast<float>(position[j] * 1.0e3));
+			}
+		}
+	}
+
+	CHECK (C3DWriter::writePoints (filename, labels, xyz, static_cast<float>(test_frame_rate)));
+}
+
+static void check_animations_close (Animation &expected, Animation &actual, double precision) {
+	CHECK_EQUAL (expected.keyFrames.size(), actual.keyFrames.size());
+
+	for (size_t i = 0; i < expected.keyFrames.size() && i < actual.keyFrames.size(); i++) {
+		CHECK_CLOSE (expected.keyFrames[i].time, actual.keyFrames[i].time, 1.0e-9);
+		CHECK_EQUAL (expected.keyFrames[i].state.size(), actual.keyFrames[i].state.size());
+		CHECK_ARRAY_CLOSE (expected.keyFrames[i].state.data(), actual.keyFrames[i].state.data(), expected.keyFrames[i].state.size(), precision);
+	}
+}
+
+/// Model and marker data of the synthetic trial
+struct TrialFixture {
+	TrialFixture () :
+		modelFilename ("model_fitter_test.lua"),
+		dataFilename ("model_fitter_test.c3d"),
+		logFilename ("model_fitter_test_log.csv") {
+		write_test_model (modelFilename);
+		CHECK (model.loadFromFile (modelFilename));
+		write_test_data (model, dataFilename);
+		CHECK (data.loadFromFile (dataFilename));
+
+		initialState = VectorNd::Zero (model.rbdlModel->q_size);
+		test_state (0, initialState);
+	}
+	~TrialFixture () {
+		remove (modelFilename);
+		remove (dataFilename);
+		remove (logFilename);
+	}
+
+	ModelFitter* createFitter (const std::string &method) {
+		ModelFitter *fitter = createModelFitter (method, &model, &data);
+		fitter->logFilename = logFilename;
+		return fitter;
+	}
+
+	const char *modelFilename;
+	const char *dataFilename;
+	const char *logFilename;
+	Model model;
+	MarkerData data;
+	VectorNd initialState;
+};
+
+TEST_FIXTURE ( TrialFixture, TestModelFitterStridedMatchesDense ) {
+	ModelFitter *fitter = createFitter ("sugihara");
+	Animation dense;
+	CHECK (fitter->computeModelAnimationFromMarkers (initialState, &dense));
+	delete fitter;
+
+	// the last stride is incomplete and the refinement may use as many
+	// steps as the keyframes
+	fitter = createFitter ("sugihara");
+	fitter->keyframeStride = 4;
+	fitter->refineSteps = 200;
+	fitter->interpolationTolerance = 0.;
+	Animation strided;
+	CHECK (fitter->computeModelAnimationFromMarkers (initialState, &strided));
+	delete fitter;
+
+	CHECK_EQUAL (static_cast<size_t>(test_frame_count), dense.keyFrames.size());
+	check_animations_close (dense, strided, TEST_PREC);
+}
+
+TEST_FIXTURE ( TrialFixture, TestModelFitterRefitMovedMarker ) {
+	const unsigned int convergence_frames = 5;
+
+	ModelFitter *fitter = createFitter ("sugihara");
+	Animation animation;
+	CHECK (fitter->refitAnimation (initialState, &animation, convergence_frames));
+	Animation previous = animation;
+
+	// B2M2 is only valid in the frames 10 to 15
+	model.setFrameMarkerCoord (3, "B2M2", Vector3f (-0.06, 0.03, -0.25));
+	CHECK (fitter->refitAnimation (initialState, &animation, convergence_frames));
+	fitter->closeLog();
+	delete fitter;
+
+	CHECK_EQUAL (previous.keyFrames.size(), animation.keyFrames.size());
+
+	for (int fi = 0; fi < static_cast<int>(animation.keyFrames.size()); fi++) {
+		if (fi >= 10 && fi <= 15 + static_cast<int>(convergence_frames))
+			continue;
+
+		CHECK_ARRAY_CLOSE (previous.keyFrames[fi].state.data(), animation.keyFrames[fi].state.data(), previous.keyFrames[fi].state.size(), 1.0e-12);
+	}
+
+	// the frames of the marker differ from the previous fit
+	CHECK ((previous.keyFrames[12].state - animation.keyFrames[12].state).norm() > TEST_PREC);
+
+	fitter = createFitter ("sugihara");
+	Animation full;
+	CHECK (fitter->computeModelAnimationFromMarkers (initialState, &full));
+	delete fitter;
+
+	check_animations_close (full, animation, TEST_PREC);
+
+	// the refitted rows replace the ones of the previous fit
+	vector<string> marker_names;
+	vector<FittingLogRow> rows;
+	CHECK (FittingLog::load (logFilename, marker_names, rows));
+	CHECK_EQUAL (static_cast<size_t>(test_frame_count), rows.size());
+	for (size_t ri = 0; ri < rows.size(); ri++) {
+		CHECK_EQUAL (static_cast<int>(ri), rows[ri].frame);
+	}
+}
+
+TEST_FIXTURE ( TrialFixture, TestSlidingWindowMatchesPerFrame ) {
+	ModelFitter *fitter = createFitter ("sugihara");
+	Animation per_frame;
+	CHECK (fitter->computeModelAnimationFromMarkers (initialState, &per_frame));
+	delete fitter;
+
+	// the last window is incomplete
+	SlidingWindowFitter window_fitter (&model, &data);
+	window_fitter.logFilename = logFilename;
+	window_fitter.windowSize = 8;
+	window_fitter.windowStep = 4;
+	window_fitter.smoothness = 1.0e-3;
+	Animation window;
+	CHECK (window_fitter.computeModelAnimationFromMarkers (initialState, &window));
+
+	// the weak smoothing only slightly pulls the noise free poses
+	check_animations_close (per_frame, window, 1.0e-3);
+}
+
+TEST_FIXTURE ( TrialFixture, TestSlidingWindowAnchoring ) {
+	// strong smoothing such that the anchor visibly pulls the first frame
+	// and only the exact block solve converges within few steps
+	const int split_frame = data.getFirstFrame() + 14;
+	const unsigned int max_steps = 20;
+
+	SlidingWindowFitter single_fitter (&model, &data, max_steps);
+	single_fitter.logFilename = logFilename;
+	single_fitter.windowSize = 8;
+	single_fitter.windowStep = 4;
+	single_fitter.smoothness = 1.;
+	Animation single;
+	CHECK (single_fitter.computeModelAnimationFromMarkers (initialState, &single));
+	CHECK_EQUAL (static_cast<size_t>(test_frame_count), single.keyFrames.size());
+
+	// the first range ends in an incomplete window, the second one
+	// continues from its last frame and is anchored to it
+	SlidingWindowFitter split_fitter (&model, &data, max_steps);
+	split_fitter.logFilename = logFilename;
+	split_fitter.windowSize = 8;
+	split_fitter.windowStep = 4;
+	split_fitter.smoothness = 1.;
+	Animation first_range;
+	CHECK (split_fitter.computeModelAnimationFromMarkers (initialState, &first_range, -1, split_frame - 1));
+	CHECK_EQUAL (14u, first_range.keyFrames.size());
+
+	// same windows as the single fit up to the first incomplete one
+	for (int fi = 0; fi < 8; fi++) {
+		CHECK_ARRAY_CLOSE (single.keyFrames[fi].state.data(), first_range.keyFrames[fi].state.data(), single.keyFrames[fi].state.size(), 1.0e-12);
+	}
+
+	VectorNd split_state = first_range.keyFrames.back().state;
+	Animation anchored;
+	CHECK (split_fitter.computeModelAnimationFromMarkers (split_state, &anchored, split_frame));
+	CHECK_EQUAL (static_cast<size_t>(test_frame_count - 14), anchored.keyFrames.size());
+
+	// a new fitter starts without an anchor
+	SlidingWindowFitter free_fitter (&model, &data, max_steps);
+	free_fitter.logFilename = logFilename;
+	free_fitter.windowSize = 8;
+	free_fitter.windowStep = 4;
+	free_fitter.smoothness = 1.;
+	Animation free_range;
+	CHECK (free_fitter.computeModelAnimationFromMarkers (split_state, &free_range, split_frame));
+	CHECK_EQUAL (anchored.keyFrames.size(), free_range.keyFrames.size());
+
+	double anchored_error = (anchored.keyFrames[0].state - single.keyFrames[14].state).norm();
+	double free_error = (free_range.keyFrames[0].state - single.keyFrames[14].state).norm();
+	CHECK (anchored_error < free_error);
+
+	// the anchor is dropped if the fit does not continue the last frame
+	Animation restarted;
+	CHECK (split_fitter.computeModelAnimationFromMarkers (split_state, &restarted, split_frame));
+	check_animations_close (free_range, restarted, 1.0e-6);
+}
@@ -0,0 +1,111 @@
+/* 
+ * Puppeteer - A Motion Capture Mapping Tool
+ * Copyright (c) 2013-2015 Martin Felis <martin.felis@iwr.uni-heidelberg.de>.
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE* 
+ */
+
+#include <UnitTest++.h>
+
+#include "StatePredictor.h"
+
+#include <iostream>
+
+using namespace std;
+
+const double TEST_PREC = 1.0e-10;
+
+VectorNd make_state (double a, double b) {
+	VectorNd result (2);
+	result << a, b;
+	return result;
+}
+
+TEST ( TestStatePredictorNone ) {
+	StatePredictor predictor;
+
+	predictor.addState (0, make_state (0., 0.));
+	predictor.addState (1, make_state (1., 2.));
+
+	CHECK_EQUAL (make_state (1., 2.), predictor.predict (2, make_state (1., 2.)));
+}
+
+TEST ( TestStatePredictorConstantVelocity ) {
+	StatePredictor predictor;
+	predictor.method = StatePredictionConstantVelocity;
+
+	predictor.addState (0, make_state (0., 0.));
+	CHECK_EQUAL (make_state (0., 0.), predictor.predict (1, make_state (0., 0.)));
+
+	predictor.addState (1, make_state (1., 2.));
+	CHECK_ARRAY_CLOSE (make_state (2., 4.).data(), predictor.predict (2, make_state (1., 2.)).data(), 2, TEST_PREC);
+}
+
+TEST ( TestStatePredictorConstantAcceleration ) {
+	StatePredictor predictor;
+	predictor.method = StatePredictionConstantAcceleration;
+
+	predictor.addState (0, make_state (0., 0.));
+	predictor.addState (1, make_state (1., 1.));
+	predictor.addState (2, make_state (4., 2.));
+
+	CHECK_ARRAY_CLOSE (make_state (9., 3.).data(), predictor.predict (3, make_state (4., 2.)).data(), 2, TEST_PREC);
+}
+
+TEST ( TestStatePredictorKalmanFollowsConstantVelocity ) {
+	StatePredictor predictor;
+	predictor.method = StatePredictionKalman;
+
+	for (int i = 0; i < 50; i++) {
+		predictor.addState (i, make_state (0.1 * i, -0.2 * i));
+	}
+
+	CHECK_ARRAY_CLOSE (make_state (5., -10.).data(), predictor.predict (50, make_state (4.9, -9.8)).data(), 2, 1.0e-3);
+}
+
+TEST ( TestStatePredictorStatic ) {
+	StatePredictor predictor;
+	predictor.method = StatePredictionConstantVelocity;
+
+	predictor.addState (0, make_state (1., 1.));
+	predictor.addState (1, make_state (1. + 1.0e-7, 1.));
+
+	CHECK_EQUAL (make_state (1. + 1.0e-7, 1.), predictor.predict (2, make_state (1. + 1.0e-7, 1.)));
+}
+
+TEST ( TestStatePredictorDiscontinuity ) {
+	StatePredictor predictor;
+	predictor.method = StatePredictionConstantVelocity;
+
+	predictor.addState (0, make_state (0., 0.));
+	predictor.addState (1, make_state (1., 2.));
+
+	// skipped frame
+	CHECK_EQUAL (make_state (1., 2.), predictor.predict (3, make_state (1., 2.)));
+
+	// different initial state
+	CHECK_EQUAL (make_state (5., 5.), predictor.predict (2, make_state (5., 5.)));
+
+	// non contiguous state resets the history
+	predictor.addState (5, make_state (3., 3.));
+	CHECK_EQUAL (1u, predictor.historyCount);
+	CHECK_EQUAL (make_state (3., 3.), predictor.predict (6, make_state (3., 3.)));
+}